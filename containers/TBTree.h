@@ -0,0 +1,1456 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of an in-memory B+ tree with the same interface as TRbTree, for
+use as the backing tree of TMap and TSet.
+
+Nodes are sized to about 512 bytes, so a lookup touches a handful of nodes
+instead of one cache line per level as in TRbTree. Keys are stored only in the
+leaves, which are linked for fast in-order iteration; inner nodes hold
+separator keys. For 32-bit integer keys the search within a node uses SSE2.
+
+Unlike TRbTree, insert and erase move keys within and between nodes, so they
+invalidate all iterators.
+
+Example:
+
+    TSet<int, std::less<int>, TBTree<int> > set;
+    TMap<int, Order, std::less<int>, TBTree<TMapPair<int, Order> > > orders;
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TBTREE_SSE2 1
+#endif
+
+// Maps a stored value to the key it is ordered by. Inner nodes store only
+// keys, so TMap specializes this for TMapPair to keep values out of them.
+//
+template <typename K>
+class TBTreeKeyOf
+{
+public:
+
+    typedef K Key;
+
+    static const Key& key(const K& value) { return value; }
+};
+
+// Search within a sorted array of keys: lowerBound is the index of the first
+// key not less than key, upperBound of the first key greater than key.
+//
+template <typename Key>
+class TBTreeSearch
+{
+public:
+
+    static size_t lowerBound(const Key* keys, size_t count, const Key& key);
+    static size_t upperBound(const Key* keys, size_t count, const Key& key);
+};
+
+#ifdef TBTREE_SSE2
+
+// Scans four keys per compare and stops at the first group that is not
+// entirely below the key; at this node size that beats a binary search, whose
+// branches are unpredictable.
+//
+class TBTreeSearchSse2
+{
+public:
+
+    static size_t lowerBound(const int32_t* keys, size_t count, int32_t key, int32_t bias);
+    static size_t upperBound(const int32_t* keys, size_t count, int32_t key, int32_t bias);
+
+private:
+
+    static size_t bitCount(int mask) { static const unsigned char bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 }; return bits[mask]; }
+};
+
+template <>
+class TBTreeSearch<int32_t>
+{
+public:
+
+    static size_t lowerBound(const int32_t* keys, size_t count, int32_t key) { return TBTreeSearchSse2::lowerBound(keys, count, key, 0); }
+    static size_t upperBound(const int32_t* keys, size_t count, int32_t key) { return TBTreeSearchSse2::upperBound(keys, count, key, 0); }
+};
+
+// unsigned order is signed order with the sign bit flipped
+template <>
+class TBTreeSearch<uint32_t>
+{
+public:
+
+    static size_t lowerBound(const uint32_t* keys, size_t count, uint32_t key) { return TBTreeSearchSse2::lowerBound(reinterpret_cast<const int32_t*>(keys), count, static_cast<int32_t>(key ^ 0x80000000u), INT32_MIN); }
+    static size_t upperBound(const uint32_t* keys, size_t count, uint32_t key) { return TBTreeSearchSse2::upperBound(reinterpret_cast<const int32_t*>(keys), count, static_cast<int32_t>(key ^ 0x80000000u), INT32_MIN); }
+};
+
+#endif
+
+// Orders values, and values against keys, by key with operator<. TBTree
+// takes no comparator, so this is its key_comp whatever TMap or TSet was given.
+//
+template <typename K, typename KeyOf>
+class TBTreeKeyLess
+{
+public:
+
+    bool operator()(const K& a, const K& b) const { return KeyOf::key(a) < KeyOf::key(b); }
+    template <typename Q> bool operator()(const K& a, const Q& b) const { return KeyOf::key(a) < b; }
+    template <typename Q> bool operator()(const Q& a, const K& b) const { return a < KeyOf::key(b); }
+};
+
+template <typename K, typename KeyOf = TBTreeKeyOf<K> > class TBTree;
+template <typename K, typename KeyOf = TBTreeKeyOf<K> > class TBTreeItr;
+template <typename K, typename KeyOf = TBTreeKeyOf<K> > class TBTreeConstItr;
+template <typename K, typename KeyOf = TBTreeKeyOf<K> > class TBTreeBuilder;
+
+template <typename K, typename KeyOf>
+class TBTreeNode
+{
+    template <typename K, typename KeyOf> friend class TBTree;
+    template <typename K, typename KeyOf> friend class TBTreeBuilder;
+
+protected:
+
+    enum { NODE_BYTES = 512 };
+
+    TBTreeNode(bool leaf) : m_leaf(leaf), m_count(0) { }
+
+    bool m_leaf;
+    uint32_t m_count;
+};
+
+template <typename K, typename KeyOf>
+class TBTreeLeaf : private TBTreeNode<K, KeyOf>
+{
+    typedef TBTreeNode<K, KeyOf> Node;
+    template <typename K, typename KeyOf> friend class TBTree;
+    template <typename K, typename KeyOf> friend class TBTreeItr;
+    template <typename K, typename KeyOf> friend class TBTreeConstItr;
+    template <typename K, typename KeyOf> friend class TBTreeBuilder;
+
+private:
+
+    enum { HEADER_BYTES = sizeof(Node) + 2 * sizeof(void*) };
+    enum { CAPACITY = (Node::NODE_BYTES - HEADER_BYTES) / sizeof(K) < 4 ? 4 : (Node::NODE_BYTES - HEADER_BYTES) / sizeof(K) };
+    enum { MIN_COUNT = CAPACITY / 2 };
+
+    TBTreeLeaf(void) : Node(true), m_prev(NULL), m_next(NULL) { }
+
+    Node* asNode(void) { return this; }
+
+    TBTreeLeaf* m_prev;
+    TBTreeLeaf* m_next;
+    K m_keys[CAPACITY];
+};
+
+template <typename K, typename KeyOf>
+class TBTreeInner : private TBTreeNode<K, KeyOf>
+{
+    typedef TBTreeNode<K, KeyOf> Node;
+    typedef typename KeyOf::Key Key;
+    template <typename K, typename KeyOf> friend class TBTree;
+    template <typename K, typename KeyOf> friend class TBTreeBuilder;
+
+private:
+
+    // m_count keys separate m_count + 1 children; every key in children[i] is
+    // less than keys[i], which is no greater than any key in children[i + 1]
+    enum { CAPACITY = (Node::NODE_BYTES - sizeof(Node) - sizeof(void*)) / (sizeof(Key) + sizeof(void*)) < 4 ? 4 : (Node::NODE_BYTES - sizeof(Node) - sizeof(void*)) / (sizeof(Key) + sizeof(void*)) };
+    enum { MIN_COUNT = CAPACITY / 2 };
+
+    TBTreeInner(void) : Node(false) { }
+
+    Node* asNode(void) { return this; }
+
+    Key m_keys[CAPACITY];
+    Node* m_children[CAPACITY + 1];
+};
+
+template <typename K, typename KeyOf>
+class TBTreeItr
+{
+    typedef TBTreeLeaf<K, KeyOf> Leaf;
+    template <typename K, typename KeyOf> friend class TBTree;
+    template <typename K, typename KeyOf> friend class TBTreeConstItr;
+
+public:
+
+    TBTreeItr(void) : m_leaf(NULL), m_pos(0) { }
+    TBTreeItr(const TBTreeItr& other) : m_leaf(other.m_leaf), m_pos(other.m_pos) { }
+
+    bool operator==(const TBTreeItr& other) const { return m_leaf == other.m_leaf && m_pos == other.m_pos; }
+    bool operator!=(const TBTreeItr& other) const { return !operator==(other); }
+    bool operator==(const TBTreeConstItr<K, KeyOf>& other) const { return m_leaf == other.m_leaf && m_pos == other.m_pos; }
+    bool operator!=(const TBTreeConstItr<K, KeyOf>& other) const { return !operator==(other); }
+    TBTreeItr& operator++(void);
+    TBTreeItr& operator--(void);
+    K& operator*(void) { return m_leaf->m_keys[m_pos]; }
+
+private:
+
+    TBTreeItr(Leaf* leaf, size_t pos) : m_leaf(leaf), m_pos(pos) { }
+
+    Leaf* m_leaf;
+    size_t m_pos;
+};
+
+template <typename K, typename KeyOf>
+class TBTreeConstItr
+{
+    typedef TBTreeLeaf<K, KeyOf> Leaf;
+    template <typename K, typename KeyOf> friend class TBTree;
+    template <typename K, typename KeyOf> friend class TBTreeItr;
+
+public:
+
+    TBTreeConstItr(void) : m_leaf(NULL), m_pos(0) { }
+    TBTreeConstItr(const TBTreeConstItr& other) : m_leaf(other.m_leaf), m_pos(other.m_pos) { }
+    TBTreeConstItr(const TBTreeItr<K, KeyOf>& other) : m_leaf(other.m_leaf), m_pos(other.m_pos) { }
+
+    bool operator==(const TBTreeConstItr& other) const { return m_leaf == other.m_leaf && m_pos == other.m_pos; }
+    bool operator!=(const TBTreeConstItr& other) const { return !operator==(other); }
+    bool operator==(const TBTreeItr<K, KeyOf>& other) const { return m_leaf == other.m_leaf && m_pos == other.m_pos; }
+    bool operator!=(const TBTreeItr<K, KeyOf>& other) const { return !operator==(other); }
+    TBTreeConstItr& operator++(void);
+    TBTreeConstItr& operator--(void);
+    const K& operator*(void) const { return m_leaf->m_keys[m_pos]; }
+
+private:
+
+    TBTreeConstItr(Leaf* leaf, size_t pos) : m_leaf(leaf), m_pos(pos) { }
+
+    Leaf* m_leaf;
+    size_t m_pos;
+};
+
+template <typename K, typename KeyOf>
+class TBTree
+{
+    typedef TBTreeNode<K, KeyOf> Node;
+    typedef TBTreeLeaf<K, KeyOf> Leaf;
+    typedef TBTreeInner<K, KeyOf> Inner;
+    typedef typename KeyOf::Key Key;
+    template <typename K, typename KeyOf> friend class TBTreeBuilder;
+
+public:
+
+    typedef TBTreeItr<K, KeyOf> iterator;
+    typedef TBTreeConstItr<K, KeyOf> const_iterator;
+    typedef TBTreeBuilder<K, KeyOf> builder;
+
+    TBTree(void);
+    ~TBTree(void);
+
+    // For TMap and TSet, which hand the backing tree their comparator. Keys
+    // here are ordered by operator< whatever compare is; they only allow
+    // std::less with a TBTree.
+    //
+    template <typename Compare> explicit TBTree(const Compare& compare);
+
+    // Copying clones the shape of other node by node in O(n), with no
+    // comparisons. Assignment copies first, so on failure this is unchanged.
+    //
+    TBTree(const TBTree& other);
+    TBTree& operator=(const TBTree& other);
+
+    // Moving and swapping exchange the trees in O(1). A move leaves the
+    // source empty when constructing, and holding this tree's old contents
+    // when assigning.
+    //
+    TBTree(TBTree&& other);
+    TBTree& operator=(TBTree&& other) { swap(other); return *this; }
+    void swap(TBTree& other);
+
+    // Insert value, or overwrite the value with an equal key. Returns where
+    // value now is and whether its key was new.
+    //
+    std::pair<iterator, bool> insert(const K& value);
+    std::pair<iterator, bool> insert(K&& value);
+
+    // The hint is ignored: descents here are only a few nodes deep, and
+    // ascending keys already land in the last leaf.
+    //
+    iterator insert_hint(iterator hint, const K& value) { return insert(value).first; }
+    iterator insert_hint(iterator hint, K&& value) { return insert(std::move(value)).first; }
+
+    // Look up key and, only if it is absent, insert a value built from args,
+    // which must have that key. Slots in a leaf are always constructed, so
+    // the value is built once and moved into its slot.
+    //
+    template <typename... Args> std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template <typename... Args> std::pair<iterator, bool> try_emplace_hint(iterator hint, const Key& key, Args&&... args) { return try_emplace(key, std::forward<Args>(args)...); }
+    void erase(const K& value);
+    void erase(iterator itr) { if (itr != end()) erase(*itr); }
+    void clear(void);
+
+    // Replace the contents with values from [first, last) in O(n). The range
+    // must be sorted; for equal keys the last one wins, as with insert. It
+    // is walked once, as leaves are allocated as they fill, so any input
+    // range will do.
+    //
+    template <typename InputItr> void assign_sorted(InputItr first, InputItr last);
+
+    // Same as assign_sorted for a range in any order, sorting a copy first.
+    //
+    template <typename InputItr> void assign_unsorted(InputItr first, InputItr last);
+
+    // Lookups take a bare key, so a TMap finds a pair without building one.
+    //
+    iterator find(const Key& key) { const_iterator itr = const_cast<const TBTree*>(this)->find(key); return iterator(itr.m_leaf, itr.m_pos); }
+    iterator lower_bound(const Key& key) { const_iterator itr = const_cast<const TBTree*>(this)->lower_bound(key); return iterator(itr.m_leaf, itr.m_pos); }
+    iterator upper_bound(const Key& key) { const_iterator itr = const_cast<const TBTree*>(this)->upper_bound(key); return iterator(itr.m_leaf, itr.m_pos); }
+    std::pair<iterator, iterator> equal_range(const Key& key) { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    iterator begin(void) { return iterator(m_first, 0); }
+    iterator end(void) { return iterator(NULL, 0); }
+    iterator last(void) { return (m_last == NULL) ? end() : iterator(m_last, m_last->m_count - 1); }
+
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    const_iterator begin(void) const { return const_iterator(m_first, 0); }
+    const_iterator end(void) const { return const_iterator(NULL, 0); }
+    const_iterator last(void) const { return (m_last == NULL) ? end() : const_iterator(m_last, m_last->m_count - 1); }
+
+    // Find keys[i] into out[i] for every i < n, end() where it is absent.
+    // Descents are only a few nodes deep, so this is a plain loop of lookups
+    // by key.
+    //
+    void find_batch(const Key* keys, size_t n, iterator* out) { findBatch(keys, n, out); }
+    void find_batch(const Key* keys, size_t n, const_iterator* out) const { findBatch(keys, n, out); }
+
+    // Call func(value) for every value with key in [lo, hi) in order.
+    //
+    template <typename Func> void for_each_in_range(const Key& lo, const Key& hi, Func func);
+    template <typename Func> void for_each_in_range(const Key& lo, const Key& hi, Func func) const;
+
+    TBTreeKeyLess<K, KeyOf> key_comp(void) const { return TBTreeKeyLess<K, KeyOf>(); }
+
+    size_t size(void) const { return m_size; }
+    size_t maxDepth(void) const { return m_depth; }
+
+private:
+
+    // enough for any tree that fits in memory, as inner nodes fan out by 4
+    // or more
+    enum { MAX_DEPTH = 48 };
+
+    typedef typename std::is_same<K, Key>::type KeyIsValue;
+
+    static bool less(const Key& a, const Key& b) { return a < b; }
+    static const Key& keyOf(const K& value) { return KeyOf::key(value); }
+
+    static size_t leafLowerBound(const Leaf* leaf, const Key& key) { return lowerBound(leaf->m_keys, leaf->m_count, key, KeyIsValue()); }
+    static size_t leafUpperBound(const Leaf* leaf, const Key& key) { return upperBound(leaf->m_keys, leaf->m_count, key, KeyIsValue()); }
+    static size_t lowerBound(const K* values, size_t count, const Key& key, std::true_type) { return TBTreeSearch<Key>::lowerBound(values, count, key); }
+    static size_t upperBound(const K* values, size_t count, const Key& key, std::true_type) { return TBTreeSearch<Key>::upperBound(values, count, key); }
+    static size_t lowerBound(const K* values, size_t count, const Key& key, std::false_type);
+    static size_t upperBound(const K* values, size_t count, const Key& key, std::false_type);
+
+    // Walk from the root to the leaf that holds or would hold key, recording
+    // the inner nodes and child slots on the way.
+    //
+    Leaf* descend(const Key& key, Inner** path, size_t* slots, size_t& depth) const;
+    template <typename Itr> void findBatch(const Key* keys, size_t n, Itr* out) const;
+
+    // Put value at pos in leaf, a NULL leaf for an empty tree, splitting the
+    // leaf if it is full.
+    //
+    iterator place(Leaf* leaf, size_t pos, K&& value, Inner** path, size_t* slots, size_t depth);
+    iterator splitLeaf(Leaf* leaf, size_t pos, K&& value, Inner** path, size_t* slots, size_t depth);
+    void insertSeparator(Inner** path, size_t* slots, size_t depth, const Key& separator, Node* child);
+
+    bool fixLeafUnderflow(Leaf* leaf, Inner* parent, size_t slot);
+    bool fixInnerUnderflow(Inner* node, Inner* parent, size_t slot);
+    void removeChild(Inner* parent, size_t keyIndex);
+
+    // Copies the subtree at node and links its leaves in order after prev,
+    // leaving prev at the last one. On a throw nothing copied is left over.
+    //
+    Node* clone(const Node* node, Leaf*& prev);
+    void destroy(Node* node);
+
+    Node* m_root;
+    Leaf* m_first;
+    Leaf* m_last;
+    size_t m_size;
+    size_t m_depth;
+};
+
+// Appends values in ascending order to full leaves, then builds the inner
+// levels bottom up. The tree is cleared on construction and holds the values
+// once finish is called. Same interface as TRbTreeBuilder.
+//
+template <typename K, typename KeyOf>
+class TBTreeBuilder
+{
+    typedef TBTreeNode<K, KeyOf> Node;
+    typedef TBTreeLeaf<K, KeyOf> Leaf;
+    typedef TBTreeInner<K, KeyOf> Inner;
+    typedef typename KeyOf::Key Key;
+    typedef TBTree<K, KeyOf> Tree;
+
+public:
+
+    TBTreeBuilder(Tree& tree, size_t capacity);
+    ~TBTreeBuilder(void) { if (!m_finished) finish(); }
+
+    void push_back(const K& value);
+    void finish(void);
+
+private:
+
+    TBTreeBuilder(const TBTreeBuilder&);
+    TBTreeBuilder& operator=(const TBTreeBuilder&);
+
+    Tree& m_tree;
+    bool m_finished;
+};
+
+#ifdef TBTREE_SSE2
+
+// TBTreeSearchSse2
+//
+inline size_t
+TBTreeSearchSse2::lowerBound(const int32_t* keys, size_t count, int32_t key, int32_t bias)
+{
+    __m128i target = _mm_set1_epi32(key);
+    __m128i flip = _mm_set1_epi32(bias);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flip);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target, block)));
+
+        if (mask != 0xf)
+            return i + bitCount(mask);
+    }
+
+    for (; i < count; i++)
+    {
+        if (!((keys[i] ^ bias) < key))
+            return i;
+    }
+
+    return count;
+}
+
+inline size_t
+TBTreeSearchSse2::upperBound(const int32_t* keys, size_t count, int32_t key, int32_t bias)
+{
+    __m128i target = _mm_set1_epi32(key);
+    __m128i flip = _mm_set1_epi32(bias);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flip);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, target)));
+
+        if (mask != 0)
+            return i + 4 - bitCount(mask);
+    }
+
+    for (; i < count; i++)
+    {
+        if (key < (keys[i] ^ bias))
+            return i;
+    }
+
+    return count;
+}
+
+#endif
+
+// TBTreeSearch
+//
+template <typename Key>
+size_t
+TBTreeSearch<Key>::lowerBound(const Key* keys, size_t count, const Key& key)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+template <typename Key>
+size_t
+TBTreeSearch<Key>::upperBound(const Key* keys, size_t count, const Key& key)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (key < keys[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+// TBTreeItr
+//
+template <typename K, typename KeyOf>
+TBTreeItr<K, KeyOf>&
+TBTreeItr<K, KeyOf>::operator++(void)
+{
+    assert(m_leaf != NULL);
+
+    if (++m_pos == m_leaf->m_count)
+    {
+        m_leaf = m_leaf->m_next;
+        m_pos = 0;
+    }
+
+    return *this;
+}
+
+template <typename K, typename KeyOf>
+TBTreeItr<K, KeyOf>&
+TBTreeItr<K, KeyOf>::operator--(void)
+{
+    assert(m_leaf != NULL);
+
+    if (m_pos > 0)
+        m_pos--;
+    else
+    {
+        m_leaf = m_leaf->m_prev;
+        m_pos = (m_leaf == NULL) ? 0 : m_leaf->m_count - 1;
+    }
+
+    return *this;
+}
+
+template <typename K, typename KeyOf>
+TBTreeConstItr<K, KeyOf>&
+TBTreeConstItr<K, KeyOf>::operator++(void)
+{
+    assert(m_leaf != NULL);
+
+    if (++m_pos == m_leaf->m_count)
+    {
+        m_leaf = m_leaf->m_next;
+        m_pos = 0;
+    }
+
+    return *this;
+}
+
+template <typename K, typename KeyOf>
+TBTreeConstItr<K, KeyOf>&
+TBTreeConstItr<K, KeyOf>::operator--(void)
+{
+    assert(m_leaf != NULL);
+
+    if (m_pos > 0)
+        m_pos--;
+    else
+    {
+        m_leaf = m_leaf->m_prev;
+        m_pos = (m_leaf == NULL) ? 0 : m_leaf->m_count - 1;
+    }
+
+    return *this;
+}
+
+// TBTree
+//
+template <typename K, typename KeyOf>
+TBTree<K, KeyOf>::TBTree(void)
+    : m_root(NULL), m_first(NULL), m_last(NULL), m_size(0), m_depth(0)
+{ }
+
+template <typename K, typename KeyOf>
+template <typename Compare>
+TBTree<K, KeyOf>::TBTree(const Compare& compare)
+    : m_root(NULL), m_first(NULL), m_last(NULL), m_size(0), m_depth(0)
+{ }
+
+template <typename K, typename KeyOf>
+TBTree<K, KeyOf>::TBTree(const TBTree& other)
+    : m_root(NULL), m_first(NULL), m_last(NULL), m_size(0), m_depth(0)
+{
+    if (other.m_root == NULL)
+        return;
+
+    Leaf* prev = NULL;
+
+    m_root = clone(other.m_root, prev);
+    m_last = prev;
+    m_size = other.m_size;
+    m_depth = other.m_depth;
+}
+
+template <typename K, typename KeyOf>
+TBTree<K, KeyOf>::TBTree(TBTree&& other)
+    : m_root(NULL), m_first(NULL), m_last(NULL), m_size(0), m_depth(0)
+{
+    swap(other);
+}
+
+template <typename K, typename KeyOf>
+TBTree<K, KeyOf>::~TBTree(void)
+{
+    clear();
+}
+
+template <typename K, typename KeyOf>
+TBTree<K, KeyOf>&
+TBTree<K, KeyOf>::operator=(const TBTree& other)
+{
+    if (this != &other)
+    {
+        TBTree copy(other);
+        swap(copy);
+    }
+
+    return *this;
+}
+
+template <typename K, typename KeyOf>
+void
+TBTree<K, KeyOf>::swap(TBTree& other)
+{
+    std::swap(m_root, other.m_root);
+    std::swap(m_first, other.m_first);
+    std::swap(m_last, other.m_last);
+    std::swap(m_size, other.m_size);
+    std::swap(m_depth, other.m_depth);
+}
+
+template <typename K, typename KeyOf>
+std::pair<typename TBTree<K, KeyOf>::iterator, bool>
+TBTree<K, KeyOf>::insert(const K& value)
+{
+    std::pair<iterator, bool> result = try_emplace(keyOf(value), value);
+
+    if (!result.second)
+        *result.first = value;
+
+    return result;
+}
+
+template <typename K, typename KeyOf>
+std::pair<typename TBTree<K, KeyOf>::iterator, bool>
+TBTree<K, KeyOf>::insert(K&& value)
+{
+    // try_emplace reads the key before it moves from value, and only moves
+    // from it if the key is new
+    std::pair<iterator, bool> result = try_emplace(keyOf(value), std::move(value));
+
+    if (!result.second)
+        *result.first = std::move(value);
+
+    return result;
+}
+
+template <typename K, typename KeyOf>
+template <typename... Args>
+std::pair<typename TBTree<K, KeyOf>::iterator, bool>
+TBTree<K, KeyOf>::try_emplace(const Key& key, Args&&... args)
+{
+    Inner* path[MAX_DEPTH];
+    size_t slots[MAX_DEPTH];
+    size_t depth = 0;
+    Leaf* leaf = NULL;
+    size_t pos = 0;
+
+    if (m_root != NULL)
+    {
+        leaf = descend(key, path, slots, depth);
+        pos = leafLowerBound(leaf, key);
+
+        if (pos < leaf->m_count && !less(key, keyOf(leaf->m_keys[pos])))
+            return std::make_pair(iterator(leaf, pos), false);
+    }
+
+    return std::make_pair(place(leaf, pos, K(std::forward<Args>(args)...), path, slots, depth), true);
+}
+
+template <typename K, typename KeyOf>
+void
+TBTree<K, KeyOf>::erase(const K& value)
+{
+    if (m_root == NULL)
+        return;
+
+    Inner* path[MAX_DEPTH];
+    size_t slots[MAX_DEPTH];
+    size_t depth = 0;
+
+    const Key& key = keyOf(value);
+    Leaf* leaf = descend(key, path, slots, depth);
+    size_t pos = leafLowerBound(leaf, key);
+
+    if (pos == leaf->m_count || less(key, keyOf(leaf->m_keys[pos])))
+        return;
+
+    for (size_t i = pos + 1; i < leaf->m_count; i++)
+        leaf->m_keys[i - 1] = std::move(leaf->m_keys[i]);
+
+    leaf->m_count--;
+    m_size--;
+
+    if (depth == 0)
+    {
+        if (leaf->m_count == 0)
+        {
+            delete leaf;
+            m_root = NULL;
+            m_first = NULL;
+            m_last = NULL;
+            m_depth = 0;
+        }
+
+        return;
+    }
+
+    if (leaf->m_count >= Leaf::MIN_COUNT || !fixLeafUnderflow(leaf, path[depth - 1], slots[depth - 1]))
+        return;
+
+    // a merge took a child from the parent, which may underflow in turn
+    for (size_t level = depth - 1; level > 0; level--)
+    {
+        Inner* node = path[level];
+
+        if (node->m_count >= Inner::MIN_COUNT || !fixInnerUnderflow(node, path[level - 1], slots[level - 1]))
+            return;
+    }
+
+    Inner* root = path[0];
+
+    if (root->m_count == 0)
+    {
+        m_root = root->m_children[0];
+        m_depth--;
+        delete root;
+    }
+}
+
+template <typename K, typename KeyOf>
+void
+TBTree<K, KeyOf>::clear(void)
+{
+    if (m_root != NULL)
+        destroy(m_root);
+
+    m_root = NULL;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+    m_depth = 0;
+}
+
+template <typename K, typename KeyOf>
+template <typename InputItr>
+void
+TBTree<K, KeyOf>::assign_sorted(InputItr first, InputItr last)
+{
+    // the builder takes no memory up front, so the range need not be counted
+    builder builder(*this, 0);
+
+    for (InputItr itr = first; itr != last; ++itr)
+        builder.push_back(*itr);
+
+    builder.finish();
+}
+
+template <typename K, typename KeyOf>
+template <typename InputItr>
+void
+TBTree<K, KeyOf>::assign_unsorted(InputItr first, InputItr last)
+{
+    std::vector<K> values;
+
+    for (InputItr itr = first; itr != last; ++itr)
+        values.push_back(*itr);
+
+    // stable so that the last of equal keys still wins
+    std::stable_sort(values.begin(), values.end(), [](const K& a, const K& b) { return less(keyOf(a), keyOf(b)); });
+    assign_sorted(values.begin(), values.end());
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::const_iterator
+TBTree<K, KeyOf>::find(const Key& key) const
+{
+    const_iterator itr = lower_bound(key);
+
+    if (itr.m_leaf == NULL || less(key, keyOf(*itr)))
+        return end();
+
+    return itr;
+}
+
+template <typename K, typename KeyOf>
+template <typename Itr>
+void
+TBTree<K, KeyOf>::findBatch(const Key* keys, size_t n, Itr* out) const
+{
+    Inner* path[MAX_DEPTH];
+    size_t slots[MAX_DEPTH];
+
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = Itr(NULL, 0);
+
+        if (m_root == NULL)
+            continue;
+
+        size_t depth = 0;
+        Leaf* leaf = descend(keys[i], path, slots, depth);
+        size_t pos = leafLowerBound(leaf, keys[i]);
+
+        if (pos < leaf->m_count && !less(keys[i], keyOf(leaf->m_keys[pos])))
+            out[i] = Itr(leaf, pos);
+    }
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::const_iterator
+TBTree<K, KeyOf>::lower_bound(const Key& key) const
+{
+    if (m_root == NULL)
+        return end();
+
+    Inner* path[MAX_DEPTH];
+    size_t slots[MAX_DEPTH];
+    size_t depth = 0;
+
+    Leaf* leaf = descend(key, path, slots, depth);
+    size_t pos = leafLowerBound(leaf, key);
+
+    // all keys in later leaves are greater
+    if (pos == leaf->m_count)
+        return const_iterator(leaf->m_next, 0);
+
+    return const_iterator(leaf, pos);
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::const_iterator
+TBTree<K, KeyOf>::upper_bound(const Key& key) const
+{
+    if (m_root == NULL)
+        return end();
+
+    Inner* path[MAX_DEPTH];
+    size_t slots[MAX_DEPTH];
+    size_t depth = 0;
+
+    Leaf* leaf = descend(key, path, slots, depth);
+    size_t pos = leafUpperBound(leaf, key);
+
+    if (pos == leaf->m_count)
+        return const_iterator(leaf->m_next, 0);
+
+    return const_iterator(leaf, pos);
+}
+
+template <typename K, typename KeyOf>
+template <typename Func>
+void
+TBTree<K, KeyOf>::for_each_in_range(const Key& lo, const Key& hi, Func func)
+{
+    iterator itr = lower_bound(lo);
+    Leaf* leaf = itr.m_leaf;
+    size_t pos = itr.m_pos;
+
+    for (; leaf != NULL; leaf = leaf->m_next, pos = 0)
+    {
+        for (; pos < leaf->m_count; pos++)
+        {
+            if (!less(keyOf(leaf->m_keys[pos]), hi))
+                return;
+
+            func(leaf->m_keys[pos]);
+        }
+    }
+}
+
+template <typename K, typename KeyOf>
+template <typename Func>
+void
+TBTree<K, KeyOf>::for_each_in_range(const Key& lo, const Key& hi, Func func) const
+{
+    const_iterator itr = lower_bound(lo);
+    const Leaf* leaf = itr.m_leaf;
+    size_t pos = itr.m_pos;
+
+    for (; leaf != NULL; leaf = leaf->m_next, pos = 0)
+    {
+        for (; pos < leaf->m_count; pos++)
+        {
+            if (!less(keyOf(leaf->m_keys[pos]), hi))
+                return;
+
+            func(static_cast<const K&>(leaf->m_keys[pos]));
+        }
+    }
+}
+
+template <typename K, typename KeyOf>
+size_t
+TBTree<K, KeyOf>::lowerBound(const K* values, size_t count, const Key& key, std::false_type)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (less(keyOf(values[mid]), key))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+template <typename K, typename KeyOf>
+size_t
+TBTree<K, KeyOf>::upperBound(const K* values, size_t count, const Key& key, std::false_type)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (less(key, keyOf(values[mid])))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::Leaf*
+TBTree<K, KeyOf>::descend(const Key& key, Inner** path, size_t* slots, size_t& depth) const
+{
+    Node* node = m_root;
+    depth = 0;
+
+    while (!node->m_leaf)
+    {
+        Inner* inner = static_cast<Inner*>(node);
+        size_t slot = TBTreeSearch<Key>::upperBound(inner->m_keys, inner->m_count, key);
+
+        path[depth] = inner;
+        slots[depth] = slot;
+        depth++;
+
+        node = inner->m_children[slot];
+    }
+
+    return static_cast<Leaf*>(node);
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::iterator
+TBTree<K, KeyOf>::place(Leaf* leaf, size_t pos, K&& value, Inner** path, size_t* slots, size_t depth)
+{
+    m_size++;
+
+    if (leaf == NULL)
+    {
+        leaf = new Leaf();
+        leaf->m_keys[0] = std::move(value);
+        leaf->m_count = 1;
+
+        m_root = leaf->asNode();
+        m_first = leaf;
+        m_last = leaf;
+        m_depth = 1;
+        return iterator(leaf, 0);
+    }
+
+    if (leaf->m_count == Leaf::CAPACITY)
+        return splitLeaf(leaf, pos, std::move(value), path, slots, depth);
+
+    for (size_t i = leaf->m_count; i > pos; i--)
+        leaf->m_keys[i] = std::move(leaf->m_keys[i - 1]);
+
+    leaf->m_keys[pos] = std::move(value);
+    leaf->m_count++;
+    return iterator(leaf, pos);
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::iterator
+TBTree<K, KeyOf>::splitLeaf(Leaf* leaf, size_t pos, K&& value, Inner** path, size_t* slots, size_t depth)
+{
+    Leaf* right = new Leaf();
+    size_t mid = Leaf::CAPACITY / 2;
+
+    for (size_t i = mid; i < Leaf::CAPACITY; i++)
+        right->m_keys[i - mid] = std::move(leaf->m_keys[i]);
+
+    right->m_count = Leaf::CAPACITY - mid;
+    leaf->m_count = mid;
+
+    Leaf* target = (pos <= mid) ? leaf : right;
+    size_t targetPos = (pos <= mid) ? pos : pos - mid;
+
+    for (size_t i = target->m_count; i > targetPos; i--)
+        target->m_keys[i] = std::move(target->m_keys[i - 1]);
+
+    target->m_keys[targetPos] = std::move(value);
+    target->m_count++;
+
+    right->m_prev = leaf;
+    right->m_next = leaf->m_next;
+
+    if (leaf->m_next != NULL)
+        leaf->m_next->m_prev = right;
+    else
+        m_last = right;
+
+    leaf->m_next = right;
+
+    // only inner nodes change from here on
+    insertSeparator(path, slots, depth, keyOf(right->m_keys[0]), right->asNode());
+    return iterator(target, targetPos);
+}
+
+template <typename K, typename KeyOf>
+void
+TBTree<K, KeyOf>::insertSeparator(Inner** path, size_t* slots, size_t depth, const Key& separator, Node* child)
+{
+    Key key = separator;
+
+    // child is the new right sibling of the child at slots[depth - 1]
+    while (depth > 0)
+    {
+        depth--;
+        Inner* parent = path[depth];
+        size_t slot = slots[depth];
+
+        if (parent->m_count < Inner::CAPACITY)
+        {
+            for (size_t i = parent->m_count; i > slot; i--)
+            {
+                parent->m_keys[i] = std::move(parent->m_keys[i - 1]);
+                parent->m_children[i + 1] = parent->m_children[i];
+            }
+
+            parent->m_keys[slot] = std::move(key);
+            parent->m_children[slot + 1] = child;
+            parent->m_count++;
+            return;
+        }
+
+        // split a full inner node: lay out all keys and children including
+        // the new ones, keep the lower half, push the middle key up and move
+        // the upper half to a new node
+        Key keys[Inner::CAPACITY + 1];
+        Node* children[Inner::CAPACITY + 2];
+
+        for (size_t i = 0, j = 0; i <= Inner::CAPACITY; i++)
+            keys[i] = (i == slot) ? std::move(key) : std::move(parent->m_keys[j++]);
+
+        for (size_t i = 0, j = 0; i <= Inner::CAPACITY + 1; i++)
+            children[i] = (i == slot + 1) ? child : parent->m_children[j++];
+
+        Inner* right = new Inner();
+        size_t mid = (Inner::CAPACITY + 1) / 2;
+
+        for (size_t i = 0; i < mid; i++)
+        {
+            parent->m_keys[i] = std::move(keys[i]);
+            parent->m_children[i] = children[i];
+        }
+
+        parent->m_children[mid] = children[mid];
+        parent->m_count = mid;
+
+        for (size_t i = mid + 1; i <= Inner::CAPACITY; i++)
+        {
+            right->m_keys[i - mid - 1] = std::move(keys[i]);
+            right->m_children[i - mid - 1] = children[i];
+        }
+
+        right->m_children[Inner::CAPACITY - mid] = children[Inner::CAPACITY + 1];
+        right->m_count = Inner::CAPACITY - mid;
+
+        key = std::move(keys[mid]);
+        child = right->asNode();
+    }
+
+    Inner* root = new Inner();
+    root->m_keys[0] = std::move(key);
+    root->m_children[0] = m_root;
+    root->m_children[1] = child;
+    root->m_count = 1;
+
+    m_root = root->asNode();
+    m_depth++;
+}
+
+template <typename K, typename KeyOf>
+bool
+TBTree<K, KeyOf>::fixLeafUnderflow(Leaf* leaf, Inner* parent, size_t slot)
+{
+    Leaf* left = (slot > 0) ? static_cast<Leaf*>(parent->m_children[slot - 1]) : NULL;
+    Leaf* right = (slot < parent->m_count) ? static_cast<Leaf*>(parent->m_children[slot + 1]) : NULL;
+
+    if (left != NULL && left->m_count > Leaf::MIN_COUNT)
+    {
+        for (size_t i = leaf->m_count; i > 0; i--)
+            leaf->m_keys[i] = std::move(leaf->m_keys[i - 1]);
+
+        leaf->m_keys[0] = std::move(left->m_keys[left->m_count - 1]);
+        leaf->m_count++;
+        left->m_count--;
+        parent->m_keys[slot - 1] = keyOf(leaf->m_keys[0]);
+        return false;
+    }
+
+    if (right != NULL && right->m_count > Leaf::MIN_COUNT)
+    {
+        leaf->m_keys[leaf->m_count++] = std::move(right->m_keys[0]);
+
+        for (size_t i = 1; i < right->m_count; i++)
+            right->m_keys[i - 1] = std::move(right->m_keys[i]);
+
+        right->m_count--;
+        parent->m_keys[slot] = keyOf(right->m_keys[0]);
+        return false;
+    }
+
+    // merge into the left one of the pair and drop the right one
+    if (left == NULL)
+    {
+        left = leaf;
+        leaf = right;
+        slot++;
+    }
+
+    for (size_t i = 0; i < leaf->m_count; i++)
+        left->m_keys[left->m_count + i] = std::move(leaf->m_keys[i]);
+
+    left->m_count += leaf->m_count;
+    left->m_next = leaf->m_next;
+
+    if (leaf->m_next != NULL)
+        leaf->m_next->m_prev = left;
+    else
+        m_last = left;
+
+    delete leaf;
+    removeChild(parent, slot - 1);
+    return true;
+}
+
+template <typename K, typename KeyOf>
+bool
+TBTree<K, KeyOf>::fixInnerUnderflow(Inner* node, Inner* parent, size_t slot)
+{
+    Inner* left = (slot > 0) ? static_cast<Inner*>(parent->m_children[slot - 1]) : NULL;
+    Inner* right = (slot < parent->m_count) ? static_cast<Inner*>(parent->m_children[slot + 1]) : NULL;
+
+    // borrowing rotates a key through the parent
+    if (left != NULL && left->m_count > Inner::MIN_COUNT)
+    {
+        node->m_children[node->m_count + 1] = node->m_children[node->m_count];
+
+        for (size_t i = node->m_count; i > 0; i--)
+        {
+            node->m_keys[i] = std::move(node->m_keys[i - 1]);
+            node->m_children[i] = node->m_children[i - 1];
+        }
+
+        node->m_keys[0] = std::move(parent->m_keys[slot - 1]);
+        node->m_children[0] = left->m_children[left->m_count];
+        node->m_count++;
+
+        parent->m_keys[slot - 1] = std::move(left->m_keys[left->m_count - 1]);
+        left->m_count--;
+        return false;
+    }
+
+    if (right != NULL && right->m_count > Inner::MIN_COUNT)
+    {
+        node->m_keys[node->m_count] = std::move(parent->m_keys[slot]);
+        node->m_children[node->m_count + 1] = right->m_children[0];
+        node->m_count++;
+
+        parent->m_keys[slot] = std::move(right->m_keys[0]);
+
+        for (size_t i = 1; i < right->m_count; i++)
+        {
+            right->m_keys[i - 1] = std::move(right->m_keys[i]);
+            right->m_children[i - 1] = right->m_children[i];
+        }
+
+        right->m_children[right->m_count - 1] = right->m_children[right->m_count];
+        right->m_count--;
+        return false;
+    }
+
+    // merge into the left one of the pair, pulling the separator down
+    if (left == NULL)
+    {
+        left = node;
+        node = right;
+        slot++;
+    }
+
+    left->m_keys[left->m_count] = std::move(parent->m_keys[slot - 1]);
+
+    for (size_t i = 0; i < node->m_count; i++)
+    {
+        left->m_keys[left->m_count + 1 + i] = std::move(node->m_keys[i]);
+        left->m_children[left->m_count + 1 + i] = node->m_children[i];
+    }
+
+    left->m_children[left->m_count + 1 + node->m_count] = node->m_children[node->m_count];
+    left->m_count += 1 + node->m_count;
+
+    delete node;
+    removeChild(parent, slot - 1);
+    return true;
+}
+
+template <typename K, typename KeyOf>
+void
+TBTree<K, KeyOf>::removeChild(Inner* parent, size_t keyIndex)
+{
+    // drops keys[keyIndex] and the child to its right
+    for (size_t i = keyIndex + 1; i < parent->m_count; i++)
+    {
+        parent->m_keys[i - 1] = std::move(parent->m_keys[i]);
+        parent->m_children[i] = parent->m_children[i + 1];
+    }
+
+    parent->m_count--;
+}
+
+template <typename K, typename KeyOf>
+typename TBTree<K, KeyOf>::Node*
+TBTree<K, KeyOf>::clone(const Node* node, Leaf*& prev)
+{
+    if (node->m_leaf)
+    {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        Leaf* copy = new Leaf();
+
+        try
+        {
+            for (size_t i = 0; i < leaf->m_count; i++)
+                copy->m_keys[i] = leaf->m_keys[i];
+        }
+        catch (...)
+        {
+            delete copy;
+            throw;
+        }
+
+        copy->m_count = leaf->m_count;
+        copy->m_prev = prev;
+
+        if (prev != NULL)
+            prev->m_next = copy;
+        else
+            m_first = copy;
+
+        prev = copy;
+        return copy->asNode();
+    }
+
+    const Inner* inner = static_cast<const Inner*>(node);
+    Inner* copy = new Inner();
+    size_t children = 0;
+
+    try
+    {
+        for (size_t i = 0; i < inner->m_count; i++)
+            copy->m_keys[i] = inner->m_keys[i];
+
+        for (; children <= inner->m_count; children++)
+            copy->m_children[children] = clone(inner->m_children[children], prev);
+    }
+    catch (...)
+    {
+        // destroy only reaches a full node's children, so free these here
+        for (size_t i = 0; i < children; i++)
+            destroy(copy->m_children[i]);
+
+        delete copy;
+        throw;
+    }
+
+    copy->m_count = inner->m_count;
+    return copy->asNode();
+}
+
+template <typename K, typename KeyOf>
+void
+TBTree<K, KeyOf>::destroy(Node* node)
+{
+    if (node->m_leaf)
+    {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+
+    for (size_t i = 0; i <= inner->m_count; i++)
+        destroy(inner->m_children[i]);
+
+    delete inner;
+}
+
+// TBTreeBuilder
+//
+template <typename K, typename KeyOf>
+TBTreeBuilder<K, KeyOf>::TBTreeBuilder(Tree& tree, size_t capacity)
+    : m_tree(tree), m_finished(false)
+{
+    m_tree.clear();
+}
+
+template <typename K, typename KeyOf>
+void
+TBTreeBuilder<K, KeyOf>::push_back(const K& value)
+{
+    assert(!m_finished);
+
+    Leaf* leaf = m_tree.m_last;
+
+    if (leaf != NULL && !Tree::less(Tree::keyOf(leaf->m_keys[leaf->m_count - 1]), Tree::keyOf(value)))
+    {
+        assert(!Tree::less(Tree::keyOf(value), Tree::keyOf(leaf->m_keys[leaf->m_count - 1])));   // input must be sorted
+        leaf->m_keys[leaf->m_count - 1] = value;
+        return;
+    }
+
+    if (leaf == NULL || leaf->m_count == Leaf::CAPACITY)
+    {
+        Leaf* newLeaf = new Leaf();
+        newLeaf->m_prev = leaf;
+
+        if (leaf != NULL)
+            leaf->m_next = newLeaf;
+        else
+            m_tree.m_first = newLeaf;
+
+        m_tree.m_last = newLeaf;
+        leaf = newLeaf;
+    }
+
+    leaf->m_keys[leaf->m_count++] = value;
+    m_tree.m_size++;
+}
+
+template <typename K, typename KeyOf>
+void
+TBTreeBuilder<K, KeyOf>::finish(void)
+{
+    assert(!m_finished);
+    m_finished = true;
+
+    Leaf* last = m_tree.m_last;
+
+    if (last == NULL)
+        return;
+
+    // the previous leaf is full, so splitting the pair evenly gives both at
+    // least MIN_COUNT
+    Leaf* prev = last->m_prev;
+
+    if (prev != NULL && last->m_count < Leaf::MIN_COUNT)
+    {
+        size_t total = prev->m_count + last->m_count;
+        size_t move = total / 2 - last->m_count;
+
+        for (size_t i = last->m_count; i > 0; i--)
+            last->m_keys[i - 1 + move] = std::move(last->m_keys[i - 1]);
+
+        for (size_t i = 0; i < move; i++)
+            last->m_keys[i] = std::move(prev->m_keys[prev->m_count - move + i]);
+
+        prev->m_count -= move;
+        last->m_count += move;
+    }
+
+    std::vector<Node*> level;
+    std::vector<Key> minKeys;
+
+    for (Leaf* leaf = m_tree.m_first; leaf != NULL; leaf = leaf->m_next)
+    {
+        level.push_back(leaf->asNode());
+        minKeys.push_back(Tree::keyOf(leaf->m_keys[0]));
+    }
+
+    size_t depth = 1;
+
+    // group each level evenly under as few inner nodes as possible
+    while (level.size() > 1)
+    {
+        size_t fanout = Inner::CAPACITY + 1;
+        size_t groups = (level.size() + fanout - 1) / fanout;
+        std::vector<Node*> parents;
+        std::vector<Key> parentMinKeys;
+
+        for (size_t g = 0, begin = 0; g < groups; g++)
+        {
+            size_t end = level.size() * (g + 1) / groups;
+            Inner* inner = new Inner();
+
+            for (size_t i = begin; i < end; i++)
+            {
+                if (i > begin)
+                    inner->m_keys[i - begin - 1] = minKeys[i];
+
+                inner->m_children[i - begin] = level[i];
+            }
+
+            inner->m_count = static_cast<uint32_t>(end - begin - 1);
+            parents.push_back(inner->asNode());
+            parentMinKeys.push_back(minKeys[begin]);
+            begin = end;
+        }
+
+        level.swap(parents);
+        minKeys.swap(parentMinKeys);
+        depth++;
+    }
+
+    m_tree.m_root = level[0];
+    m_tree.m_depth = depth;
+}
@@ -0,0 +1,910 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a compact red-black tree with the same interface as TRbTree.
+
+Nodes live in one contiguous pool and link to each other with 32-bit indices
+into it, and the color is packed into the top bit of the parent index. For a
+4-byte key a node takes 16 bytes with no per-node heap block, against 40 bytes
+plus allocator overhead for a TRbTreeNode.
+
+Each tree holds at most 2^31 - 1 nodes, the largest index the 31 bits beside
+the color bit can address; insert and assign_sorted throw std::length_error
+rather than grow past it.
+
+Because links are indices, iterators stay valid when the pool grows; as with
+TRbTree, erasing a key invalidates only iterators to that key.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+template <typename K> class TCompactRbTree;
+template <typename K> class TCompactRbTreeConstItr;
+
+template <typename K>
+class TCompactRbTreeNode
+{
+    template <typename K> friend class TCompactRbTree;
+    template <typename K> friend class TCompactRbTreeItr;
+    template <typename K> friend class TCompactRbTreeConstItr;
+
+public:
+
+    // public only so that std::vector can construct the pool
+    TCompactRbTreeNode(void) : m_parentColor(0), m_left(0), m_right(0) { }
+
+private:
+
+    static const uint32_t RED = 0x80000000u;
+    static const uint32_t INDEX_MASK = 0x7fffffffu;
+
+    uint32_t m_parentColor;     // parent index, RED bit set for red nodes
+    uint32_t m_left;
+    uint32_t m_right;
+    K m_key;
+};
+
+template <typename K>
+class TCompactRbTreeItr
+{
+    typedef TCompactRbTree<K> Tree;
+    template <typename K> friend class TCompactRbTree;
+    template <typename K> friend class TCompactRbTreeConstItr;
+
+public:
+
+    TCompactRbTreeItr(const TCompactRbTreeItr& other) : m_tree(other.m_tree), m_index(other.m_index) { }
+
+    bool operator==(const TCompactRbTreeItr& other) const { return m_index == other.m_index; }
+    bool operator!=(const TCompactRbTreeItr& other) const { return m_index != other.m_index; }
+    bool operator==(const TCompactRbTreeConstItr<K>& other) const { return m_index == other.m_index; }
+    bool operator!=(const TCompactRbTreeConstItr<K>& other) const { return m_index != other.m_index; }
+    TCompactRbTreeItr& operator++(void) { m_index = m_tree->successor(m_index); return *this; }
+    TCompactRbTreeItr& operator--(void) { m_index = m_tree->predecessor(m_index); return *this; }
+    K& operator*(void) { return m_tree->m_nodes[m_index].m_key; }
+
+private:
+
+    TCompactRbTreeItr(Tree* tree, uint32_t index) : m_tree(tree), m_index(index) { }
+
+    Tree* m_tree;
+    uint32_t m_index;
+};
+
+template <typename K>
+class TCompactRbTreeConstItr
+{
+    typedef TCompactRbTree<K> Tree;
+    template <typename K> friend class TCompactRbTree;
+    template <typename K> friend class TCompactRbTreeItr;
+
+public:
+
+    TCompactRbTreeConstItr(const TCompactRbTreeConstItr& other) : m_tree(other.m_tree), m_index(other.m_index) { }
+    TCompactRbTreeConstItr(const TCompactRbTreeItr<K>& other) : m_tree(other.m_tree), m_index(other.m_index) { }
+
+    bool operator==(const TCompactRbTreeConstItr& other) const { return m_index == other.m_index; }
+    bool operator!=(const TCompactRbTreeConstItr& other) const { return m_index != other.m_index; }
+    bool operator==(const TCompactRbTreeItr<K>& other) const { return m_index == other.m_index; }
+    bool operator!=(const TCompactRbTreeItr<K>& other) const { return m_index != other.m_index; }
+    TCompactRbTreeConstItr& operator++(void) { m_index = m_tree->successor(m_index); return *this; }
+    TCompactRbTreeConstItr& operator--(void) { m_index = m_tree->predecessor(m_index); return *this; }
+    const K& operator*(void) const { return m_tree->m_nodes[m_index].m_key; }
+
+private:
+
+    TCompactRbTreeConstItr(const Tree* tree, uint32_t index) : m_tree(tree), m_index(index) { }
+
+    const Tree* m_tree;
+    uint32_t m_index;
+};
+
+template <typename K>
+class TCompactRbTree
+{
+    typedef TCompactRbTreeNode<K> Node;
+    template <typename K> friend class TCompactRbTreeItr;
+    template <typename K> friend class TCompactRbTreeConstItr;
+
+public:
+
+    typedef TCompactRbTreeItr<K> iterator;
+    typedef TCompactRbTreeConstItr<K> const_iterator;
+
+    TCompactRbTree(void);
+
+    // Preallocate the pool for count keys.
+    //
+    void reserve(size_t count) { m_nodes.reserve(count + 1); }
+
+    // Insert key, or overwrite the equal key already present. Returns where
+    // key now is and whether it was new; a slot is taken only if it was.
+    //
+    std::pair<iterator, bool> insert(const K& key);
+
+    // Same as insert, but O(1) amortized when key belongs right before or
+    // right after hint, as in TRbTree.
+    //
+    iterator insert_hint(iterator hint, const K& key);
+
+    void erase(const K& key);
+    void erase(iterator itr);
+    void clear(void);
+
+    // Replace the contents with keys from [first, last) in O(n). The range
+    // must be sorted by operator<; for equal keys the last one wins. It is
+    // walked twice, once to count it, so it must be a forward range.
+    //
+    template <typename ForwardItr> void assign_sorted(ForwardItr first, ForwardItr last);
+
+    iterator find(const K& key) { return iterator(this, findIndex(key)); }
+    iterator lower_bound(const K& key) { return iterator(this, lowerBound(key)); }
+    iterator upper_bound(const K& key) { return iterator(this, upperBound(key)); }
+    std::pair<iterator, iterator> equal_range(const K& key) { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    iterator begin(void) { return iterator(this, m_first); }
+    iterator end(void) { return iterator(this, NIL); }
+    iterator last(void) { return iterator(this, m_last); }
+
+    const_iterator find(const K& key) const { return const_iterator(this, findIndex(key)); }
+    const_iterator lower_bound(const K& key) const { return const_iterator(this, lowerBound(key)); }
+    const_iterator upper_bound(const K& key) const { return const_iterator(this, upperBound(key)); }
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    const_iterator begin(void) const { return const_iterator(this, m_first); }
+    const_iterator end(void) const { return const_iterator(this, NIL); }
+    const_iterator last(void) const { return const_iterator(this, m_last); }
+
+    // Call func(key) for every key in [lo, hi) in order, in O(log n + k).
+    //
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func);
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func) const;
+
+    size_t size(void) const { return m_size; }
+    size_t maxDepth(void) const;
+
+    // Bytes used by the pool, including free slots and spare capacity.
+    //
+    size_t memoryUsed(void) const { return sizeof(*this) + m_nodes.capacity() * sizeof(Node); }
+
+private:
+
+    // index 0 is the sentinel, which also serves as end()
+    static const uint32_t NIL = 0;
+
+    uint32_t parent(uint32_t x) const { return m_nodes[x].m_parentColor & Node::INDEX_MASK; }
+    uint32_t& left(uint32_t x) { return m_nodes[x].m_left; }
+    uint32_t& right(uint32_t x) { return m_nodes[x].m_right; }
+    uint32_t left(uint32_t x) const { return m_nodes[x].m_left; }
+    uint32_t right(uint32_t x) const { return m_nodes[x].m_right; }
+    const K& key(uint32_t x) const { return m_nodes[x].m_key; }
+    bool isRed(uint32_t x) const { return (m_nodes[x].m_parentColor & Node::RED) != 0; }
+
+    void setParent(uint32_t x, uint32_t p) { m_nodes[x].m_parentColor = (m_nodes[x].m_parentColor & Node::RED) | p; }
+    void setRed(uint32_t x) { m_nodes[x].m_parentColor |= Node::RED; }
+    void setBlack(uint32_t x) { m_nodes[x].m_parentColor &= Node::INDEX_MASK; }
+    void copyColor(uint32_t x, uint32_t from) { if (isRed(from)) setRed(x); else setBlack(x); }
+
+    // Find key, or the parent and side a new key would attach to.
+    // locateHint does the same in O(1) when key is next to hint.
+    //
+    uint32_t locate(const K& key, uint32_t& parent, bool& left) const;
+    uint32_t locateHint(uint32_t hint, const K& key, uint32_t& parent, bool& left) const;
+    uint32_t attach(uint32_t parent, bool left, const K& key);
+
+    uint32_t allocNode(const K& key);
+    void freeNode(uint32_t x);
+
+    uint32_t successor(uint32_t x) const;
+    uint32_t predecessor(uint32_t x) const;
+    uint32_t findIndex(const K& key) const;
+    uint32_t lowerBound(const K& key) const;
+    uint32_t upperBound(const K& key) const;
+
+    void leftRotate(uint32_t x);
+    void rightRotate(uint32_t x);
+    void insertFixup(uint32_t z);
+
+    void transplant(uint32_t u, uint32_t v);
+    uint32_t minimum(uint32_t x) const;
+    uint32_t maximum(uint32_t x) const;
+    void eraseNode(uint32_t z);
+    void eraseFixup(uint32_t x);
+
+    uint32_t buildBalanced(uint32_t first, uint32_t count, uint32_t parent, size_t depth, size_t redDepth);
+    size_t maxDepth(uint32_t x, size_t depth) const;
+
+    std::vector<Node> m_nodes;
+    uint32_t m_root;
+    uint32_t m_first;
+    uint32_t m_last;
+    uint32_t m_free;    // erased slots, linked through m_left
+    size_t m_size;
+};
+
+template <typename K>
+TCompactRbTree<K>::TCompactRbTree(void)
+    : m_nodes(1), m_root(NIL), m_first(NIL), m_last(NIL), m_free(NIL), m_size(0)
+{ }
+
+template <typename K>
+std::pair<typename TCompactRbTree<K>::iterator, bool>
+TCompactRbTree<K>::insert(const K& key)
+{
+    uint32_t parent;
+    bool left;
+    uint32_t x = locate(key, parent, left);
+
+    if (x != NIL)
+    {
+        m_nodes[x].m_key = key;
+        return std::make_pair(iterator(this, x), false);
+    }
+
+    return std::make_pair(iterator(this, attach(parent, left, key)), true);
+}
+
+template <typename K>
+typename TCompactRbTree<K>::iterator
+TCompactRbTree<K>::insert_hint(iterator hint, const K& key)
+{
+    uint32_t parent;
+    bool left;
+    uint32_t x = locateHint(hint.m_index, key, parent, left);
+
+    if (x != NIL)
+    {
+        m_nodes[x].m_key = key;
+        return iterator(this, x);
+    }
+
+    return iterator(this, attach(parent, left, key));
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::erase(const K& key)
+{
+    erase(find(key));
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::erase(iterator itr)
+{
+    if (itr.m_index == NIL)
+        return;
+
+    uint32_t z = itr.m_index;
+
+    if (z == m_first)
+        m_first = successor(z);
+
+    if (z == m_last)
+        m_last = predecessor(z);
+
+    eraseNode(z);
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::clear(void)
+{
+    m_nodes.resize(1);
+    m_nodes[NIL] = Node();
+    m_root = NIL;
+    m_first = NIL;
+    m_last = NIL;
+    m_free = NIL;
+    m_size = 0;
+}
+
+template <typename K>
+template <typename ForwardItr>
+void
+TCompactRbTree<K>::assign_sorted(ForwardItr first, ForwardItr last)
+{
+    clear();
+
+    size_t count = 0;
+
+    for (ForwardItr itr = first; itr != last; ++itr)
+        count++;
+
+    if (count > Node::INDEX_MASK)
+        throw std::length_error("TCompactRbTree: more than 2^31 - 1 keys");
+
+    reserve(count);
+
+    // nodes go into the pool in key order
+    for (ForwardItr itr = first; itr != last; ++itr)
+    {
+        if (m_nodes.size() > 1 && !(m_nodes.back().m_key < *itr))
+        {
+            assert(!(*itr < m_nodes.back().m_key));     // input must be sorted
+            m_nodes.back().m_key = *itr;
+            continue;
+        }
+
+        m_nodes.push_back(Node());
+        m_nodes.back().m_key = *itr;
+    }
+
+    uint32_t nodeCount = static_cast<uint32_t>(m_nodes.size() - 1);
+
+    if (nodeCount == 0)
+        return;
+
+    // depth of the last, incomplete level: floor(log2(count + 1))
+    size_t redDepth = 0;
+
+    for (size_t n = nodeCount + 1; n > 1; n >>= 1)
+        redDepth++;
+
+    m_root = buildBalanced(1, nodeCount, NIL, 0, redDepth);
+    m_first = 1;
+    m_last = nodeCount;
+    m_size = nodeCount;
+}
+
+template <typename K>
+template <typename Func>
+void
+TCompactRbTree<K>::for_each_in_range(const K& lo, const K& hi, Func func)
+{
+    for (uint32_t x = lowerBound(lo); x != NIL && key(x) < hi; x = successor(x))
+        func(m_nodes[x].m_key);
+}
+
+template <typename K>
+template <typename Func>
+void
+TCompactRbTree<K>::for_each_in_range(const K& lo, const K& hi, Func func) const
+{
+    for (uint32_t x = lowerBound(lo); x != NIL && key(x) < hi; x = successor(x))
+        func(m_nodes[x].m_key);
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::locate(const K& key, uint32_t& parent, bool& left) const
+{
+    uint32_t y = NIL;
+    uint32_t x = m_root;
+
+    while (x != NIL)
+    {
+        y = x;
+
+        if (key < this->key(x))
+            x = this->left(x);
+        else if (this->key(x) < key)
+            x = right(x);
+        else
+            return x;
+    }
+
+    parent = y;
+    left = (y != NIL && key < this->key(y));
+    return NIL;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::locateHint(uint32_t hint, const K& key, uint32_t& parent, bool& left) const
+{
+    if (hint == NIL)
+    {
+        // after the last key
+        if (m_last == NIL || this->key(m_last) < key)
+        {
+            parent = m_last;
+            left = false;
+            return NIL;
+        }
+    }
+    else if (key < this->key(hint))
+    {
+        // between the predecessor and hint: the predecessor has no right
+        // child if hint has a left subtree, otherwise hint has no left child
+        uint32_t prev = (hint == m_first) ? NIL : predecessor(hint);
+
+        if (prev == NIL || this->key(prev) < key)
+        {
+            left = (this->left(hint) == NIL);
+            parent = left ? hint : prev;
+            return NIL;
+        }
+    }
+    else if (this->key(hint) < key)
+    {
+        uint32_t next = (hint == m_last) ? NIL : successor(hint);
+
+        if (next == NIL || key < this->key(next))
+        {
+            left = (right(hint) != NIL);
+            parent = left ? next : hint;
+            return NIL;
+        }
+    }
+    else
+        return hint;
+
+    return locate(key, parent, left);
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::attach(uint32_t parent, bool left, const K& key)
+{
+    // parent is NIL for an empty tree, otherwise its child on the given side
+    // is NIL and the new key belongs there; allocating may move the pool
+    uint32_t z = allocNode(key);
+    setParent(z, parent);
+
+    if (parent == NIL)
+        m_root = z;
+    else if (left)
+        this->left(parent) = z;
+    else
+        right(parent) = z;
+
+    if (m_first == NIL || (parent == m_first && left))
+        m_first = z;
+
+    if (m_last == NIL || (parent == m_last && !left))
+        m_last = z;
+
+    setRed(z);
+    insertFixup(z);
+    m_size++;
+    return z;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::allocNode(const K& key)
+{
+    uint32_t x = m_free;
+
+    if (x != NIL)
+    {
+        m_free = left(x);
+        m_nodes[x].m_parentColor = 0;
+        m_nodes[x].m_left = NIL;
+        m_nodes[x].m_right = NIL;
+        m_nodes[x].m_key = key;
+        return x;
+    }
+
+    if (m_nodes.size() > Node::INDEX_MASK)
+        throw std::length_error("TCompactRbTree: more than 2^31 - 1 keys");
+
+    x = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(Node());
+    m_nodes[x].m_key = key;
+    return x;
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::freeNode(uint32_t x)
+{
+    // release what the key holds now rather than on reuse
+    m_nodes[x].m_key = K();
+    left(x) = m_free;
+    m_free = x;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::successor(uint32_t x) const
+{
+    assert(x != NIL);
+
+    if (right(x) != NIL)
+        return minimum(right(x));
+
+    uint32_t y = parent(x);
+
+    while (y != NIL && x == right(y))
+    {
+        x = y;
+        y = parent(y);
+    }
+
+    return y;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::predecessor(uint32_t x) const
+{
+    assert(x != NIL);
+
+    if (left(x) != NIL)
+        return maximum(left(x));
+
+    uint32_t y = parent(x);
+
+    while (y != NIL && x == left(y))
+    {
+        x = y;
+        y = parent(y);
+    }
+
+    return y;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::findIndex(const K& key) const
+{
+    uint32_t x = m_root;
+
+    while (x != NIL)
+    {
+        if (key < this->key(x))
+            x = left(x);
+        else if (this->key(x) < key)
+            x = right(x);
+        else
+            return x;
+    }
+
+    return NIL;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::lowerBound(const K& key) const
+{
+    uint32_t x = m_root;
+    uint32_t bound = NIL;
+
+    while (x != NIL)
+    {
+        if (this->key(x) < key)
+            x = right(x);
+        else
+        {
+            bound = x;
+            x = left(x);
+        }
+    }
+
+    return bound;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::upperBound(const K& key) const
+{
+    uint32_t x = m_root;
+    uint32_t bound = NIL;
+
+    while (x != NIL)
+    {
+        if (key < this->key(x))
+        {
+            bound = x;
+            x = left(x);
+        }
+        else
+            x = right(x);
+    }
+
+    return bound;
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::leftRotate(uint32_t x)
+{
+    uint32_t y = right(x);
+    right(x) = left(y);
+
+    if (left(y) != NIL)
+        setParent(left(y), x);
+
+    uint32_t p = parent(x);
+    setParent(y, p);
+
+    if (p == NIL)
+        m_root = y;
+    else if (x == left(p))
+        left(p) = y;
+    else
+        right(p) = y;
+
+    left(y) = x;
+    setParent(x, y);
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::rightRotate(uint32_t x)
+{
+    uint32_t y = left(x);
+    left(x) = right(y);
+
+    if (right(y) != NIL)
+        setParent(right(y), x);
+
+    uint32_t p = parent(x);
+    setParent(y, p);
+
+    if (p == NIL)
+        m_root = y;
+    else if (x == right(p))
+        right(p) = y;
+    else
+        left(p) = y;
+
+    right(y) = x;
+    setParent(x, y);
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::insertFixup(uint32_t z)
+{
+    while (isRed(parent(z)))
+    {
+        uint32_t p = parent(z);
+        uint32_t g = parent(p);
+
+        if (p == left(g))
+        {
+            uint32_t y = right(g);
+
+            if (isRed(y))
+            {
+                setBlack(p);
+                setBlack(y);
+                setRed(g);
+                z = g;
+            }
+            else
+            {
+                if (z == right(p))
+                {
+                    z = p;
+                    leftRotate(z);
+                }
+
+                setBlack(parent(z));
+                setRed(parent(parent(z)));
+                rightRotate(parent(parent(z)));
+            }
+        }
+        else
+        {
+            uint32_t y = left(g);
+
+            if (isRed(y))
+            {
+                setBlack(p);
+                setBlack(y);
+                setRed(g);
+                z = g;
+            }
+            else
+            {
+                if (z == left(p))
+                {
+                    z = p;
+                    rightRotate(z);
+                }
+
+                setBlack(parent(z));
+                setRed(parent(parent(z)));
+                leftRotate(parent(parent(z)));
+            }
+        }
+    }
+
+    setBlack(m_root);
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::transplant(uint32_t u, uint32_t v)
+{
+    uint32_t p = parent(u);
+
+    if (p == NIL)
+        m_root = v;
+    else if (u == left(p))
+        left(p) = v;
+    else
+        right(p) = v;
+
+    setParent(v, p);
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::minimum(uint32_t x) const
+{
+    while (left(x) != NIL)
+        x = left(x);
+    return x;
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::maximum(uint32_t x) const
+{
+    while (right(x) != NIL)
+        x = right(x);
+    return x;
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::eraseNode(uint32_t z)
+{
+    assert(z != NIL);
+
+    uint32_t x = NIL;
+    uint32_t y = z;
+    bool yOriginalRed = isRed(y);
+
+    if (left(z) == NIL)
+    {
+        x = right(z);
+        transplant(z, right(z));
+    }
+    else if (right(z) == NIL)
+    {
+        x = left(z);
+        transplant(z, left(z));
+    }
+    else
+    {
+        y = minimum(right(z));
+        yOriginalRed = isRed(y);
+        x = right(y);
+
+        if (parent(y) == z)
+            setParent(x, y);
+        else
+        {
+            transplant(y, right(y));
+            right(y) = right(z);
+            setParent(right(y), y);
+        }
+
+        transplant(z, y);
+        left(y) = left(z);
+        setParent(left(y), y);
+        copyColor(y, z);
+    }
+
+    if (!yOriginalRed)
+        eraseFixup(x);
+
+    freeNode(z);
+    m_size--;
+}
+
+template <typename K>
+void
+TCompactRbTree<K>::eraseFixup(uint32_t x)
+{
+    while (x != m_root && !isRed(x))
+    {
+        uint32_t p = parent(x);
+
+        if (x == left(p))
+        {
+            uint32_t w = right(p);
+
+            if (isRed(w))
+            {
+                setBlack(w);
+                setRed(p);
+                leftRotate(p);
+                w = right(parent(x));
+            }
+
+            if (!isRed(left(w)) && !isRed(right(w)))
+            {
+                setRed(w);
+                x = parent(x);
+            }
+            else
+            {
+                if (!isRed(right(w)))
+                {
+                    setBlack(left(w));
+                    setRed(w);
+                    rightRotate(w);
+                    w = right(parent(x));
+                }
+
+                copyColor(w, parent(x));
+                setBlack(parent(x));
+                setBlack(right(w));
+                leftRotate(parent(x));
+                x = m_root;
+            }
+        }
+        else
+        {
+            uint32_t w = left(p);
+
+            if (isRed(w))
+            {
+                setBlack(w);
+                setRed(p);
+                rightRotate(p);
+                w = left(parent(x));
+            }
+
+            if (!isRed(right(w)) && !isRed(left(w)))
+            {
+                setRed(w);
+                x = parent(x);
+            }
+            else
+            {
+                if (!isRed(left(w)))
+                {
+                    setBlack(right(w));
+                    setRed(w);
+                    leftRotate(w);
+                    w = left(parent(x));
+                }
+
+                copyColor(w, parent(x));
+                setBlack(parent(x));
+                setBlack(left(w));
+                rightRotate(parent(x));
+                x = m_root;
+            }
+        }
+    }
+
+    setBlack(x);
+}
+
+template <typename K>
+uint32_t
+TCompactRbTree<K>::buildBalanced(uint32_t first, uint32_t count, uint32_t parent, size_t depth, size_t redDepth)
+{
+    if (count == 0)
+        return NIL;
+
+    // same shape and coloring as TRbTreeBuilder
+    uint32_t mid = count / 2;
+    uint32_t x = first + mid;
+
+    m_nodes[x].m_parentColor = (depth == redDepth) ? (parent | Node::RED) : parent;
+    left(x) = buildBalanced(first, mid, x, depth + 1, redDepth);
+    right(x) = buildBalanced(x + 1, count - mid - 1, x, depth + 1, redDepth);
+    return x;
+}
+
+template <typename K>
+size_t
+TCompactRbTree<K>::maxDepth(void) const
+{
+    return maxDepth(m_root, 0);
+}
+
+template <typename K>
+size_t
+TCompactRbTree<K>::maxDepth(uint32_t x, size_t depth) const
+{
+    if (x == NIL)
+        return depth;
+
+    size_t leftDepth = maxDepth(left(x), depth + 1);
+    size_t rightDepth = maxDepth(right(x), depth + 1);
+    return (leftDepth > rightDepth) ? leftDepth : rightDepth;
+}
@@ -0,0 +1,317 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a map container that may be shared between threads, made of
+independent TMap shards each guarded by its own lock.
+
+Keys are spread over the shards by std::hash, so threads working on different
+keys rarely wait on the same lock; keys that the comparator C treats as equal
+must therefore hash alike. Each shard counts how often its lock was taken
+and how often that meant waiting, by any operation, which shows whether more
+shards would help.
+The shards share nothing: every TMap owns its own sentinel and node pool.
+
+Lookups copy the value out, since a reference would outlive the shard lock.
+Ordered iteration merges the shards and holds every shard lock while it runs.
+
+Example:
+
+    TConcurrentMap<int, Session> sessions(64);
+    sessions.insert(id, session);           // from any thread
+
+    Session session;
+    if (sessions.find(id, session))
+        ...
+
+    sessions.update(id, [](Session& session) { session.touch(); });
+*/
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "TRbTree.h"
+#include "TMap.h"
+
+class TConcurrentMapStats
+{
+public:
+
+    TConcurrentMapStats(uint64_t acquires, uint64_t contended, size_t size) : m_acquires(acquires), m_contended(contended), m_size(size) { }
+
+    uint64_t m_acquires;                    // lock acquisitions
+    uint64_t m_contended;                   // acquisitions that had to wait
+    size_t m_size;
+};
+
+template <typename K, typename V, typename C = std::less<K>, typename Tree = TRbTree<TMapPair<K, V>, TRbTreeNoAugment, TMapKeyCompare<K, V, C> > >
+class TConcurrentMap
+{
+public:
+
+    // The shard count is rounded up to a power of two. Every shard orders
+    // its keys by a copy of compare.
+    //
+    TConcurrentMap(size_t shardCount = 16, const C& compare = C());
+    ~TConcurrentMap(void) { delete[] m_shards; }
+
+    void insert(const K& key, const V& value);
+    void erase(const K& key);
+
+    // Copy the value for key into value; returns false if key is absent.
+    //
+    bool find(const K& key, V& value) const;
+
+    // Call func(value) on the value for key under the shard lock; returns
+    // false without calling func if key is absent.
+    //
+    template <typename Func> bool update(const K& key, Func func);
+
+    // Call func(key, value) for every entry in key order. All shards are
+    // locked for the duration, so func must not call back into the map.
+    //
+    template <typename Func> void for_each(Func func) const;
+
+    size_t size(void) const;
+    size_t shard_count(void) const { return m_shardCount; }
+    TConcurrentMapStats shard_stats(size_t shard) const;
+
+private:
+
+    typedef TMap<K, V, C, Tree> Map;
+    typedef typename Map::const_iterator ConstItr;
+
+    enum { CACHE_LINE = 64 };
+
+    // The padding keeps the lock and counters of neighbouring shards off
+    // each other's cache lines.
+    //
+    class Shard
+    {
+    public:
+
+        Shard(void) : m_acquires(0), m_contended(0) { }
+
+        std::mutex m_lock;
+        std::atomic<uint64_t> m_acquires;
+        std::atomic<uint64_t> m_contended;
+        Map m_map;
+        char m_pad[CACHE_LINE];
+    };
+
+    // Locks a shard, counting the acquisition and whether it had to wait.
+    // Every lock of a shard goes through lock so that the counts are whole.
+    //
+    static void lock(Shard& shard);
+
+    class ShardLock
+    {
+    public:
+
+        ShardLock(Shard& shard) : m_shard(shard) { lock(shard); }
+        ~ShardLock(void) { m_shard.m_lock.unlock(); }
+
+    private:
+
+        ShardLock(const ShardLock&);
+        ShardLock& operator=(const ShardLock&);
+
+        Shard& m_shard;
+    };
+
+    // One shard's position in the k-way merge.
+    //
+    class Cursor
+    {
+    public:
+
+        Cursor(const ConstItr& itr, const ConstItr& end, const C& compare) : m_itr(itr), m_end(end), m_compare(&compare) { }
+
+        // a min-heap on the current key
+        bool operator<(const Cursor& other) const { return (*m_compare)(other.m_itr->first, m_itr->first); }
+
+        ConstItr m_itr;
+        ConstItr m_end;
+        const C* m_compare;
+    };
+
+    TConcurrentMap(const TConcurrentMap&);
+    TConcurrentMap& operator=(const TConcurrentMap&);
+
+    Shard& shardOf(const K& key) const;
+
+    Shard* m_shards;
+    size_t m_shardCount;
+    size_t m_shardBits;
+    C m_compare;
+};
+
+// TConcurrentMap
+//
+template <typename K, typename V, typename C, typename Tree>
+TConcurrentMap<K, V, C, Tree>::TConcurrentMap(size_t shardCount, const C& compare)
+    : m_shards(NULL), m_shardCount(1), m_shardBits(0), m_compare(compare)
+{
+    while (m_shardCount < shardCount)
+    {
+        m_shardCount <<= 1;
+        m_shardBits++;
+    }
+
+    m_shards = new Shard[m_shardCount];
+
+    for (size_t i = 0; i < m_shardCount; i++)
+    {
+        Map map(compare);
+        m_shards[i].m_map.swap(map);
+    }
+}
+
+template <typename K, typename V, typename C, typename Tree>
+void
+TConcurrentMap<K, V, C, Tree>::insert(const K& key, const V& value)
+{
+    Shard& shard = shardOf(key);
+    ShardLock lock(shard);
+    shard.m_map.insert(key, value);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+void
+TConcurrentMap<K, V, C, Tree>::erase(const K& key)
+{
+    Shard& shard = shardOf(key);
+    ShardLock lock(shard);
+    shard.m_map.erase(key);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+bool
+TConcurrentMap<K, V, C, Tree>::find(const K& key, V& value) const
+{
+    Shard& shard = shardOf(key);
+    ShardLock lock(shard);
+    const Map& map = shard.m_map;
+    ConstItr itr = map.find(key);
+
+    if (itr == map.end())
+        return false;
+
+    value = *itr;
+    return true;
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename Func>
+bool
+TConcurrentMap<K, V, C, Tree>::update(const K& key, Func func)
+{
+    Shard& shard = shardOf(key);
+    ShardLock lock(shard);
+    typename Map::iterator itr = shard.m_map.find(key);
+
+    if (itr == shard.m_map.end())
+        return false;
+
+    func(*itr);
+    return true;
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename Func>
+void
+TConcurrentMap<K, V, C, Tree>::for_each(Func func) const
+{
+    // always lock in shard order so that two iterations cannot deadlock;
+    // the guards unlock every shard even if func throws, and the room for
+    // them is reserved up front so that none is lost between lock and guard
+    std::vector<std::unique_lock<std::mutex> > locks;
+    std::vector<Cursor> heap;
+
+    locks.reserve(m_shardCount);
+    heap.reserve(m_shardCount);
+
+    for (size_t i = 0; i < m_shardCount; i++)
+    {
+        lock(m_shards[i]);
+        locks.push_back(std::unique_lock<std::mutex>(m_shards[i].m_lock, std::adopt_lock));
+
+        const Map& map = m_shards[i].m_map;
+
+        if (map.begin() != map.end())
+            heap.push_back(Cursor(map.begin(), map.end(), m_compare));
+    }
+
+    std::make_heap(heap.begin(), heap.end());
+
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end());
+        Cursor& cursor = heap.back();
+
+        func(cursor.m_itr->first, *cursor.m_itr);
+
+        if (++cursor.m_itr != cursor.m_end)
+            std::push_heap(heap.begin(), heap.end());
+        else
+            heap.pop_back();
+    }
+}
+
+template <typename K, typename V, typename C, typename Tree>
+size_t
+TConcurrentMap<K, V, C, Tree>::size(void) const
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < m_shardCount; i++)
+    {
+        ShardLock lock(m_shards[i]);
+        size += m_shards[i].m_map.size();
+    }
+
+    return size;
+}
+
+template <typename K, typename V, typename C, typename Tree>
+TConcurrentMapStats
+TConcurrentMap<K, V, C, Tree>::shard_stats(size_t shard) const
+{
+    assert(shard < m_shardCount);
+
+    Shard& s = m_shards[shard];
+    size_t size;
+
+    {
+        ShardLock lock(s);
+        size = s.m_map.size();
+    }
+
+    return TConcurrentMapStats(s.m_acquires.load(std::memory_order_relaxed), s.m_contended.load(std::memory_order_relaxed), size);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+typename TConcurrentMap<K, V, C, Tree>::Shard&
+TConcurrentMap<K, V, C, Tree>::shardOf(const K& key) const
+{
+    // std::hash is the identity for integers on common libraries, so mix
+    // the bits before taking the top ones
+    uint64_t hash = static_cast<uint64_t>(std::hash<K>()(key)) * 0x9e3779b97f4a7c15ull;
+    return m_shards[(m_shardBits == 0) ? 0 : static_cast<size_t>(hash >> (64 - m_shardBits))];
+}
+
+template <typename K, typename V, typename C, typename Tree>
+void
+TConcurrentMap<K, V, C, Tree>::lock(Shard& shard)
+{
+    if (!shard.m_lock.try_lock())
+    {
+        shard.m_contended.fetch_add(1, std::memory_order_relaxed);
+        shard.m_lock.lock();
+    }
+
+    shard.m_acquires.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,235 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of epoch-based memory reclamation for lock-free containers.
+
+A thread brackets every access to shared nodes with a TEpochGuard. A node that
+has been unlinked is handed to TEpoch::retire() and is freed only after every
+thread that could still hold a pointer to it has left its critical section.
+
+Example:
+
+    {
+        TEpochGuard guard;
+        Node* node = m_head.load();
+        ...
+        if (m_head.compare_exchange_strong(node, node->m_next))
+            TEpoch::retire(node);
+    }
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <cassert>
+
+class TEpochRecord
+{
+    friend class TEpoch;
+
+private:
+
+    // An object retired in global epoch e is safe to free once the global
+    // epoch has reached e + 2, so three limbo lists are enough.
+    //
+    enum { LIMBO_COUNT = 3 };
+
+    struct Retired
+    {
+        Retired* m_next;
+        void* m_ptr;
+        void (*m_deleter)(void*);
+    };
+
+    TEpochRecord(void) : m_epoch(0), m_inUse(true), m_next(NULL), m_depth(0), m_retireCount(0)
+    {
+        for (size_t i = 0; i < LIMBO_COUNT; i++)
+        {
+            m_limbo[i] = NULL;
+            m_limboEpoch[i] = 0;
+        }
+    }
+
+    // (epoch << 1) | 1 while inside a critical section, 0 otherwise
+    std::atomic<uint64_t> m_epoch;
+    std::atomic<bool> m_inUse;
+    TEpochRecord* m_next;
+
+    // only touched by the owning thread
+    size_t m_depth;
+    size_t m_retireCount;
+    Retired* m_limbo[LIMBO_COUNT];
+    uint64_t m_limboEpoch[LIMBO_COUNT];
+};
+
+class TEpoch
+{
+public:
+
+    static void enter(void);
+    static void leave(void);
+
+    // Must be called from inside a critical section, after ptr has been made
+    // unreachable from the shared structure.
+    //
+    static void retire(void* ptr, void (*deleter)(void*));
+
+    template <typename T>
+    static void retire(T* ptr) { retire(ptr, &deleteObject<T>); }
+
+private:
+
+    // Try to advance the global epoch every this many retires.
+    //
+    enum { ADVANCE_INTERVAL = 64 };
+
+    class ThreadRecord
+    {
+    public:
+
+        ThreadRecord(void) : m_record(NULL) { }
+        ~ThreadRecord(void) { if (m_record != NULL) m_record->m_inUse.store(false); }
+
+        TEpochRecord* m_record;
+    };
+
+    template <typename T>
+    static void deleteObject(void* ptr) { delete static_cast<T*>(ptr); }
+
+    static std::atomic<uint64_t>& globalEpoch(void) { static std::atomic<uint64_t> epoch(0); return epoch; }
+    static std::atomic<TEpochRecord*>& records(void) { static std::atomic<TEpochRecord*> head(NULL); return head; }
+
+    static TEpochRecord* threadRecord(void);
+    static TEpochRecord* acquireRecord(void);
+    static bool tryAdvance(uint64_t epoch);
+    static void freeLimbo(TEpochRecord* record, size_t index);
+};
+
+class TEpochGuard
+{
+public:
+
+    TEpochGuard(void) { TEpoch::enter(); }
+    ~TEpochGuard(void) { TEpoch::leave(); }
+
+private:
+
+    TEpochGuard(const TEpochGuard&);
+    TEpochGuard& operator=(const TEpochGuard&);
+};
+
+// TEpoch
+//
+inline TEpochRecord*
+TEpoch::threadRecord(void)
+{
+    static thread_local ThreadRecord threadRecord;
+
+    if (threadRecord.m_record == NULL)
+        threadRecord.m_record = acquireRecord();
+
+    return threadRecord.m_record;
+}
+
+inline TEpochRecord*
+TEpoch::acquireRecord(void)
+{
+    // reuse a record released by an exited thread, along with its limbo lists
+    for (TEpochRecord* record = records().load(); record != NULL; record = record->m_next)
+    {
+        bool inUse = false;
+
+        if (!record->m_inUse.load() && record->m_inUse.compare_exchange_strong(inUse, true))
+            return record;
+    }
+
+    // records are never freed, so publishing is a simple push
+    TEpochRecord* record = new TEpochRecord();
+    TEpochRecord* head = records().load();
+
+    do
+    {
+        record->m_next = head;
+    }
+    while (!records().compare_exchange_weak(head, record));
+
+    return record;
+}
+
+inline void
+TEpoch::enter(void)
+{
+    TEpochRecord* record = threadRecord();
+
+    if (record->m_depth++ == 0)
+    {
+        uint64_t epoch = globalEpoch().load();
+        record->m_epoch.store((epoch << 1) | 1);
+    }
+}
+
+inline void
+TEpoch::leave(void)
+{
+    TEpochRecord* record = threadRecord();
+    assert(record->m_depth > 0);
+
+    if (--record->m_depth == 0)
+        record->m_epoch.store(0, std::memory_order_release);
+}
+
+inline void
+TEpoch::retire(void* ptr, void (*deleter)(void*))
+{
+    TEpochRecord* record = threadRecord();
+    assert(record->m_depth > 0);
+
+    uint64_t epoch = globalEpoch().load();
+    size_t index = epoch % TEpochRecord::LIMBO_COUNT;
+
+    // the list was filled at least three epochs ago, so it is safe to free
+    if (record->m_limboEpoch[index] != epoch)
+    {
+        freeLimbo(record, index);
+        record->m_limboEpoch[index] = epoch;
+    }
+
+    TEpochRecord::Retired* retired = new TEpochRecord::Retired();
+    retired->m_ptr = ptr;
+    retired->m_deleter = deleter;
+    retired->m_next = record->m_limbo[index];
+    record->m_limbo[index] = retired;
+
+    if (++record->m_retireCount % ADVANCE_INTERVAL == 0)
+        tryAdvance(epoch);
+}
+
+inline bool
+TEpoch::tryAdvance(uint64_t epoch)
+{
+    uint64_t active = (epoch << 1) | 1;
+
+    for (TEpochRecord* record = records().load(); record != NULL; record = record->m_next)
+    {
+        uint64_t recordEpoch = record->m_epoch.load();
+
+        if (recordEpoch != 0 && recordEpoch != active)
+            return false;
+    }
+
+    return globalEpoch().compare_exchange_strong(epoch, epoch + 1);
+}
+
+inline void
+TEpoch::freeLimbo(TEpochRecord* record, size_t index)
+{
+    TEpochRecord::Retired* retired = record->m_limbo[index];
+    record->m_limbo[index] = NULL;
+
+    while (retired != NULL)
+    {
+        TEpochRecord::Retired* next = retired->m_next;
+        retired->m_deleter(retired->m_ptr);
+        delete retired;
+        retired = next;
+    }
+}
@@ -0,0 +1,398 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a singly linked list container with an STL-like interface.
+
+Each node carries only a next pointer, so for small V a node is a third smaller
+than a TList node. A tail pointer keeps push_back and splice_after O(1), which
+makes it a good fit for FIFO queues that push at one end and pop at the other.
+*/
+#pragma once
+
+#include <cassert>
+#include <utility>
+
+template <typename V>
+class TForwardListNode
+{
+    template <typename K> friend class TForwardList;
+    template <typename K> friend class TForwardListItr;
+    template <typename K> friend class TForwardListConstItr;
+
+private:
+
+    template <typename... Args>
+    TForwardListNode(Args&&... args) : m_next(NULL), m_value(std::forward<Args>(args)...) { }
+
+    TForwardListNode* m_next;
+    V m_value;
+};
+
+template <typename V>
+class TForwardListItr
+{
+    typedef TForwardListNode<V> Node;
+    template <typename K> friend class TForwardList;
+    template <typename K> friend class TForwardListConstItr;
+
+public:
+
+    TForwardListItr(const TForwardListItr& itr) : m_node(itr.m_node) { }
+
+    bool operator==(const TForwardListItr& other) const { return m_node == other.m_node; }
+    bool operator!=(const TForwardListItr& other) const { return m_node != other.m_node; }
+    bool operator==(const TForwardListConstItr<V>& other) const { return m_node == other.m_node; }
+    bool operator!=(const TForwardListConstItr<V>& other) const { return m_node != other.m_node; }
+    TForwardListItr& operator++(void) { assert(m_node != NULL); m_node = m_node->m_next; return *this; }
+    V& operator*(void) { return m_node->m_value; }
+
+private:
+
+    TForwardListItr(Node* node) : m_node(node) { }
+
+    Node* m_node;
+};
+
+template <typename V>
+class TForwardListConstItr
+{
+    typedef TForwardListNode<V> Node;
+    template <typename K> friend class TForwardList;
+    template <typename K> friend class TForwardListItr;
+
+public:
+
+    TForwardListConstItr(const TForwardListConstItr& other) : m_node(other.m_node) { }
+    TForwardListConstItr(const TForwardListItr<V>& other) : m_node(other.m_node) { }
+
+    bool operator==(const TForwardListConstItr& other) const { return m_node == other.m_node; }
+    bool operator!=(const TForwardListConstItr& other) const { return m_node != other.m_node; }
+    bool operator==(const TForwardListItr<V>& other) const { return m_node == other.m_node; }
+    bool operator!=(const TForwardListItr<V>& other) const { return m_node != other.m_node; }
+    TForwardListConstItr& operator++(void) { assert(m_node != NULL); m_node = m_node->m_next; return *this; }
+    const V& operator*(void) const { return m_node->m_value; }
+
+private:
+
+    TForwardListConstItr(Node* node) : m_node(node) { }
+
+    Node* m_node;
+};
+
+template <typename V>
+class TForwardList
+{
+    typedef TForwardListNode<V> Node;
+
+public:
+
+    typedef TForwardListItr<V> iterator;
+    typedef TForwardListConstItr<V> const_iterator;
+
+    TForwardList(void);
+    TForwardList(const TForwardList& other);
+    TForwardList(TForwardList&& other);
+    ~TForwardList(void);
+
+    TForwardList& operator=(const TForwardList& other);
+    TForwardList& operator=(TForwardList&& other);
+
+    // Exchange the contents with other in O(1); iterators keep pointing at
+    // the same nodes, now in the other list.
+    //
+    void swap(TForwardList& other);
+
+    void push_front(const V& value) { emplace_front(value); }
+    void push_back(const V& value) { emplace_back(value); }
+    void insert_after(iterator itr, const V& value) { emplace_after(itr, value); }
+
+    void push_front(V&& value) { emplace_front(std::move(value)); }
+    void push_back(V&& value) { emplace_back(std::move(value)); }
+    void insert_after(iterator itr, V&& value) { emplace_after(itr, std::move(value)); }
+
+    // Construct V in place inside the new node from args.
+    //
+    template <typename... Args> void emplace_front(Args&&... args);
+    template <typename... Args> void emplace_back(Args&&... args);
+    template <typename... Args> void emplace_after(iterator itr, Args&&... args);
+
+    // Return is void because return of V is inefficient requiring V to be
+    // copied to lvalue.
+    //
+    void pop_front(void);
+    void erase_after(iterator itr);
+    void clear(void);
+
+    // Move all nodes of other after itr, or to the front of this list when
+    // itr is end(), since there is no iterator before the first node.
+    // Leaves other empty.
+    //
+    void splice_after(iterator itr, TForwardList& other);
+
+    V& front(void);
+    V& back(void);
+
+    const V& front(void) const;
+    const V& back(void) const;
+
+    iterator begin(void) { return iterator(m_head); }
+    iterator last(void) { return iterator(m_tail); }
+    iterator end(void) { return iterator(NULL); }
+
+    const_iterator begin(void) const { return const_iterator(m_head); }
+    const_iterator last(void) const { return const_iterator(m_tail); }
+    const_iterator end(void) const { return const_iterator(NULL); }
+
+    size_t size(void) const { return m_size; }
+
+protected:
+
+    Node* m_head;
+    Node* m_tail;
+    size_t m_size;
+};
+
+template <typename V>
+TForwardList<V>::TForwardList(void)
+    : m_head(NULL), m_tail(NULL), m_size(0)
+{ }
+
+template <typename V>
+TForwardList<V>::TForwardList(const TForwardList& other)
+    : m_head(NULL), m_tail(NULL), m_size(0)
+{
+    try
+    {
+        for (Node* node = other.m_head; node != NULL; node = node->m_next)
+            emplace_back(node->m_value);
+    }
+    catch (...)
+    {
+        // the destructor does not run for a constructor that throws
+        clear();
+        throw;
+    }
+}
+
+template <typename V>
+TForwardList<V>::TForwardList(TForwardList&& other)
+    : m_head(other.m_head), m_tail(other.m_tail), m_size(other.m_size)
+{
+    other.m_head = NULL;
+    other.m_tail = NULL;
+    other.m_size = 0;
+}
+
+template <typename V>
+TForwardList<V>::~TForwardList(void)
+{
+    clear();
+}
+
+template <typename V>
+TForwardList<V>&
+TForwardList<V>::operator=(const TForwardList& other)
+{
+    if (this != &other)
+    {
+        TForwardList copy(other);
+        swap(copy);
+    }
+
+    return *this;
+}
+
+template <typename V>
+TForwardList<V>&
+TForwardList<V>::operator=(TForwardList&& other)
+{
+    if (this != &other)
+    {
+        clear();
+        swap(other);
+    }
+
+    return *this;
+}
+
+template <typename V>
+void
+TForwardList<V>::swap(TForwardList& other)
+{
+    Node* head = m_head;
+    Node* tail = m_tail;
+    size_t size = m_size;
+
+    m_head = other.m_head;
+    m_tail = other.m_tail;
+    m_size = other.m_size;
+
+    other.m_head = head;
+    other.m_tail = tail;
+    other.m_size = size;
+}
+
+template <typename V>
+template <typename... Args>
+void
+TForwardList<V>::emplace_front(Args&&... args)
+{
+    Node* newNode = new Node(std::forward<Args>(args)...);
+    newNode->m_next = m_head;
+    m_head = newNode;
+
+    if (m_tail == NULL)
+        m_tail = newNode;
+
+    m_size++;
+}
+
+template <typename V>
+template <typename... Args>
+void
+TForwardList<V>::emplace_back(Args&&... args)
+{
+    Node* newNode = new Node(std::forward<Args>(args)...);
+
+    if (m_tail == NULL)
+    {
+        assert(m_head == NULL);
+        m_head = newNode;
+    }
+    else
+    {
+        m_tail->m_next = newNode;
+    }
+
+    m_tail = newNode;
+    m_size++;
+}
+
+template <typename V>
+template <typename... Args>
+void
+TForwardList<V>::emplace_after(iterator itr, Args&&... args)
+{
+    assert(itr.m_node != NULL);
+
+    Node* newNode = new Node(std::forward<Args>(args)...);
+    newNode->m_next = itr.m_node->m_next;
+    itr.m_node->m_next = newNode;
+
+    if (m_tail == itr.m_node)
+        m_tail = newNode;
+
+    m_size++;
+}
+
+template <typename V>
+void
+TForwardList<V>::pop_front(void)
+{
+    assert(m_head != NULL);
+
+    Node* deleteNode = m_head;
+    m_head = m_head->m_next;
+
+    if (m_head == NULL)
+        m_tail = NULL;
+
+    delete deleteNode;
+    m_size--;
+}
+
+template <typename V>
+void
+TForwardList<V>::erase_after(iterator itr)
+{
+    assert(itr.m_node != NULL && itr.m_node->m_next != NULL);
+
+    Node* deleteNode = itr.m_node->m_next;
+    itr.m_node->m_next = deleteNode->m_next;
+
+    if (m_tail == deleteNode)
+        m_tail = itr.m_node;
+
+    delete deleteNode;
+    m_size--;
+}
+
+template <typename V>
+void
+TForwardList<V>::clear(void)
+{
+    Node* node = m_head;
+
+    while (node != NULL)
+    {
+        Node* deleteNode = node;
+        node = node->m_next;
+        delete deleteNode;
+    }
+
+    m_head = NULL;
+    m_tail = NULL;
+    m_size = 0;
+}
+
+template <typename V>
+void
+TForwardList<V>::splice_after(iterator itr, TForwardList& other)
+{
+    if (&other == this || other.m_head == NULL)
+        return;
+
+    if (itr.m_node == NULL)
+    {
+        other.m_tail->m_next = m_head;
+        m_head = other.m_head;
+
+        if (m_tail == NULL)
+            m_tail = other.m_tail;
+    }
+    else
+    {
+        other.m_tail->m_next = itr.m_node->m_next;
+        itr.m_node->m_next = other.m_head;
+
+        if (m_tail == itr.m_node)
+            m_tail = other.m_tail;
+    }
+
+    m_size += other.m_size;
+
+    other.m_head = NULL;
+    other.m_tail = NULL;
+    other.m_size = 0;
+}
+
+template <typename V>
+V&
+TForwardList<V>::front(void)
+{
+    assert(m_head != NULL);
+    return m_head->m_value;
+}
+
+template <typename V>
+V&
+TForwardList<V>::back(void)
+{
+    assert(m_tail != NULL);
+    return m_tail->m_value;
+}
+
+template <typename V>
+const V&
+TForwardList<V>::front(void) const
+{
+    assert(m_head != NULL);
+    return m_head->m_value;
+}
+
+template <typename V>
+const V&
+TForwardList<V>::back(void) const
+{
+    assert(m_tail != NULL);
+    return m_tail->m_value;
+}
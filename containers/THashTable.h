@@ -0,0 +1,696 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of an open-addressing hash table in the style of the Swiss
+tables of Abseil, the storage behind TUnorderedMap and TUnorderedSet.
+
+Elements live in one flat array of slots, with a control byte per slot that
+holds either 7 bits of the element's hash or EMPTY or DELETED. Slots come in
+groups of 16, and a lookup compares the 7 bits of its key against the control
+bytes of a whole group at once, with SSE2 where available, so it reads a key
+only when those bits match. The rest of the hash picks the first group, and
+groups are probed in triangular order from there until one has an EMPTY byte.
+
+The table doubles at 7/8 load. An erase leaves a DELETED tombstone only when
+the erased slot's group has no EMPTY byte: lookups stop at a group that has
+one, so none can be passing through. A group never regains an EMPTY byte
+before the next rehash, which drops the tombstones.
+
+An insert that grows the table, rehash and reserve invalidate all iterators
+and element pointers; an erase invalidates only the erased element.
+
+Keys are hashed with H and compared with E. The table mixes the hash once
+more, so std::hash, which maps integers to themselves, is good enough.
+THashTableHash and THashTableEqual hash and compare std::string by content
+and accept C strings as well, which makes string lookups transparent.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <new>
+#include <string>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define THASHTABLE_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+template <typename K>
+class THashTableHash
+{
+public:
+
+    size_t operator()(const K& key) const { return std::hash<K>()(key); }
+};
+
+template <>
+class THashTableHash<std::string>
+{
+public:
+
+    typedef void is_transparent;
+
+    size_t operator()(const std::string& key) const { return hashBytes(key.data(), key.size()); }
+    size_t operator()(const char* key) const { return hashBytes(key, strlen(key)); }
+
+private:
+
+    // eight bytes per multiply; the table mixes the result again
+    static size_t hashBytes(const char* data, size_t size)
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+        uint64_t word;
+
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            memcpy(&word, data, 8);
+            h = (h ^ word) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+
+        word = 0;
+        memcpy(&word, data, size);
+        h = (h ^ word) * 0xff51afd7ed558ccdull;
+
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+};
+
+template <typename K>
+class THashTableEqual
+{
+public:
+
+    bool operator()(const K& a, const K& b) const { return a == b; }
+};
+
+template <>
+class THashTableEqual<std::string>
+{
+public:
+
+    typedef void is_transparent;
+
+    bool operator()(const std::string& a, const std::string& b) const { return a == b; }
+    bool operator()(const std::string& a, const char* b) const { return a == b; }
+    bool operator()(const char* a, const std::string& b) const { return b == a; }
+};
+
+template <typename T>
+class THashTableVoid
+{
+public:
+
+    typedef void Type;
+};
+
+// Has Type when both H and E are transparent, i.e. when keys of type Q may
+// be looked up without building a K.
+//
+template <typename H, typename E, typename Q, typename Enable = void>
+class THashTableTransparent
+{
+};
+
+template <typename H, typename E, typename Q>
+class THashTableTransparent<H, E, Q, typename THashTableVoid<std::pair<typename H::is_transparent, typename E::is_transparent> >::Type>
+{
+public:
+
+    typedef void Type;
+};
+
+// The key of an element; TUnorderedMap specializes it for its pairs.
+//
+template <typename T>
+class THashTableKeyOf
+{
+public:
+
+    typedef T Key;
+
+    static const Key& key(const T& value) { return value; }
+};
+
+// The control bytes of one group of slots, as bit masks with bit i for slot i.
+//
+class THashTableGroup
+{
+public:
+
+    // a full slot holds 7 bits of its hash, 0 to 127; SENTINEL ends the table
+    enum { SIZE = 16, EMPTY = 0x80, DELETED = 0xfe, SENTINEL = 0xff };
+
+    explicit THashTableGroup(const uint8_t* ctrl)
+    {
+#if THASHTABLE_SSE2
+        m_ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#else
+        m_ctrl = ctrl;
+#endif
+    }
+
+    uint32_t match(uint8_t byte) const
+    {
+#if THASHTABLE_SSE2
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(m_ctrl, _mm_set1_epi8(static_cast<char>(byte)))));
+#else
+        uint32_t bits = 0;
+
+        for (size_t i = 0; i < SIZE; i++)
+            bits |= static_cast<uint32_t>(m_ctrl[i] == byte) << i;
+
+        return bits;
+#endif
+    }
+
+    uint32_t matchEmpty(void) const { return match(EMPTY); }
+
+    // EMPTY or DELETED
+    uint32_t matchFree(void) const
+    {
+#if THASHTABLE_SSE2
+        // as signed bytes, EMPTY and DELETED are the only ones below SENTINEL
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(SENTINEL)), m_ctrl)));
+#else
+        return match(EMPTY) | match(DELETED);
+#endif
+    }
+
+    static size_t lowestBit(uint32_t bits)
+    {
+#if defined(__GNUC__)
+        return static_cast<size_t>(__builtin_ctz(bits));
+#elif defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return static_cast<size_t>(index);
+#else
+        size_t index = 0;
+
+        for (; (bits & 1) == 0; bits >>= 1)
+            index++;
+
+        return index;
+#endif
+    }
+
+private:
+
+#if THASHTABLE_SSE2
+    __m128i m_ctrl;
+#else
+    const uint8_t* m_ctrl;
+#endif
+};
+
+template <typename T, typename H, typename E> class THashTable;
+template <typename T> class THashTableConstItr;
+
+template <typename T>
+class THashTableItr
+{
+    template <typename T, typename H, typename E> friend class THashTable;
+    template <typename T> friend class THashTableConstItr;
+
+public:
+
+    THashTableItr(void) : m_ctrl(NULL), m_slot(NULL) { }
+    THashTableItr(const THashTableItr& other) : m_ctrl(other.m_ctrl), m_slot(other.m_slot) { }
+
+    bool operator==(const THashTableItr& other) const { return m_ctrl == other.m_ctrl; }
+    bool operator!=(const THashTableItr& other) const { return m_ctrl != other.m_ctrl; }
+    THashTableItr& operator++(void) { m_ctrl++; m_slot++; skipFree(); return *this; }
+    T& operator*(void) const { return *m_slot; }
+    T* operator->(void) const { return m_slot; }
+
+private:
+
+    THashTableItr(uint8_t* ctrl, T* slot) : m_ctrl(ctrl), m_slot(slot) { }
+
+    // move on to the next full slot, or to the sentinel
+    void skipFree(void)
+    {
+        while (*m_ctrl >= THashTableGroup::EMPTY && *m_ctrl != THashTableGroup::SENTINEL)
+        {
+            m_ctrl++;
+            m_slot++;
+        }
+    }
+
+    uint8_t* m_ctrl;
+    T* m_slot;
+};
+
+template <typename T>
+class THashTableConstItr
+{
+    template <typename T, typename H, typename E> friend class THashTable;
+
+public:
+
+    THashTableConstItr(void) : m_ctrl(NULL), m_slot(NULL) { }
+    THashTableConstItr(const THashTableConstItr& other) : m_ctrl(other.m_ctrl), m_slot(other.m_slot) { }
+    THashTableConstItr(const THashTableItr<T>& other) : m_ctrl(other.m_ctrl), m_slot(other.m_slot) { }
+
+    bool operator==(const THashTableConstItr& other) const { return m_ctrl == other.m_ctrl; }
+    bool operator!=(const THashTableConstItr& other) const { return m_ctrl != other.m_ctrl; }
+    THashTableConstItr& operator++(void) { m_ctrl++; m_slot++; skipFree(); return *this; }
+    const T& operator*(void) const { return *m_slot; }
+    const T* operator->(void) const { return m_slot; }
+
+private:
+
+    THashTableConstItr(const uint8_t* ctrl, const T* slot) : m_ctrl(ctrl), m_slot(slot) { }
+
+    void skipFree(void)
+    {
+        while (*m_ctrl >= THashTableGroup::EMPTY && *m_ctrl != THashTableGroup::SENTINEL)
+        {
+            m_ctrl++;
+            m_slot++;
+        }
+    }
+
+    const uint8_t* m_ctrl;
+    const T* m_slot;
+};
+
+template <typename T, typename H = THashTableHash<typename THashTableKeyOf<T>::Key>, typename E = THashTableEqual<typename THashTableKeyOf<T>::Key> >
+class THashTable
+{
+    typedef THashTableKeyOf<T> KeyOf;
+    typedef THashTableGroup Group;
+
+public:
+
+    typedef THashTableItr<T> iterator;
+    typedef THashTableConstItr<T> const_iterator;
+
+    THashTable(void);
+    THashTable(const THashTable& other);
+    THashTable(THashTable&& other);
+    ~THashTable(void);
+
+    THashTable& operator=(const THashTable& other);
+    THashTable& operator=(THashTable&& other);
+
+    // Build the element from args in a free slot if key is absent; if it is
+    // present nothing is constructed. args must build an element with key.
+    //
+    template <typename Q, typename... Args> std::pair<iterator, bool> try_emplace(const Q& key, Args&&... args);
+
+    std::pair<iterator, bool> insert(const T& value) { return try_emplace(KeyOf::key(value), value); }
+    std::pair<iterator, bool> insert(T&& value) { return try_emplace(KeyOf::key(value), std::move(value)); }
+
+    template <typename Q> size_t erase(const Q& key);
+    void erase(iterator itr) { eraseSlot(static_cast<size_t>(itr.m_ctrl - m_ctrl)); }
+    void erase(const_iterator itr) { eraseSlot(static_cast<size_t>(itr.m_ctrl - m_ctrl)); }
+    void clear(void);
+
+    // O(1), swapping the slot arrays.
+    //
+    void swap(THashTable& other);
+
+    // Make room for count elements without further rehashing.
+    //
+    void reserve(size_t count);
+
+    template <typename Q> iterator find(const Q& key) { size_t slot = findSlot(key, hashOf(key)); return iterator(m_ctrl + slot, m_slots + slot); }
+    template <typename Q> const_iterator find(const Q& key) const { size_t slot = findSlot(key, hashOf(key)); return const_iterator(m_ctrl + slot, m_slots + slot); }
+
+    iterator begin(void) { iterator itr(m_ctrl, m_slots); itr.skipFree(); return itr; }
+    iterator end(void) { return iterator(m_ctrl + m_capacity, m_slots + m_capacity); }
+    const_iterator begin(void) const { const_iterator itr(m_ctrl, m_slots); itr.skipFree(); return itr; }
+    const_iterator end(void) const { return const_iterator(m_ctrl + m_capacity, m_slots + m_capacity); }
+
+    size_t size(void) const { return m_size; }
+    size_t capacity(void) const { return m_capacity; }
+
+private:
+
+    // the largest number of elements that capacity slots hold, 7/8 of them
+    static size_t maxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+    // an empty table shares this, so that begin() meets the sentinel at once
+    static uint8_t* emptyCtrl(void)
+    {
+        static uint8_t ctrl[Group::SIZE] = { Group::SENTINEL };
+        return ctrl;
+    }
+
+    template <typename Q>
+    uint64_t hashOf(const Q& key) const
+    {
+        uint64_t h = static_cast<uint64_t>(m_hash(key)) * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+    }
+
+    static uint8_t ctrlOf(uint64_t hash) { return static_cast<uint8_t>(hash & 0x7f); }
+
+    // The slot holding key, or m_capacity.
+    //
+    template <typename Q> size_t findSlot(const Q& key, uint64_t hash) const;
+
+    // The first EMPTY or DELETED slot on the probe path of hash.
+    //
+    size_t findFree(uint64_t hash) const;
+
+    void eraseSlot(size_t slot);
+    void rehash(size_t capacity);
+    void allocate(size_t capacity);
+    void destroy(void);
+
+    uint8_t* m_ctrl;
+    T* m_slots;
+    size_t m_capacity;
+    size_t m_size;
+    size_t m_growthLeft;    // EMPTY slots that may still be filled before a rehash
+    H m_hash;
+    E m_equal;
+};
+
+// THashTable
+//
+template <typename T, typename H, typename E>
+THashTable<T, H, E>::THashTable(void) : m_ctrl(emptyCtrl()), m_slots(NULL), m_capacity(0), m_size(0), m_growthLeft(0)
+{
+}
+
+// Copies keep the slot of every element, so no key is hashed again.
+//
+template <typename T, typename H, typename E>
+THashTable<T, H, E>::THashTable(const THashTable& other) : m_ctrl(emptyCtrl()), m_slots(NULL), m_capacity(0), m_size(0), m_growthLeft(0), m_hash(other.m_hash), m_equal(other.m_equal)
+{
+    if (other.m_size == 0)
+        return;
+
+    allocate(other.m_capacity);
+    memcpy(m_ctrl, other.m_ctrl, m_capacity);
+
+    size_t i = 0;
+
+    try
+    {
+        for (; i < m_capacity; i++)
+        {
+            if (m_ctrl[i] < Group::EMPTY)
+                new (m_slots + i) T(other.m_slots[i]);
+        }
+    }
+    catch (...)
+    {
+        // only the full slots before i hold elements; the destructor does
+        // not run for a constructor that throws
+        while (i-- > 0)
+        {
+            if (m_ctrl[i] < Group::EMPTY)
+                m_slots[i].~T();
+        }
+
+        ::operator delete(m_ctrl);
+        throw;
+    }
+
+    m_size = other.m_size;
+    m_growthLeft = other.m_growthLeft;
+}
+
+template <typename T, typename H, typename E>
+THashTable<T, H, E>::THashTable(THashTable&& other) : m_ctrl(emptyCtrl()), m_slots(NULL), m_capacity(0), m_size(0), m_growthLeft(0), m_hash(other.m_hash), m_equal(other.m_equal)
+{
+    swap(other);
+}
+
+template <typename T, typename H, typename E>
+THashTable<T, H, E>::~THashTable(void)
+{
+    destroy();
+}
+
+template <typename T, typename H, typename E>
+THashTable<T, H, E>&
+THashTable<T, H, E>::operator=(const THashTable& other)
+{
+    if (this != &other)
+    {
+        THashTable copy(other);
+        swap(copy);
+    }
+
+    return *this;
+}
+
+template <typename T, typename H, typename E>
+THashTable<T, H, E>&
+THashTable<T, H, E>::operator=(THashTable&& other)
+{
+    if (this != &other)
+    {
+        destroy();
+        m_ctrl = emptyCtrl();
+        m_slots = NULL;
+        m_capacity = 0;
+        m_size = 0;
+        m_growthLeft = 0;
+        swap(other);
+    }
+
+    return *this;
+}
+
+template <typename T, typename H, typename E>
+template <typename Q, typename... Args>
+std::pair<typename THashTable<T, H, E>::iterator, bool>
+THashTable<T, H, E>::try_emplace(const Q& key, Args&&... args)
+{
+    uint64_t hash = hashOf(key);
+    size_t slot = findSlot(key, hash);
+
+    if (slot != m_capacity)
+        return std::make_pair(iterator(m_ctrl + slot, m_slots + slot), false);
+
+    slot = (m_capacity != 0) ? findFree(hash) : 0;
+
+    // reusing a tombstone costs no growth
+    if (m_growthLeft == 0 && (m_capacity == 0 || m_ctrl[slot] == Group::EMPTY))
+    {
+        // grow, unless tombstones take up most of the load
+        if (m_size >= maxLoad(m_capacity) / 2)
+            rehash((m_capacity != 0) ? 2 * m_capacity : static_cast<size_t>(Group::SIZE));
+        else
+            rehash(m_capacity);
+
+        slot = findFree(hash);
+    }
+
+    new (m_slots + slot) T(std::forward<Args>(args)...);
+
+    if (m_ctrl[slot] == Group::EMPTY)
+        m_growthLeft--;
+
+    m_ctrl[slot] = ctrlOf(hash);
+    m_size++;
+
+    return std::make_pair(iterator(m_ctrl + slot, m_slots + slot), true);
+}
+
+template <typename T, typename H, typename E>
+template <typename Q>
+size_t
+THashTable<T, H, E>::erase(const Q& key)
+{
+    size_t slot = findSlot(key, hashOf(key));
+
+    if (slot == m_capacity)
+        return 0;
+
+    eraseSlot(slot);
+    return 1;
+}
+
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::clear(void)
+{
+    if (m_capacity == 0)
+        return;
+
+    for (size_t i = 0; i < m_capacity; i++)
+    {
+        if (m_ctrl[i] < Group::EMPTY)
+            m_slots[i].~T();
+    }
+
+    memset(m_ctrl, Group::EMPTY, m_capacity);
+    m_size = 0;
+    m_growthLeft = maxLoad(m_capacity);
+}
+
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::swap(THashTable& other)
+{
+    std::swap(m_ctrl, other.m_ctrl);
+    std::swap(m_slots, other.m_slots);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_size, other.m_size);
+    std::swap(m_growthLeft, other.m_growthLeft);
+    std::swap(m_hash, other.m_hash);
+    std::swap(m_equal, other.m_equal);
+}
+
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::reserve(size_t count)
+{
+    size_t capacity = Group::SIZE;
+
+    while (maxLoad(capacity) < count)
+        capacity *= 2;
+
+    if (capacity > m_capacity)
+        rehash(capacity);
+}
+
+template <typename T, typename H, typename E>
+template <typename Q>
+size_t
+THashTable<T, H, E>::findSlot(const Q& key, uint64_t hash) const
+{
+    if (m_size == 0)
+        return m_capacity;
+
+    size_t mask = m_capacity / Group::SIZE - 1;
+    size_t group = static_cast<size_t>(hash >> 7) & mask;
+    uint8_t ctrl = ctrlOf(hash);
+
+    for (size_t step = 1; ; step++)
+    {
+        size_t first = group * Group::SIZE;
+        Group bytes(m_ctrl + first);
+
+        for (uint32_t bits = bytes.match(ctrl); bits != 0; bits &= bits - 1)
+        {
+            size_t slot = first + Group::lowestBit(bits);
+
+            if (m_equal(KeyOf::key(m_slots[slot]), key))
+                return slot;
+        }
+
+        if (bytes.matchEmpty() != 0)
+            return m_capacity;
+
+        // triangular steps visit every group of a power of two
+        group = (group + step) & mask;
+    }
+}
+
+template <typename T, typename H, typename E>
+size_t
+THashTable<T, H, E>::findFree(uint64_t hash) const
+{
+    size_t mask = m_capacity / Group::SIZE - 1;
+    size_t group = static_cast<size_t>(hash >> 7) & mask;
+
+    for (size_t step = 1; ; step++)
+    {
+        uint32_t bits = Group(m_ctrl + group * Group::SIZE).matchFree();
+
+        if (bits != 0)
+            return group * Group::SIZE + Group::lowestBit(bits);
+
+        group = (group + step) & mask;
+    }
+}
+
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::eraseSlot(size_t slot)
+{
+    m_slots[slot].~T();
+    m_size--;
+
+    // lookups stop at a group with an EMPTY byte, so none passes this one
+    if (Group(m_ctrl + slot / Group::SIZE * Group::SIZE).matchEmpty() != 0)
+    {
+        m_ctrl[slot] = Group::EMPTY;
+        m_growthLeft++;
+    }
+    else
+    {
+        m_ctrl[slot] = Group::DELETED;
+    }
+}
+
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::rehash(size_t capacity)
+{
+    uint8_t* oldCtrl = m_ctrl;
+    T* oldSlots = m_slots;
+    size_t oldCapacity = m_capacity;
+
+    allocate(capacity);
+
+    for (size_t i = 0; i < oldCapacity; i++)
+    {
+        if (oldCtrl[i] >= Group::EMPTY)
+            continue;
+
+        uint64_t hash = hashOf(KeyOf::key(oldSlots[i]));
+        size_t slot = findFree(hash);
+
+        new (m_slots + slot) T(std::move(oldSlots[i]));
+        oldSlots[i].~T();
+        m_ctrl[slot] = ctrlOf(hash);
+    }
+
+    m_growthLeft -= m_size;
+
+    if (oldCapacity != 0)
+        ::operator delete(oldCtrl);
+}
+
+// One block holds the control bytes, a group of SENTINEL bytes that ends
+// iteration and keeps the slots aligned, and the slots.
+//
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::allocate(size_t capacity)
+{
+    static_assert(alignof(T) <= Group::SIZE, "slots are aligned to the group size");
+
+    void* memory = ::operator new(capacity + Group::SIZE + capacity * sizeof(T));
+
+    m_ctrl = static_cast<uint8_t*>(memory);
+    m_slots = reinterpret_cast<T*>(m_ctrl + capacity + Group::SIZE);
+    m_capacity = capacity;
+    m_growthLeft = maxLoad(capacity);
+
+    memset(m_ctrl, Group::EMPTY, capacity);
+    memset(m_ctrl + capacity, Group::SENTINEL, Group::SIZE);
+}
+
+template <typename T, typename H, typename E>
+void
+THashTable<T, H, E>::destroy(void)
+{
+    if (m_capacity == 0)
+        return;
+
+    for (size_t i = 0; i < m_capacity; i++)
+    {
+        if (m_ctrl[i] < Group::EMPTY)
+            m_slots[i].~T();
+    }
+
+    ::operator delete(m_ctrl);
+}
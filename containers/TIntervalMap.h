@@ -0,0 +1,194 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of an interval map: closed intervals [lo, hi] mapped to values,
+for finding the intervals that overlap a point or another interval.
+
+It is a TRbTree ordered by (lo, hi) whose nodes are augmented with the largest
+hi in their subtree, which rotations and fixups keep current as for any other
+augmentation. A search skips every subtree whose largest hi is below the query
+and, since keys are ordered by lo, everything right of a node starting past
+the query. Finding one overlap takes O(log n). Reporting all k overlaps takes
+O(min(n, (k + 1) log n)), and close to O(log n + k) when the overlaps sit
+together in key order, as they do for ranges that rarely nest.
+
+Equal intervals are one entry; inserting one again replaces its value.
+
+Example:
+
+    TIntervalMap<uint32_t, Route> routes;
+    routes.insert(0x0a000000, 0x0affffff, route);       // 10.0.0.0/8
+
+    TIntervalMap<uint32_t, Route>::const_iterator itr = routes.find_any_overlap(address);
+    if (itr != routes.end())
+        ...
+
+    routes.for_each_overlap(lo, hi, [](const TIntervalMapEntry<uint32_t, Route>& entry) { ... });
+*/
+#pragma once
+
+#include <cassert>
+#include <utility>
+#include "TRbTree.h"
+
+template <typename E, typename V>
+class TIntervalMapEntry
+{
+public:
+
+    TIntervalMapEntry(void) { }
+    TIntervalMapEntry(const E& start, const E& end, const V& data) : lo(start), hi(end), value(data) { }
+
+    bool operator<(const TIntervalMapEntry& other) const { return lo < other.lo || (!(other.lo < lo) && hi < other.hi); }
+
+    E lo;
+    E hi;
+    V value;
+};
+
+// Keeps the largest hi in each subtree. E has no minimum that works for every
+// type, so the sentinel is marked empty instead.
+//
+template <typename E>
+class TIntervalMapMaxEnd
+{
+public:
+
+    enum { ENABLED = 1 };
+
+    TIntervalMapMaxEnd(void) : m_empty(true), m_maxEnd() { }
+
+    template <typename K>
+    static void update(TIntervalMapMaxEnd& node, const K& key, const TIntervalMapMaxEnd& left, const TIntervalMapMaxEnd& right)
+    {
+        node.m_empty = false;
+        node.m_maxEnd = key.hi;
+
+        if (!left.m_empty && node.m_maxEnd < left.m_maxEnd)
+            node.m_maxEnd = left.m_maxEnd;
+
+        if (!right.m_empty && node.m_maxEnd < right.m_maxEnd)
+            node.m_maxEnd = right.m_maxEnd;
+    }
+
+    bool m_empty;
+    E m_maxEnd;
+};
+
+template <typename E, typename V>
+class TIntervalMap : private TRbTree<TIntervalMapEntry<E, V>, TIntervalMapMaxEnd<E> >
+{
+    typedef TIntervalMapEntry<E, V> Entry;
+    typedef TRbTree<Entry, TIntervalMapMaxEnd<E> > Tree;
+    typedef TRbTreeNode<Entry, TIntervalMapMaxEnd<E> > Node;
+
+public:
+
+    typedef typename Tree::const_iterator const_iterator;
+
+    // Insert [lo, hi] with lo <= hi, or replace the value if exactly that
+    // interval is present.
+    //
+    std::pair<const_iterator, bool> insert(const E& lo, const E& hi, const V& value);
+    void erase(const E& lo, const E& hi) { Tree::erase(typename Tree::iterator(find(lo, hi))); }
+    void erase(const_iterator itr) { Tree::erase(typename Tree::iterator(itr)); }
+    void clear(void) { Tree::clear(); }
+
+    // The entry for exactly [lo, hi], or end().
+    //
+    const_iterator find(const E& lo, const E& hi) const;
+
+    // Some entry overlapping point or [lo, hi], or end() if none does.
+    //
+    const_iterator find_any_overlap(const E& point) const { return find_any_overlap(point, point); }
+    const_iterator find_any_overlap(const E& lo, const E& hi) const;
+
+    // Call func(entry) for every entry overlapping point or [lo, hi], in
+    // order of (lo, hi).
+    //
+    template <typename Func> void for_each_overlap(const E& point, Func func) const { forEachOverlap(Tree::m_root, point, point, func); }
+    template <typename Func> void for_each_overlap(const E& lo, const E& hi, Func func) const { forEachOverlap(Tree::m_root, lo, hi, func); }
+
+    const_iterator begin(void) const { return Tree::begin(); }
+    const_iterator end(void) const { return Tree::end(); }
+    size_t size(void) const { return Tree::size(); }
+
+private:
+
+    template <typename Func> void forEachOverlap(const Node* node, const E& lo, const E& hi, Func& func) const;
+};
+
+// TIntervalMap
+//
+template <typename E, typename V>
+std::pair<typename TIntervalMap<E, V>::const_iterator, bool>
+TIntervalMap<E, V>::insert(const E& lo, const E& hi, const V& value)
+{
+    assert(!(hi < lo));
+
+    std::pair<typename Tree::iterator, bool> result = Tree::insert(Entry(lo, hi, value));
+    return std::make_pair(const_iterator(result.first), result.second);
+}
+
+template <typename E, typename V>
+typename TIntervalMap<E, V>::const_iterator
+TIntervalMap<E, V>::find(const E& lo, const E& hi) const
+{
+    Node* node = Tree::m_root;
+
+    while (node != Tree::m_nil)
+    {
+        const Entry& key = node->m_key;
+
+        if (lo < key.lo || (!(key.lo < lo) && hi < key.hi))
+            node = node->m_left;
+        else if (key.lo < lo || key.hi < hi)
+            node = node->m_right;
+        else
+            return const_iterator(this, node);
+    }
+
+    return end();
+}
+
+template <typename E, typename V>
+typename TIntervalMap<E, V>::const_iterator
+TIntervalMap<E, V>::find_any_overlap(const E& lo, const E& hi) const
+{
+    Node* node = Tree::m_root;
+
+    while (node != Tree::m_nil)
+    {
+        const Entry& key = node->m_key;
+
+        if (!(hi < key.lo) && !(key.hi < lo))
+            return const_iterator(this, node);
+
+        // if the left subtree reaches lo but overlaps nothing, its interval
+        // ending at or after lo starts after hi, and so does everything to
+        // the right: the overlap, if any, is on the left
+        Node* left = node->m_left;
+        node = (left != Tree::m_nil && !(left->m_maxEnd < lo)) ? left : node->m_right;
+    }
+
+    return end();
+}
+
+template <typename E, typename V>
+template <typename Func>
+void
+TIntervalMap<E, V>::forEachOverlap(const Node* node, const E& lo, const E& hi, Func& func) const
+{
+    if (node == Tree::m_nil || node->m_maxEnd < lo)
+        return;
+
+    forEachOverlap(node->m_left, lo, hi, func);
+
+    // this node and everything to its right start after hi
+    if (hi < node->m_key.lo)
+        return;
+
+    if (!(node->m_key.hi < lo))
+        func(node->m_key);
+
+    forEachOverlap(node->m_right, lo, hi, func);
+}
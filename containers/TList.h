@@ -4,6 +4,8 @@ Implementation of a linked-list container with an STL-like interface.
 */
 #pragma once
 
+#include <utility>
+
 template <typename V>
 class TListNode
 {
@@ -13,7 +15,8 @@ class TListNode
 
 private:
 
-    TListNode(const V& value) : m_value(value), m_prev(NULL), m_next(NULL) { }
+    template <typename... Args>
+    TListNode(Args&&... args) : m_prev(NULL), m_next(NULL), m_value(std::forward<Args>(args)...) { }
 
     TListNode* m_prev;
     TListNode* m_next;
@@ -84,11 +87,34 @@ public:
     typedef TListConstItr<V> const_iterator;
 
     TList(void);
+    TList(const TList& other);
+    TList(TList&& other);
+    ~TList(void);
+
+    TList& operator=(const TList& other);
+    TList& operator=(TList&& other);
+
+    // Exchange the contents with other in O(1); iterators keep pointing at
+    // the same nodes, now in the other list.
+    //
+    void swap(TList& other);
 
-    void push_front(const V& value);
-    void push_back(const V& value);
-    void push_after(iterator itr, const V& value);
-    void push_before(iterator itr, const V& value);
+    void push_front(const V& value) { emplace_front(value); }
+    void push_back(const V& value) { emplace_back(value); }
+    void push_after(iterator itr, const V& value) { emplace_after(itr, value); }
+    void push_before(iterator itr, const V& value) { emplace_before(itr, value); }
+
+    void push_front(V&& value) { emplace_front(std::move(value)); }
+    void push_back(V&& value) { emplace_back(std::move(value)); }
+    void push_after(iterator itr, V&& value) { emplace_after(itr, std::move(value)); }
+    void push_before(iterator itr, V&& value) { emplace_before(itr, std::move(value)); }
+
+    // Construct V in place inside the new node from args.
+    //
+    template <typename... Args> void emplace_front(Args&&... args);
+    template <typename... Args> void emplace_back(Args&&... args);
+    template <typename... Args> void emplace_after(iterator itr, Args&&... args);
+    template <typename... Args> void emplace_before(iterator itr, Args&&... args);
 
     // Return is void because return of V is inefficient requiring V to be
     // copied to lvalue.
@@ -96,6 +122,7 @@ public:
     void pop_front(void);
     void pop_back(void);
     void pop_at(iterator itr);
+    void clear(void);
 
     V& front(void);
     V& back(void);
@@ -125,19 +152,95 @@ TList<V>::TList(void)
     : m_head(NULL), m_tail(NULL), m_size(0)
 { }
 
+template <typename V>
+TList<V>::TList(const TList& other)
+    : m_head(NULL), m_tail(NULL), m_size(0)
+{
+    try
+    {
+        for (Node* node = other.m_head; node != NULL; node = node->m_next)
+            emplace_back(node->m_value);
+    }
+    catch (...)
+    {
+        // the destructor does not run for a constructor that throws
+        clear();
+        throw;
+    }
+}
+
+template <typename V>
+TList<V>::TList(TList&& other)
+    : m_head(other.m_head), m_tail(other.m_tail), m_size(other.m_size)
+{
+    other.m_head = NULL;
+    other.m_tail = NULL;
+    other.m_size = 0;
+}
+
+template <typename V>
+TList<V>::~TList(void)
+{
+    clear();
+}
+
+template <typename V>
+TList<V>&
+TList<V>::operator=(const TList& other)
+{
+    if (this != &other)
+    {
+        TList copy(other);
+        swap(copy);
+    }
+
+    return *this;
+}
+
+template <typename V>
+TList<V>&
+TList<V>::operator=(TList&& other)
+{
+    if (this != &other)
+    {
+        clear();
+        swap(other);
+    }
+
+    return *this;
+}
+
 template <typename V>
 void
-TList<V>::push_front(const V& value)
+TList<V>::swap(TList& other)
+{
+    Node* head = m_head;
+    Node* tail = m_tail;
+    size_t size = m_size;
+
+    m_head = other.m_head;
+    m_tail = other.m_tail;
+    m_size = other.m_size;
+
+    other.m_head = head;
+    other.m_tail = tail;
+    other.m_size = size;
+}
+
+template <typename V>
+template <typename... Args>
+void
+TList<V>::emplace_front(Args&&... args)
 {
     if (m_head == NULL)
     {
         assert(m_tail == NULL);
-        m_head = new Node(value);
+        m_head = new Node(std::forward<Args>(args)...);
         m_tail = m_head;
     }
     else
     {
-        Node* newNode = new Node(value);
+        Node* newNode = new Node(std::forward<Args>(args)...);
         newNode->m_next = m_head;
         m_head->m_prev = newNode;
         m_head = newNode;
@@ -147,18 +250,19 @@ TList<V>::push_front(const V& value)
 }
 
 template <typename V>
+template <typename... Args>
 void
-TList<V>::push_back(const V& value)
+TList<V>::emplace_back(Args&&... args)
 {
     if (m_tail == NULL)
     {
         assert(m_head == NULL);
-        m_tail = new Node(value);
+        m_tail = new Node(std::forward<Args>(args)...);
         m_head = m_tail;
     }
     else
     {
-        Node* newNode = new Node(value);
+        Node* newNode = new Node(std::forward<Args>(args)...);
         newNode->m_prev = m_tail;
         m_tail->m_next = newNode;
         m_tail = newNode;
@@ -168,12 +272,13 @@ TList<V>::push_back(const V& value)
 }
 
 template <typename V>
+template <typename... Args>
 void
-TList<V>::push_after(iterator itr, const V& value)
+TList<V>::emplace_after(iterator itr, Args&&... args)
 {
     assert(itr.m_node != NULL);
 
-    Node* newNode = new Node(value);
+    Node* newNode = new Node(std::forward<Args>(args)...);
     Node* nextNode = itr.m_node->m_next;
 
     newNode->m_prev = itr.m_node;
@@ -190,12 +295,13 @@ TList<V>::push_after(iterator itr, const V& value)
 }
 
 template <typename V>
+template <typename... Args>
 void
-TList<V>::push_before(iterator itr, const V& value)
+TList<V>::emplace_before(iterator itr, Args&&... args)
 {
     assert(itr.m_node != NULL);
 
-    Node* newNode = new Node(value);
+    Node* newNode = new Node(std::forward<Args>(args)...);
     Node* prevNode = itr.m_node->m_prev;
 
     newNode->m_next = itr.m_node;
@@ -273,6 +379,24 @@ TList<V>::pop_at(iterator itr)
     m_size--;
 }
 
+template <typename V>
+void
+TList<V>::clear(void)
+{
+    Node* node = m_head;
+
+    while (node != NULL)
+    {
+        Node* deleteNode = node;
+        node = node->m_next;
+        delete deleteNode;
+    }
+
+    m_head = NULL;
+    m_tail = NULL;
+    m_size = 0;
+}
+
 template <typename V>
 V&
 TList<V>::front(void)
@@ -0,0 +1,199 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a lock-free ordered singly linked list that may be shared
+between threads, following Harris' algorithm with Michael's refinements. Erase
+first marks the low bit of the node's next link so no insert can follow it, then
+unlinks it; any thread that walks past a marked node helps unlink it. Unlinked
+nodes are reclaimed through TEpoch.
+
+Keys are unique and ordered by operator<.
+
+Example:
+
+    TLockFreeList<int> list;
+    list.insert(5);                         // from any thread
+    list.contains(5);                       // true
+    list.erase(5);                          // from any thread
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+#include "TEpoch.h"
+
+template <typename K>
+class TLockFreeListNode
+{
+    template <typename K> friend class TLockFreeList;
+
+private:
+
+    TLockFreeListNode(const K& key) : m_next(NULL), m_key(key) { }
+    TLockFreeListNode(K&& key) : m_next(NULL), m_key(std::move(key)) { }
+
+    std::atomic<TLockFreeListNode*> m_next;
+    K m_key;
+};
+
+template <typename K>
+class TLockFreeList
+{
+    typedef TLockFreeListNode<K> Node;
+    typedef std::atomic<Node*> Link;
+
+public:
+
+    TLockFreeList(void) : m_head(NULL) { }
+    ~TLockFreeList(void);
+
+    // Returns false if the key was already present.
+    //
+    bool insert(const K& key) { return insert(new Node(key)); }
+    bool insert(K&& key) { return insert(new Node(std::move(key))); }
+
+    // Returns false if the key was not present.
+    //
+    bool erase(const K& key);
+
+    bool contains(const K& key) const;
+
+private:
+
+    TLockFreeList(const TLockFreeList&);
+    TLockFreeList& operator=(const TLockFreeList&);
+
+    static bool isMarked(Node* node) { return (reinterpret_cast<uintptr_t>(node) & 1) != 0; }
+    static Node* mark(Node* node) { return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(node) | 1); }
+    static Node* unmark(Node* node) { return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(node) & ~static_cast<uintptr_t>(1)); }
+
+    bool insert(Node* node);
+
+    // Positions prev/curr so that curr is the first node with key >= key and
+    // prev is the link pointing to it, unlinking marked nodes on the way.
+    // Must be called under a TEpochGuard.
+    //
+    bool search(const K& key, Link*& prev, Node*& curr);
+
+    Link m_head;
+};
+
+template <typename K>
+TLockFreeList<K>::~TLockFreeList(void)
+{
+    // no other thread may be using the list at this point
+    Node* node = unmark(m_head.load());
+
+    while (node != NULL)
+    {
+        Node* next = unmark(node->m_next.load());
+        delete node;
+        node = next;
+    }
+}
+
+template <typename K>
+bool
+TLockFreeList<K>::search(const K& key, Link*& prev, Node*& curr)
+{
+retry:
+    prev = &m_head;
+    curr = prev->load();
+
+    while (curr != NULL)
+    {
+        Node* next = curr->m_next.load();
+
+        if (isMarked(next))
+        {
+            // curr is logically erased; fails if prev changed or was marked
+            Node* expected = curr;
+
+            if (!prev->compare_exchange_strong(expected, unmark(next)))
+                goto retry;
+
+            TEpoch::retire(curr);
+            curr = unmark(next);
+            continue;
+        }
+
+        if (!(curr->m_key < key))
+            return !(key < curr->m_key);
+
+        prev = &curr->m_next;
+        curr = next;
+    }
+
+    return false;
+}
+
+template <typename K>
+bool
+TLockFreeList<K>::insert(Node* node)
+{
+    TEpochGuard guard;
+    Link* prev;
+    Node* curr;
+
+    while (1)
+    {
+        if (search(node->m_key, prev, curr))
+        {
+            delete node;
+            return false;
+        }
+
+        node->m_next.store(curr, std::memory_order_relaxed);
+
+        if (prev->compare_exchange_strong(curr, node))
+            return true;
+    }
+}
+
+template <typename K>
+bool
+TLockFreeList<K>::erase(const K& key)
+{
+    TEpochGuard guard;
+    Link* prev;
+    Node* curr;
+
+    while (1)
+    {
+        if (!search(key, prev, curr))
+            return false;
+
+        Node* next = curr->m_next.load();
+
+        // another thread is erasing curr; search again to help it along
+        if (isMarked(next))
+            continue;
+
+        // logical erase, the linearization point
+        if (!curr->m_next.compare_exchange_strong(next, mark(next)))
+            continue;
+
+        // physical erase, or leave it for the next search to unlink
+        Node* expected = curr;
+
+        if (prev->compare_exchange_strong(expected, next))
+            TEpoch::retire(curr);
+        else
+            search(key, prev, curr);
+
+        return true;
+    }
+}
+
+template <typename K>
+bool
+TLockFreeList<K>::contains(const K& key) const
+{
+    TEpochGuard guard;
+    Node* curr = m_head.load();
+
+    while (curr != NULL && curr->m_key < key)
+        curr = unmark(curr->m_next.load());
+
+    return curr != NULL && !(key < curr->m_key) && !isMarked(curr->m_next.load());
+}
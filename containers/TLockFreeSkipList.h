@@ -0,0 +1,528 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a lock-free ordered map that may be shared between threads,
+as a skip list whose every level is a Harris list as in TLockFreeList.
+
+Erase marks the node's links from the top level down; marking the bottom link
+is the linearization point, after which walks on any level help unlink it.
+An insert may still be linking the upper levels of a node that is being
+erased, so the node is retired through TEpoch by whichever of the two
+finishes last, once it has unlinked the node from every level.
+
+Towers grow with probability 1/4 per level rather than 1/2: a node has 4/3
+links on average instead of 2, so most nodes fit in one cache line with their
+key and value, at the cost of slightly longer walks per level.
+
+Keys are unique and ordered by C. Values are immutable once inserted: find
+copies the value out and iterators give const access; to change a value,
+erase and insert again.
+
+Iteration is weakly consistent: an iterator never returns an entry twice or
+out of order, sees every entry present for its whole walk, and may or may not
+see entries inserted or erased during it. An iterator keeps its thread inside
+an epoch critical section for as long as it lives, which holds back all
+reclamation, so keep iterators short-lived and on the thread that made them.
+
+Example:
+
+    TLockFreeSkipList<uint64_t, Order> orders;
+    orders.insert(id, order);               // from any thread
+
+    Order order;
+    if (orders.find(id, order))
+        ...
+
+    for (TLockFreeSkipList<uint64_t, Order>::const_iterator itr = orders.lower_bound(lo); itr != orders.end() && itr->first < hi; ++itr)
+        ...
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include "TEpoch.h"
+
+template <typename K, typename V>
+class TLockFreeSkipListPair
+{
+public:
+
+    TLockFreeSkipListPair(const K& key, const V& value) : first(key), second(value) { }
+
+    const K first;
+    const V second;
+};
+
+template <typename K, typename V>
+class TLockFreeSkipListNode
+{
+    typedef TLockFreeSkipListPair<K, V> Pair;
+    template <typename K, typename V, typename C> friend class TLockFreeSkipList;
+    template <typename K, typename V> friend class TLockFreeSkipListItr;
+
+private:
+
+    // m_state bits, set once each by the inserter and the eraser when done
+    enum { INSERTED = 1, ERASED = 2 };
+
+    TLockFreeSkipListNode(const K& key, const V& value, size_t height) : m_pair(key, value), m_height(static_cast<uint8_t>(height)), m_state(0) { }
+
+    static bool isMarked(TLockFreeSkipListNode* node) { return (reinterpret_cast<uintptr_t>(node) & 1) != 0; }
+    static TLockFreeSkipListNode* mark(TLockFreeSkipListNode* node) { return reinterpret_cast<TLockFreeSkipListNode*>(reinterpret_cast<uintptr_t>(node) | 1); }
+    static TLockFreeSkipListNode* unmark(TLockFreeSkipListNode* node) { return reinterpret_cast<TLockFreeSkipListNode*>(reinterpret_cast<uintptr_t>(node) & ~static_cast<uintptr_t>(1)); }
+
+    Pair m_pair;
+    uint8_t m_height;
+    std::atomic<uint8_t> m_state;
+    std::atomic<TLockFreeSkipListNode*> m_next[1];  // m_height links, allocated with the node
+};
+
+template <typename K, typename V>
+class TLockFreeSkipListItr
+{
+    typedef TLockFreeSkipListNode<K, V> Node;
+    typedef TLockFreeSkipListPair<K, V> Pair;
+    template <typename K, typename V, typename C> friend class TLockFreeSkipList;
+
+public:
+
+    TLockFreeSkipListItr(void) : m_node(NULL) { TEpoch::enter(); }
+    TLockFreeSkipListItr(const TLockFreeSkipListItr& other) : m_node(other.m_node) { TEpoch::enter(); }
+    ~TLockFreeSkipListItr(void) { TEpoch::leave(); }
+    TLockFreeSkipListItr& operator=(const TLockFreeSkipListItr& other) { m_node = other.m_node; return *this; }
+
+    bool operator==(const TLockFreeSkipListItr& other) const { return m_node == other.m_node; }
+    bool operator!=(const TLockFreeSkipListItr& other) const { return m_node != other.m_node; }
+    TLockFreeSkipListItr& operator++(void) { m_node = live(Node::unmark(m_node->m_next[0].load())); return *this; }
+    const V& operator*(void) const { return m_node->m_pair.second; }
+    const Pair* operator->(void) const { return &m_node->m_pair; }
+
+private:
+
+    // the first node from node on that is not erased
+    static Node* live(Node* node)
+    {
+        while (node != NULL && Node::isMarked(node->m_next[0].load()))
+            node = Node::unmark(node->m_next[0].load());
+
+        return node;
+    }
+
+    Node* m_node;
+};
+
+template <typename K, typename V, typename C = std::less<K> >
+class TLockFreeSkipList
+{
+    typedef TLockFreeSkipListNode<K, V> Node;
+    typedef std::atomic<Node*> Link;
+
+public:
+
+    typedef TLockFreeSkipListItr<K, V> const_iterator;
+
+    TLockFreeSkipList(void);
+    explicit TLockFreeSkipList(const C& compare);
+    ~TLockFreeSkipList(void);
+
+    // Returns false, leaving the present value, if key was already present.
+    //
+    bool insert(const K& key, const V& value);
+
+    // Returns false if key was not present.
+    //
+    bool erase(const K& key);
+
+    // Copy the value for key into value; returns false if key is absent.
+    //
+    bool find(const K& key, V& value) const;
+    bool contains(const K& key) const;
+
+    const_iterator lower_bound(const K& key) const;
+    const_iterator begin(void) const;
+    const_iterator end(void) const { return const_iterator(); }
+
+    // Exact only while no other thread is inserting or erasing.
+    //
+    size_t size(void) const { return m_size.load(std::memory_order_relaxed); }
+
+private:
+
+    // 4^16 keys before the top level stops thinning out
+    enum { MAX_LEVEL = 16 };
+
+    TLockFreeSkipList(const TLockFreeSkipList&);
+    TLockFreeSkipList& operator=(const TLockFreeSkipList&);
+
+    static Node* createNode(const K& key, const V& value, size_t height);
+    static void destroyNode(void* node);
+    static size_t randomHeight(void);
+
+    // the link at level in node, or in the head for NULL
+    Link& link(Node* node, size_t level) { return (node != NULL) ? node->m_next[level] : m_head[level]; }
+
+    // Finds, on every level, the last node before key (preds, NULL for the
+    // head) and the first node not before it (succs), unlinking marked nodes
+    // on the way. Returns whether succs[0] has key. Must be called under a
+    // TEpochGuard.
+    //
+    bool search(const K& key, Node** preds, Node** succs);
+
+    // The first node not before key that is not erased, without unlinking.
+    //
+    Node* lowerBound(const K& key) const;
+
+    // Called by the inserter and the eraser of node when each is done with
+    // it; the second one unlinks it from every level and retires it.
+    //
+    void finish(Node* node, uint8_t state);
+    void unlinkAll(const K& key);
+
+    Link m_head[MAX_LEVEL];
+    std::atomic<size_t> m_size;
+    C m_compare;
+};
+
+// TLockFreeSkipList
+//
+template <typename K, typename V, typename C>
+TLockFreeSkipList<K, V, C>::TLockFreeSkipList(void) : m_size(0)
+{
+    for (size_t i = 0; i < MAX_LEVEL; i++)
+        m_head[i].store(NULL, std::memory_order_relaxed);
+}
+
+template <typename K, typename V, typename C>
+TLockFreeSkipList<K, V, C>::TLockFreeSkipList(const C& compare) : m_size(0), m_compare(compare)
+{
+    for (size_t i = 0; i < MAX_LEVEL; i++)
+        m_head[i].store(NULL, std::memory_order_relaxed);
+}
+
+template <typename K, typename V, typename C>
+TLockFreeSkipList<K, V, C>::~TLockFreeSkipList(void)
+{
+    // no other thread may be using the list at this point; retired nodes are
+    // no longer on the bottom level and belong to TEpoch
+    Node* node = Node::unmark(m_head[0].load());
+
+    while (node != NULL)
+    {
+        Node* next = Node::unmark(node->m_next[0].load());
+        destroyNode(node);
+        node = next;
+    }
+}
+
+template <typename K, typename V, typename C>
+bool
+TLockFreeSkipList<K, V, C>::insert(const K& key, const V& value)
+{
+    TEpochGuard guard;
+    Node* preds[MAX_LEVEL];
+    Node* succs[MAX_LEVEL];
+    Node* node = NULL;
+    size_t height = randomHeight();
+
+    while (1)
+    {
+        if (search(key, preds, succs))
+        {
+            // never published, so no other thread can have seen it
+            if (node != NULL)
+                destroyNode(node);
+
+            return false;
+        }
+
+        if (node == NULL)
+            node = createNode(key, value, height);
+
+        for (size_t level = 0; level < height; level++)
+            node->m_next[level].store(succs[level], std::memory_order_relaxed);
+
+        // linking the bottom level is the linearization point
+        Node* expected = succs[0];
+
+        if (link(preds[0], 0).compare_exchange_strong(expected, node))
+            break;
+    }
+
+    m_size.fetch_add(1, std::memory_order_relaxed);
+
+    bool building = true;
+
+    for (size_t level = 1; level < height && building; level++)
+    {
+        while (1)
+        {
+            // stop building the tower once an erase has marked it
+            Node* next = node->m_next[level].load();
+
+            if (Node::isMarked(next) || (next != succs[level] && !node->m_next[level].compare_exchange_strong(next, succs[level])))
+            {
+                building = false;
+                break;
+            }
+
+            Node* expected = succs[level];
+
+            if (link(preds[level], level).compare_exchange_strong(expected, node))
+                break;
+
+            // the search also unlinks node if it has been erased meanwhile
+            if (!search(key, preds, succs) || succs[0] != node)
+            {
+                building = false;
+                break;
+            }
+        }
+    }
+
+    finish(node, Node::INSERTED);
+    return true;
+}
+
+template <typename K, typename V, typename C>
+bool
+TLockFreeSkipList<K, V, C>::erase(const K& key)
+{
+    TEpochGuard guard;
+    Node* preds[MAX_LEVEL];
+    Node* succs[MAX_LEVEL];
+
+    if (!search(key, preds, succs))
+        return false;
+
+    Node* node = succs[0];
+
+    // mark the tower top down so no insert can link above or after it
+    for (size_t level = node->m_height - 1; level > 0; level--)
+    {
+        Node* next = node->m_next[level].load();
+
+        while (!Node::isMarked(next) && !node->m_next[level].compare_exchange_weak(next, Node::mark(next)))
+            ;
+    }
+
+    Node* next = node->m_next[0].load();
+
+    while (1)
+    {
+        // another erase got there first
+        if (Node::isMarked(next))
+            return false;
+
+        if (node->m_next[0].compare_exchange_weak(next, Node::mark(next)))
+            break;
+    }
+
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+
+    search(key, preds, succs);
+    finish(node, Node::ERASED);
+    return true;
+}
+
+template <typename K, typename V, typename C>
+bool
+TLockFreeSkipList<K, V, C>::find(const K& key, V& value) const
+{
+    TEpochGuard guard;
+    Node* node = lowerBound(key);
+
+    if (node == NULL || m_compare(key, node->m_pair.first))
+        return false;
+
+    value = node->m_pair.second;
+    return true;
+}
+
+template <typename K, typename V, typename C>
+bool
+TLockFreeSkipList<K, V, C>::contains(const K& key) const
+{
+    TEpochGuard guard;
+    Node* node = lowerBound(key);
+
+    return node != NULL && !m_compare(key, node->m_pair.first);
+}
+
+template <typename K, typename V, typename C>
+typename TLockFreeSkipList<K, V, C>::const_iterator
+TLockFreeSkipList<K, V, C>::lower_bound(const K& key) const
+{
+    // the iterator enters the epoch before the walk
+    const_iterator itr;
+    itr.m_node = lowerBound(key);
+    return itr;
+}
+
+template <typename K, typename V, typename C>
+typename TLockFreeSkipList<K, V, C>::const_iterator
+TLockFreeSkipList<K, V, C>::begin(void) const
+{
+    const_iterator itr;
+    itr.m_node = const_iterator::live(Node::unmark(m_head[0].load()));
+    return itr;
+}
+
+template <typename K, typename V, typename C>
+typename TLockFreeSkipList<K, V, C>::Node*
+TLockFreeSkipList<K, V, C>::createNode(const K& key, const V& value, size_t height)
+{
+    void* memory = ::operator new(sizeof(Node) + (height - 1) * sizeof(Link));
+    Node* node = new (memory) Node(key, value, height);
+
+    for (size_t level = 1; level < height; level++)
+        new (&node->m_next[level]) Link(NULL);
+
+    return node;
+}
+
+template <typename K, typename V, typename C>
+void
+TLockFreeSkipList<K, V, C>::destroyNode(void* node)
+{
+    static_cast<Node*>(node)->~Node();
+    ::operator delete(node);
+}
+
+template <typename K, typename V, typename C>
+size_t
+TLockFreeSkipList<K, V, C>::randomHeight(void)
+{
+    // xorshift, seeded per thread from the address of its state
+    static thread_local uint64_t state = 0;
+
+    if (state == 0)
+        state = reinterpret_cast<uintptr_t>(&state) * 0x9e3779b97f4a7c15ull | 1;
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    size_t height = 1;
+
+    for (uint64_t bits = state; (bits & 3) == 0 && height < MAX_LEVEL; bits >>= 2)
+        height++;
+
+    return height;
+}
+
+template <typename K, typename V, typename C>
+bool
+TLockFreeSkipList<K, V, C>::search(const K& key, Node** preds, Node** succs)
+{
+retry:
+    Node* pred = NULL;
+
+    for (size_t level = MAX_LEVEL; level-- > 0; )
+    {
+        Node* curr = Node::unmark(link(pred, level).load());
+
+        while (curr != NULL)
+        {
+            Node* next = curr->m_next[level].load();
+
+            if (Node::isMarked(next))
+            {
+                // fails if pred changed or is being erased itself
+                Node* expected = curr;
+
+                if (!link(pred, level).compare_exchange_strong(expected, Node::unmark(next)))
+                    goto retry;
+
+                curr = Node::unmark(next);
+                continue;
+            }
+
+            if (!m_compare(curr->m_pair.first, key))
+                break;
+
+            pred = curr;
+            curr = next;
+        }
+
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+
+    return succs[0] != NULL && !m_compare(key, succs[0]->m_pair.first);
+}
+
+template <typename K, typename V, typename C>
+typename TLockFreeSkipList<K, V, C>::Node*
+TLockFreeSkipList<K, V, C>::lowerBound(const K& key) const
+{
+    Node* pred = NULL;
+    Node* curr = NULL;
+
+    for (size_t level = MAX_LEVEL; level-- > 0; )
+    {
+        curr = Node::unmark(((pred != NULL) ? pred->m_next[level] : m_head[level]).load());
+
+        // marked nodes are passed over, not unlinked
+        while (curr != NULL && m_compare(curr->m_pair.first, key))
+        {
+            pred = curr;
+            curr = Node::unmark(curr->m_next[level].load());
+        }
+    }
+
+    return const_iterator::live(curr);
+}
+
+template <typename K, typename V, typename C>
+void
+TLockFreeSkipList<K, V, C>::finish(Node* node, uint8_t state)
+{
+    if (node->m_state.fetch_or(state) == 0)
+        return;
+
+    unlinkAll(node->m_pair.first);
+    TEpoch::retire(node, &destroyNode);
+}
+
+template <typename K, typename V, typename C>
+void
+TLockFreeSkipList<K, V, C>::unlinkAll(const K& key)
+{
+    // as search, but walking on past nodes equal to key, so that a marked
+    // node is unlinked even if a live one with the same key came before it
+retry:
+    Node* pred = NULL;
+
+    for (size_t level = MAX_LEVEL; level-- > 0; )
+    {
+        Node* prev = pred;
+        Node* curr = Node::unmark(link(pred, level).load());
+
+        while (curr != NULL)
+        {
+            Node* next = curr->m_next[level].load();
+
+            if (Node::isMarked(next))
+            {
+                Node* expected = curr;
+
+                if (!link(prev, level).compare_exchange_strong(expected, Node::unmark(next)))
+                    goto retry;
+
+                curr = Node::unmark(next);
+                continue;
+            }
+
+            if (m_compare(key, curr->m_pair.first))
+                break;
+
+            if (m_compare(curr->m_pair.first, key))
+                pred = curr;
+
+            prev = curr;
+            curr = next;
+        }
+    }
+}
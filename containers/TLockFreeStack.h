@@ -0,0 +1,116 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a lock-free stack (Treiber stack) that may be shared between
+threads. Popped nodes are reclaimed through TEpoch, which also rules out the
+ABA problem since a node cannot be reused while another thread may hold it.
+
+Example:
+
+    TLockFreeStack<Message> stack;
+    stack.push(message);                    // from any thread
+
+    Message message;
+    while (stack.pop(message))              // from any thread
+        handle(message);
+*/
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include "TEpoch.h"
+
+template <typename V>
+class TLockFreeStackNode
+{
+    template <typename K> friend class TLockFreeStack;
+
+private:
+
+    template <typename... Args>
+    TLockFreeStackNode(Args&&... args) : m_next(NULL), m_value(std::forward<Args>(args)...) { }
+
+    TLockFreeStackNode* m_next;
+    V m_value;
+};
+
+template <typename V>
+class TLockFreeStack
+{
+    typedef TLockFreeStackNode<V> Node;
+
+public:
+
+    TLockFreeStack(void) : m_head(NULL) { }
+    ~TLockFreeStack(void);
+
+    void push(const V& value) { emplace(value); }
+    void push(V&& value) { emplace(std::move(value)); }
+
+    template <typename... Args>
+    void emplace(Args&&... args);
+
+    // Returns false if the stack was empty, otherwise moves the top value
+    // into value.
+    //
+    bool pop(V& value);
+
+    // Only a snapshot, since other threads may push or pop concurrently.
+    //
+    bool empty(void) const { return m_head.load() == NULL; }
+
+private:
+
+    TLockFreeStack(const TLockFreeStack&);
+    TLockFreeStack& operator=(const TLockFreeStack&);
+
+    std::atomic<Node*> m_head;
+};
+
+template <typename V>
+TLockFreeStack<V>::~TLockFreeStack(void)
+{
+    // no other thread may be using the stack at this point
+    Node* node = m_head.load();
+
+    while (node != NULL)
+    {
+        Node* next = node->m_next;
+        delete node;
+        node = next;
+    }
+}
+
+template <typename V>
+template <typename... Args>
+void
+TLockFreeStack<V>::emplace(Args&&... args)
+{
+    Node* newNode = new Node(std::forward<Args>(args)...);
+    Node* head = m_head.load(std::memory_order_relaxed);
+
+    do
+    {
+        newNode->m_next = head;
+    }
+    while (!m_head.compare_exchange_weak(head, newNode, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <typename V>
+bool
+TLockFreeStack<V>::pop(V& value)
+{
+    TEpochGuard guard;
+    Node* head = m_head.load(std::memory_order_acquire);
+
+    // head->m_next stays readable under the guard even if another thread
+    // pops head first
+    while (head != NULL && !m_head.compare_exchange_weak(head, head->m_next, std::memory_order_acquire, std::memory_order_acquire))
+        ;
+
+    if (head == NULL)
+        return false;
+
+    value = std::move(head->m_value);
+    TEpoch::retire(head);
+    return true;
+}
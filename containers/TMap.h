@@ -3,6 +3,21 @@ Copyright 2016 Tom Kim
 Implementation of a map container that stores key-value pairs backed by a
 red-black tree with an STL-like interface.
 
+Keys are ordered by the comparator C, which the tree applies to the keys of
+the pairs alone, so looking up a key never builds a pair or a value. A map
+constructed from a C keeps a copy of it for every comparison. With a
+transparent comparator such as std::less<> the lookups also accept any type C
+compares with K:
+
+    TMap<std::string, int, std::less<> > counts;
+    counts.find("word");                    // no std::string is built
+
+The backing tree is a template parameter. TBTree trades iterator stability on
+insert and erase for far fewer cache misses on large maps; it orders keys by
+operator<, so C must then be std::less:
+
+    TMap<int, Order, std::less<int>, TBTree<TMapPair<int, Order> > > orders;
+
 Example:
 
     typedef TMap<std::string, std::string> Car;
@@ -27,20 +42,33 @@ Example:
 
 #include "TMap.h"
 
+// Selects the TMapPair constructor that builds the value in place.
+//
+class TMapEmplace
+{
+};
+
 template <typename K, typename V>
 class TMapPair
 {
-    template <typename K, typename V> friend class TMap;
-    template <typename K, typename V> friend class TMapItr;
-    template <typename K, typename V> friend class TMapConstItr;
+    template <typename K, typename V, typename C, typename Tree> friend class TMap;
+    template <typename K, typename V, typename Tree> friend class TMapItr;
+    template <typename K, typename V, typename Tree> friend class TMapConstItr;
 
 public:
 
     TMapPair(const K& key) : first(key) { }
     TMapPair(const K& key, const V& value) : first(key), second(value) { }
     TMapPair(const TMapPair& other) : first(other.first), second(other.second) { }
+    TMapPair(TMapPair&& other) : first(std::move(other.first)), second(std::move(other.second)) { }
     TMapPair(void) { }
 
+    template <typename KeyArg, typename... Args>
+    TMapPair(TMapEmplace, KeyArg&& key, Args&&... args) : first(std::forward<KeyArg>(key)), second(std::forward<Args>(args)...) { }
+
+    TMapPair& operator=(const TMapPair& other) { first = other.first; second = other.second; return *this; }
+    TMapPair& operator=(TMapPair&& other) { first = std::move(other.first); second = std::move(other.second); return *this; }
+
     bool operator<(const TMapPair& other) const { return first < other.first; }
     TMapPair* operator->(void) { return this; }
     const TMapPair* operator->(void) const { return this; }
@@ -49,22 +77,64 @@ public:
     V second;
 };
 
+// Orders pairs by key with C, and compares pairs with bare keys so that
+// lookups need no pair. It is always transparent towards the tree; whether
+// keys of other types than K may be looked up is decided by C, see TMap.
+//
+template <typename K, typename V, typename C>
+class TMapKeyCompare
+{
+public:
+
+    typedef void is_transparent;
+
+    TMapKeyCompare(void) { }
+    TMapKeyCompare(const C& compare) : m_compare(compare) { }
+
+    bool operator()(const TMapPair<K, V>& a, const TMapPair<K, V>& b) const { return m_compare(a.first, b.first); }
+    template <typename Q> bool operator()(const TMapPair<K, V>& a, const Q& b) const { return m_compare(a.first, b); }
+    template <typename Q> bool operator()(const Q& a, const TMapPair<K, V>& b) const { return m_compare(a, b.first); }
+
+private:
+
+    C m_compare;
+};
+
+// TBTree orders pairs by key alone and keeps only keys in its inner nodes
+//
+template <typename K> class TBTreeKeyOf;
+
 template <typename K, typename V>
+class TBTreeKeyOf<TMapPair<K, V> >
+{
+public:
+
+    typedef K Key;
+
+    static const Key& key(const TMapPair<K, V>& pair) { return pair.first; }
+};
+
+template <typename K, typename V, typename C = std::less<K>, typename Tree = TRbTree<TMapPair<K, V>, TRbTreeNoAugment, TMapKeyCompare<K, V, C> > > class TMap;
+template <typename K, typename V, typename Tree> class TMapItr;
+template <typename K, typename V, typename Tree> class TMapConstItr;
+
+template <typename K, typename V, typename Tree>
 class TMapItr
 {
     typedef TMapPair<K, V> Pair;
-    typedef TRbTreeItr<Pair> BaseItr;
-    template <typename K, typename V> friend class TMap;
-    template <typename K, typename V> friend class TMapConstItr;
+    typedef typename Tree::iterator BaseItr;
+    template <typename K, typename V, typename C, typename Tree> friend class TMap;
+    template <typename K, typename V, typename Tree> friend class TMapConstItr;
 
 public:
 
+    TMapItr(void) { }
     TMapItr(const TMapItr& other) : m_baseItr(other.m_baseItr) { }
 
     bool operator==(const TMapItr& other) const { return m_baseItr.operator==(other.m_baseItr); }
     bool operator!=(const TMapItr& other) const { return m_baseItr.operator!=(other.m_baseItr); }
-    bool operator==(const TMapConstItr<K, V>& other) const { return m_baseItr.operator==(other.m_baseItr); }
-    bool operator!=(const TMapConstItr<K, V>& other) const { return m_baseItr.operator!=(other.m_baseItr); }
+    bool operator==(const TMapConstItr<K, V, Tree>& other) const { return m_baseItr.operator==(other.m_baseItr); }
+    bool operator!=(const TMapConstItr<K, V, Tree>& other) const { return m_baseItr.operator!=(other.m_baseItr); }
     TMapItr& operator++(void) { ++m_baseItr; return *this; }
     TMapItr& operator--(void) { --m_baseItr; return *this; }
     V& operator*(void) { Pair& pair = *m_baseItr; return pair.second; }
@@ -77,23 +147,24 @@ private:
     BaseItr m_baseItr;
 };
 
-template <typename K, typename V>
+template <typename K, typename V, typename Tree>
 class TMapConstItr
 {
     typedef TMapPair<K, V> Pair;
-    typedef TRbTreeConstItr<Pair> BaseItr;
-    template <typename K, typename V> friend class TMap;
-    template <typename K, typename V> friend class TMapItr;
+    typedef typename Tree::const_iterator BaseItr;
+    template <typename K, typename V, typename C, typename Tree> friend class TMap;
+    template <typename K, typename V, typename Tree> friend class TMapItr;
 
 public:
 
+    TMapConstItr(void) { }
     TMapConstItr(const TMapConstItr& other) : m_baseItr(other.m_baseItr) { }
-    TMapConstItr(const TMapItr<K, V>& other) : m_baseItr(other.m_baseItr) { }
+    TMapConstItr(const TMapItr<K, V, Tree>& other) : m_baseItr(other.m_baseItr) { }
 
     bool operator==(const TMapConstItr& other) const { return m_baseItr.operator==(other.m_baseItr); }
     bool operator!=(const TMapConstItr& other) const { return m_baseItr.operator!=(other.m_baseItr); }
-    bool operator==(const TMapItr<K, V>& other) const { return m_baseItr.operator==(other.m_baseItr); }
-    bool operator!=(const TMapItr<K, V>& other) const { return m_baseItr.operator!=(other.m_baseItr); }
+    bool operator==(const TMapItr<K, V, Tree>& other) const { return m_baseItr.operator==(other.m_baseItr); }
+    bool operator!=(const TMapItr<K, V, Tree>& other) const { return m_baseItr.operator!=(other.m_baseItr); }
     TMapConstItr& operator++(void) { ++m_baseItr; return *this; }
     TMapConstItr& operator--(void) { --m_baseItr; return *this; }
     const V& operator*(void) const { const Pair& pair = *m_baseItr; return pair.second; }
@@ -106,27 +177,265 @@ private:
     BaseItr m_baseItr;
 };
 
-template <typename K, typename V>
-class TMap : private TRbTree<TMapPair<K, V> >
+template <typename K, typename V, typename C, typename Tree>
+class TMap : private Tree
 {
     typedef TMapPair<K, V> Pair;
 
+    static_assert(TRbTreeOrdersBy<Tree, C, K>::VALUE, "TBTree orders keys by operator< and cannot use C");
+
 public:
 
-    typedef TMapItr<K, V> iterator;
-    typedef TMapConstItr<K, V> const_iterator;
+    typedef TMapItr<K, V, Tree> iterator;
+    typedef TMapConstItr<K, V, Tree> const_iterator;
+
+    TMap(void) { }
+    explicit TMap(const C& compare) : Tree(TMapKeyCompare<K, V, C>(compare)) { }
+
+    // Insert the pair, or overwrite the value if key is present. Returns
+    // where the pair is and whether key was new. The value is copied or
+    // moved once, into the new node or over the old value.
+    //
+    std::pair<iterator, bool> insert(const K& key, const V& value) { return insert_or_assign(key, value); }
+    std::pair<iterator, bool> insert(K&& key, V&& value) { return insert_or_assign(std::move(key), std::move(value)); }
+    template <typename M> std::pair<iterator, bool> insert_or_assign(const K& key, M&& value);
+    template <typename M> std::pair<iterator, bool> insert_or_assign(K&& key, M&& value);
+
+    // Build the value from args in the new node if key is absent; if it is
+    // present nothing is constructed and args are left untouched.
+    //
+    template <typename... Args> std::pair<iterator, bool> try_emplace(const K& key, Args&&... args);
+    template <typename... Args> std::pair<iterator, bool> try_emplace(K&& key, Args&&... args);
+
+    // The value for key, default-constructed in place if key is absent.
+    //
+    V& operator[](const K& key) { return *try_emplace(key).first; }
+    V& operator[](K&& key) { return *try_emplace(std::move(key)).first; }
+
+    // O(1) amortized when key belongs right before or after hint, e.g. end()
+    // for ascending keys.
+    //
+    iterator insert_hint(iterator hint, const K& key, const V& value);
+
+    void erase(const K& key) { Tree::erase(Tree::find(key)); }
+    void erase(iterator itr) { Tree::erase(itr.m_baseItr); }
+    void clear(void) { Tree::clear(); }
+
+    // Erase the pairs in [first, last), or those for which pred(pair) is
+    // true, returning how many; long runs are split off rather than erased
+    // pair by pair. See TRbTree.
+    //
+    void erase(iterator first, iterator last) { Tree::erase(first.m_baseItr, last.m_baseItr); }
+    template <typename Pred> size_t erase_if(Pred pred) { return Tree::erase_if(pred); }
+
+    // Copies clone the tree in O(n); moves and swap are O(1). See TRbTree.
+    //
+    void swap(TMap& other) { Tree::swap(static_cast<Tree&>(other)); }
+
+    // Replace the contents in O(n) from a range of key-value pairs (anything
+    // with first and second) sorted by key. For equal keys the last one wins.
+    // The range is walked twice, so it must be a forward range.
+    //
+    template <typename ForwardItr> void assign_sorted(ForwardItr first, ForwardItr last);
+
+    // Same as assign_sorted for a range in any order, sorting a copy first.
+    //
+    template <typename InputItr> void assign_unsorted(InputItr first, InputItr last);
+
+    iterator find(const K& key) { return iterator(Tree::find(key)); }
+    iterator lower_bound(const K& key) { return iterator(Tree::lower_bound(key)); }
+    iterator upper_bound(const K& key) { return iterator(Tree::upper_bound(key)); }
+    std::pair<iterator, iterator> equal_range(const K& key) { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    iterator begin(void) { return iterator(Tree::begin()); }
+    iterator end(void) { return iterator(Tree::end()); }
+    iterator last(void) { return iterator(Tree::last()); }
+
+    const_iterator find(const K& key) const { return const_iterator(Tree::find(key)); }
+    const_iterator lower_bound(const K& key) const { return const_iterator(Tree::lower_bound(key)); }
+    const_iterator upper_bound(const K& key) const { return const_iterator(Tree::upper_bound(key)); }
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    const_iterator begin(void) const { return const_iterator(Tree::begin()); }
+    const_iterator end(void) const { return const_iterator(Tree::end()); }
+    const_iterator last(void) const { return const_iterator(Tree::last()); }
+
+    // Heterogeneous lookups, available when C is transparent.
+    //
+    template <typename Q> iterator find(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return iterator(Tree::find(key)); }
+    template <typename Q> iterator lower_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return iterator(Tree::lower_bound(key)); }
+    template <typename Q> iterator upper_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return iterator(Tree::upper_bound(key)); }
+    template <typename Q> std::pair<iterator, iterator> equal_range(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return std::make_pair(lower_bound(key), upper_bound(key)); }
+
+    template <typename Q> const_iterator find(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return const_iterator(Tree::find(key)); }
+    template <typename Q> const_iterator lower_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return const_iterator(Tree::lower_bound(key)); }
+    template <typename Q> const_iterator upper_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return const_iterator(Tree::upper_bound(key)); }
+    template <typename Q> std::pair<const_iterator, const_iterator> equal_range(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return std::make_pair(lower_bound(key), upper_bound(key)); }
 
-    void insert(const K& key, const V& value) { TRbTree::insert(Pair(key, value)); }
-    void erase(const K& key) { TRbTree::erase(Pair(key)); }
-    void erase(iterator itr) { TRbTree::erase(itr.m_baseItr); }
+    // Find keys[i] into out[i] for every i < n, end() where it is absent,
+    // overlapping the cache misses of neighbouring lookups. See TRbTree.
+    //
+    void find_batch(const K* keys, size_t n, iterator* out) { findBatch(static_cast<Tree&>(*this), keys, n, out); }
+    void find_batch(const K* keys, size_t n, const_iterator* out) const { findBatch(static_cast<const Tree&>(*this), keys, n, out); }
 
-    iterator find(const K& key) { return iterator(TRbTree::find(Pair(key))); }
-    iterator begin(void) { return iterator(TRbTree::begin()); }
-    iterator end(void) { return iterator(TRbTree::end()); }
-    iterator last(void) { return iterator(TRbTree::last()); }
+    // Call func(pair) for every pair with key in [lo, hi) in order, where
+    // pair.first is the key and pair.second the value.
+    //
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func);
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func) const;
 
-    const_iterator find(const K& key) const { return const_iterator(TRbTree::find(Pair(key))); }
-    const_iterator begin(void) const { return const_iterator(TRbTree::begin()); }
-    const_iterator end(void) const { return const_iterator(TRbTree::end()); }
-    const_iterator last(void) const { return const_iterator(TRbTree::last()); }
+    // Set operations on keys that take over the pairs of other and leave it
+    // empty; for a key in both maps the value of this map is kept. filter
+    // keeps the pairs for which pred(pair) is true. See TRbTree.
+    //
+    void set_union(TMap& other) { Tree::set_union(static_cast<Tree&>(other)); }
+    void set_intersection(TMap& other) { Tree::set_intersection(static_cast<Tree&>(other)); }
+    void set_difference(TMap& other) { Tree::set_difference(static_cast<Tree&>(other)); }
+    template <typename Pred> void filter(Pred pred) { Tree::filter(pred); }
+
+    // join appends other, whose keys must all be greater; split moves the
+    // pairs with keys not less than key into the empty right.
+    //
+    void join(TMap& other) { Tree::join(static_cast<Tree&>(other)); }
+    void split(const K& key, TMap& right) { Tree::split(key, static_cast<Tree&>(right)); }
+
+    // Move the nodes into one block in key order, all at once or in slices
+    // of up to count nodes; see TRbTree.
+    //
+    void compact(void) { Tree::compact(); }
+    bool compact_step(size_t count) { return Tree::compact_step(count); }
+
+    size_t size(void) const { return Tree::size(); }
+
+private:
+
+    template <typename T, typename Itr> static void findBatch(T& tree, const K* keys, size_t n, Itr* out);
 };
+
+// The tree looks up key before it builds anything, so value is consumed by
+// either the new pair or the assignment, never both.
+//
+template <typename K, typename V, typename C, typename Tree>
+template <typename M>
+std::pair<typename TMap<K, V, C, Tree>::iterator, bool>
+TMap<K, V, C, Tree>::insert_or_assign(const K& key, M&& value)
+{
+    std::pair<typename Tree::iterator, bool> result = Tree::try_emplace(key, TMapEmplace(), key, std::forward<M>(value));
+
+    if (!result.second)
+        (*result.first).second = std::forward<M>(value);
+
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename M>
+std::pair<typename TMap<K, V, C, Tree>::iterator, bool>
+TMap<K, V, C, Tree>::insert_or_assign(K&& key, M&& value)
+{
+    std::pair<typename Tree::iterator, bool> result = Tree::try_emplace(key, TMapEmplace(), std::move(key), std::forward<M>(value));
+
+    if (!result.second)
+        (*result.first).second = std::forward<M>(value);
+
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename... Args>
+std::pair<typename TMap<K, V, C, Tree>::iterator, bool>
+TMap<K, V, C, Tree>::try_emplace(const K& key, Args&&... args)
+{
+    std::pair<typename Tree::iterator, bool> result = Tree::try_emplace(key, TMapEmplace(), key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename... Args>
+std::pair<typename TMap<K, V, C, Tree>::iterator, bool>
+TMap<K, V, C, Tree>::try_emplace(K&& key, Args&&... args)
+{
+    std::pair<typename Tree::iterator, bool> result = Tree::try_emplace(key, TMapEmplace(), std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+typename TMap<K, V, C, Tree>::iterator
+TMap<K, V, C, Tree>::insert_hint(iterator hint, const K& key, const V& value)
+{
+    std::pair<typename Tree::iterator, bool> result = Tree::try_emplace_hint(hint.m_baseItr, key, TMapEmplace(), key, value);
+
+    if (!result.second)
+        (*result.first).second = value;
+
+    return iterator(result.first);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename ForwardItr>
+void
+TMap<K, V, C, Tree>::assign_sorted(ForwardItr first, ForwardItr last)
+{
+    size_t count = 0;
+
+    for (ForwardItr itr = first; itr != last; ++itr)
+        count++;
+
+    typename Tree::builder builder(*this, count);
+
+    for (ForwardItr itr = first; itr != last; ++itr)
+        builder.push_back(Pair(itr->first, itr->second));
+
+    builder.finish();
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename InputItr>
+void
+TMap<K, V, C, Tree>::assign_unsorted(InputItr first, InputItr last)
+{
+    std::vector<Pair> pairs;
+
+    for (InputItr itr = first; itr != last; ++itr)
+        pairs.push_back(Pair(itr->first, itr->second));
+
+    // stable so that the last of equal keys still wins
+    std::stable_sort(pairs.begin(), pairs.end(), Tree::key_comp());
+    Tree::assign_sorted(pairs.begin(), pairs.end());
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename Func>
+void
+TMap<K, V, C, Tree>::for_each_in_range(const K& lo, const K& hi, Func func)
+{
+    for (typename Tree::iterator itr = Tree::lower_bound(lo); itr != Tree::end() && Tree::key_comp()(*itr, hi); ++itr)
+        func(*itr);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename Func>
+void
+TMap<K, V, C, Tree>::for_each_in_range(const K& lo, const K& hi, Func func) const
+{
+    for (typename Tree::const_iterator itr = Tree::lower_bound(lo); itr != Tree::end() && Tree::key_comp()(*itr, hi); ++itr)
+        func(*itr);
+}
+
+template <typename K, typename V, typename C, typename Tree>
+template <typename T, typename Itr>
+void
+TMap<K, V, C, Tree>::findBatch(T& tree, const K* keys, size_t n, Itr* out)
+{
+    // the tree fills its own iterators, which are rewrapped a chunk at a time
+    enum { CHUNK = 64 };
+
+    typename Itr::BaseItr found[CHUNK];
+
+    for (size_t first = 0; first < n; first += CHUNK)
+    {
+        size_t count = std::min<size_t>(CHUNK, n - first);
+        tree.find_batch(keys + first, count, found);
+
+        for (size_t i = 0; i < count; i++)
+            out[first + i] = Itr(found[i]);
+    }
+}
@@ -0,0 +1,652 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a map container for read-mostly data shared between threads,
+backed by a persistent left-leaning red-black tree.
+
+Published nodes are never modified. A write copies only the nodes on the path
+it changes, O(log n) of them, and publishes the new version with one atomic
+store, so readers need no locks. A reader takes a snapshot, which is wait-free,
+and sees exactly one version for as long as it holds it. Replaced nodes are
+reclaimed through TEpoch once no snapshot can reach them. Writers are
+serialized by a mutex.
+
+A snapshot keeps its thread in an epoch critical section, so it must be
+released on the thread that took it, and a long-lived snapshot holds back
+reclamation for every TEpoch user.
+
+Example:
+
+    TPersistentMap<std::string, Route> routes;
+    routes.insert("10.0.0.0/8", route);     // from any thread
+
+    {
+        TPersistentMap<std::string, Route>::Snapshot snapshot = routes.snapshot();
+        TPersistentMap<std::string, Route>::const_iterator itr = snapshot.find("10.0.0.0/8");
+
+        if (itr != snapshot.end())
+            use(itr->second);
+    }
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <vector>
+#include "TEpoch.h"
+
+template <typename K, typename V>
+class TPersistentMapNode
+{
+    template <typename K, typename V> friend class TPersistentMap;
+    template <typename K, typename V> friend class TPersistentMapSnapshot;
+    template <typename K, typename V> friend class TPersistentMapConstItr;
+
+public:
+
+    const TPersistentMapNode* operator->(void) const { return this; }
+
+    K first;
+    V second;
+
+private:
+
+    TPersistentMapNode(const K& key, const V& value, uint64_t stamp)
+        : first(key), second(value), m_red(true), m_stamp(stamp), m_left(NULL), m_right(NULL) { }
+    TPersistentMapNode(const TPersistentMapNode& other, uint64_t stamp)
+        : first(other.first), second(other.second), m_red(other.m_red), m_stamp(stamp), m_left(other.m_left), m_right(other.m_right) { }
+
+    bool m_red;
+    uint64_t m_stamp;                       // the write that created the node
+    TPersistentMapNode* m_left;
+    TPersistentMapNode* m_right;
+};
+
+// One published version of the tree.
+//
+template <typename K, typename V>
+class TPersistentMapVersion
+{
+    template <typename K, typename V> friend class TPersistentMap;
+    template <typename K, typename V> friend class TPersistentMapSnapshot;
+
+private:
+
+    TPersistentMapVersion(TPersistentMapNode<K, V>* root, size_t size) : m_root(root), m_size(size) { }
+
+    TPersistentMapNode<K, V>* m_root;
+    size_t m_size;
+};
+
+// Nodes have no parent links since they are shared between versions, so the
+// iterator keeps the ancestors still to be visited on a stack.
+//
+template <typename K, typename V>
+class TPersistentMapConstItr
+{
+    typedef TPersistentMapNode<K, V> Node;
+    template <typename K, typename V> friend class TPersistentMapSnapshot;
+
+public:
+
+    TPersistentMapConstItr(const TPersistentMapConstItr& other);
+
+    bool operator==(const TPersistentMapConstItr& other) const { return top() == other.top(); }
+    bool operator!=(const TPersistentMapConstItr& other) const { return top() != other.top(); }
+    TPersistentMapConstItr& operator++(void);
+    const V& operator*(void) const { assert(m_depth > 0); return top()->second; }
+    const Node& operator->(void) const { assert(m_depth > 0); return *top(); }
+
+private:
+
+    // the height of a left-leaning red-black tree is at most 2 log2(n + 1)
+    enum { MAX_DEPTH = 96 };
+
+    TPersistentMapConstItr(void) : m_depth(0) { }
+
+    const Node* top(void) const { return (m_depth == 0) ? NULL : m_stack[m_depth - 1]; }
+    void push(const Node* node) { assert(m_depth < MAX_DEPTH); m_stack[m_depth++] = node; }
+    void pushLeftSpine(const Node* node) { for (; node != NULL; node = node->m_left) push(node); }
+
+    const Node* m_stack[MAX_DEPTH];
+    size_t m_depth;
+};
+
+// A consistent read-only view of one version of a TPersistentMap.
+//
+template <typename K, typename V>
+class TPersistentMapSnapshot
+{
+    typedef TPersistentMapNode<K, V> Node;
+    typedef TPersistentMapVersion<K, V> Version;
+    template <typename K, typename V> friend class TPersistentMap;
+
+public:
+
+    typedef TPersistentMapConstItr<K, V> const_iterator;
+
+    TPersistentMapSnapshot(const TPersistentMapSnapshot& other) : m_version(other.m_version) { TEpoch::enter(); }
+    ~TPersistentMapSnapshot(void) { TEpoch::leave(); }
+
+    const_iterator find(const K& key) const;
+    const_iterator lower_bound(const K& key) const;
+    const_iterator begin(void) const;
+    const_iterator end(void) const { return const_iterator(); }
+
+    size_t size(void) const { return m_version->m_size; }
+
+private:
+
+    // the caller has already entered the epoch for us
+    TPersistentMapSnapshot(const Version* version) : m_version(version) { }
+
+    TPersistentMapSnapshot& operator=(const TPersistentMapSnapshot&);
+
+    const Version* m_version;
+};
+
+template <typename K, typename V>
+class TPersistentMap
+{
+    typedef TPersistentMapNode<K, V> Node;
+    typedef TPersistentMapVersion<K, V> Version;
+
+public:
+
+    typedef TPersistentMapSnapshot<K, V> Snapshot;
+    typedef TPersistentMapConstItr<K, V> const_iterator;
+
+    TPersistentMap(void);
+    ~TPersistentMap(void);
+
+    void insert(const K& key, const V& value);
+    void erase(const K& key);
+
+    // Wait-free; the snapshot sees no writes made after it was taken.
+    //
+    Snapshot snapshot(void) const;
+
+    size_t size(void) const { return m_current.load(std::memory_order_acquire)->m_size; }
+
+private:
+
+    TPersistentMap(const TPersistentMap&);
+    TPersistentMap& operator=(const TPersistentMap&);
+
+    static bool isRed(const Node* node) { return node != NULL && node->m_red; }
+
+    // Return node itself if it was created by the current write, or else a
+    // copy that the write may modify. The original stays in the published
+    // version, so it is only noted in m_replaced here and retired once the
+    // write has been published.
+    //
+    Node* own(Node* node);
+    Node* track(Node* node);
+    void discard(Node* node);
+
+    // The recursive left-leaning red-black operations; every node they touch
+    // has been passed through own() first.
+    //
+    Node* insert(Node* node, const K& key, const V& value, bool& added);
+    Node* erase(Node* node, const K& key);
+    Node* eraseMin(Node* node);
+    Node* rotateLeft(Node* node);
+    Node* rotateRight(Node* node);
+    void flipColors(Node* node);
+    Node* moveRedLeft(Node* node);
+    Node* moveRedRight(Node* node);
+    Node* balance(Node* node);
+
+    // Make next current and retire what it replaced, or, if the write threw
+    // before that, free the nodes it created and leave the published
+    // version untouched.
+    //
+    void publish(Version* next);
+    void abandon(void);
+    void destroy(Node* node);
+
+    std::atomic<Version*> m_current;
+    std::mutex m_writeLock;
+    uint64_t m_stamp;
+    std::vector<Node*> m_created;   // nodes made by the current write
+    std::vector<Node*> m_replaced;  // published nodes it has copied or dropped
+};
+
+// TPersistentMapConstItr
+//
+template <typename K, typename V>
+TPersistentMapConstItr<K, V>::TPersistentMapConstItr(const TPersistentMapConstItr& other)
+    : m_depth(other.m_depth)
+{
+    for (size_t i = 0; i < m_depth; i++)
+        m_stack[i] = other.m_stack[i];
+}
+
+template <typename K, typename V>
+TPersistentMapConstItr<K, V>&
+TPersistentMapConstItr<K, V>::operator++(void)
+{
+    assert(m_depth > 0);
+
+    const Node* node = m_stack[--m_depth];
+    pushLeftSpine(node->m_right);
+    return *this;
+}
+
+// TPersistentMapSnapshot
+//
+template <typename K, typename V>
+typename TPersistentMapSnapshot<K, V>::const_iterator
+TPersistentMapSnapshot<K, V>::find(const K& key) const
+{
+    const_iterator itr = lower_bound(key);
+
+    if (itr.m_depth == 0 || key < itr.top()->first)
+        return end();
+
+    return itr;
+}
+
+template <typename K, typename V>
+typename TPersistentMapSnapshot<K, V>::const_iterator
+TPersistentMapSnapshot<K, V>::lower_bound(const K& key) const
+{
+    // keep the ancestors we branch left at; they follow the target in order
+    const_iterator itr;
+    const Node* node = m_version->m_root;
+
+    while (node != NULL)
+    {
+        if (node->first < key)
+            node = node->m_right;
+        else
+        {
+            itr.push(node);
+
+            if (!(key < node->first))
+                break;
+
+            node = node->m_left;
+        }
+    }
+
+    return itr;
+}
+
+template <typename K, typename V>
+typename TPersistentMapSnapshot<K, V>::const_iterator
+TPersistentMapSnapshot<K, V>::begin(void) const
+{
+    const_iterator itr;
+    itr.pushLeftSpine(m_version->m_root);
+    return itr;
+}
+
+// TPersistentMap
+//
+template <typename K, typename V>
+TPersistentMap<K, V>::TPersistentMap(void)
+    : m_current(new Version(NULL, 0)), m_stamp(0)
+{ }
+
+template <typename K, typename V>
+TPersistentMap<K, V>::~TPersistentMap(void)
+{
+    // no snapshot may outlive the map; earlier versions are already retired
+    Version* version = m_current.load();
+    destroy(version->m_root);
+    delete version;
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::insert(const K& key, const V& value)
+{
+    std::lock_guard<std::mutex> lock(m_writeLock);
+    TEpochGuard guard;
+
+    Version* version = m_current.load(std::memory_order_relaxed);
+    bool added = false;
+
+    Version* next;
+
+    m_stamp++;
+    m_created.clear();
+    m_replaced.clear();
+
+    try
+    {
+        Node* root = insert(version->m_root, key, value, added);
+        root->m_red = false;
+        next = new Version(root, version->m_size + (added ? 1 : 0));
+    }
+    catch (...)
+    {
+        abandon();
+        throw;
+    }
+
+    publish(next);
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::erase(const K& key)
+{
+    std::lock_guard<std::mutex> lock(m_writeLock);
+    TEpochGuard guard;
+
+    Version* version = m_current.load(std::memory_order_relaxed);
+    const Node* node = version->m_root;
+
+    // the top-down erase assumes the key is present
+    while (node != NULL && (key < node->first || node->first < key))
+        node = (key < node->first) ? node->m_left : node->m_right;
+
+    if (node == NULL)
+        return;
+
+    Version* next;
+
+    m_stamp++;
+    m_created.clear();
+    m_replaced.clear();
+
+    try
+    {
+        Node* root = own(version->m_root);
+
+        if (!isRed(root->m_left) && !isRed(root->m_right))
+            root->m_red = true;
+
+        root = erase(root, key);
+
+        if (root != NULL)
+            root->m_red = false;
+
+        next = new Version(root, version->m_size - 1);
+    }
+    catch (...)
+    {
+        abandon();
+        throw;
+    }
+
+    publish(next);
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Snapshot
+TPersistentMap<K, V>::snapshot(void) const
+{
+    TEpoch::enter();
+    return Snapshot(m_current.load(std::memory_order_acquire));
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::own(Node* node)
+{
+    if (node == NULL || node->m_stamp == m_stamp)
+        return node;
+
+    Node* copy = track(new Node(*node, m_stamp));
+    m_replaced.push_back(node);
+    return copy;
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::track(Node* node)
+{
+    try
+    {
+        m_created.push_back(node);
+    }
+    catch (...)
+    {
+        delete node;
+        throw;
+    }
+
+    return node;
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::discard(Node* node)
+{
+    if (node->m_stamp != m_stamp)
+    {
+        m_replaced.push_back(node);
+        return;
+    }
+
+    // a copy made by this write was never published
+    for (size_t i = 0; i < m_created.size(); i++)
+    {
+        if (m_created[i] == node)
+        {
+            m_created[i] = m_created.back();
+            m_created.pop_back();
+            break;
+        }
+    }
+
+    delete node;
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::insert(Node* node, const K& key, const V& value, bool& added)
+{
+    if (node == NULL)
+    {
+        added = true;
+        return track(new Node(key, value, m_stamp));
+    }
+
+    node = own(node);
+
+    if (key < node->first)
+        node->m_left = insert(node->m_left, key, value, added);
+    else if (node->first < key)
+        node->m_right = insert(node->m_right, key, value, added);
+    else
+        node->second = value;
+
+    return balance(node);
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::erase(Node* node, const K& key)
+{
+    node = own(node);
+
+    if (key < node->first)
+    {
+        if (!isRed(node->m_left) && !isRed(node->m_left->m_left))
+            node = moveRedLeft(node);
+
+        node->m_left = erase(node->m_left, key);
+    }
+    else
+    {
+        if (isRed(node->m_left))
+            node = rotateRight(node);
+
+        if (!(node->first < key) && node->m_right == NULL)
+        {
+            discard(node);
+            return NULL;
+        }
+
+        if (!isRed(node->m_right) && !isRed(node->m_right->m_left))
+            node = moveRedRight(node);
+
+        if (!(node->first < key))
+        {
+            // take over the successor's entry and erase it below
+            const Node* successor = node->m_right;
+
+            while (successor->m_left != NULL)
+                successor = successor->m_left;
+
+            node->first = successor->first;
+            node->second = successor->second;
+            node->m_right = eraseMin(node->m_right);
+        }
+        else
+            node->m_right = erase(node->m_right, key);
+    }
+
+    return balance(node);
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::eraseMin(Node* node)
+{
+    node = own(node);
+
+    if (node->m_left == NULL)
+    {
+        discard(node);
+        return NULL;
+    }
+
+    if (!isRed(node->m_left) && !isRed(node->m_left->m_left))
+        node = moveRedLeft(node);
+
+    node->m_left = eraseMin(node->m_left);
+    return balance(node);
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::rotateLeft(Node* node)
+{
+    Node* x = own(node->m_right);
+    node->m_right = x->m_left;
+    x->m_left = node;
+    x->m_red = node->m_red;
+    node->m_red = true;
+    return x;
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::rotateRight(Node* node)
+{
+    Node* x = own(node->m_left);
+    node->m_left = x->m_right;
+    x->m_right = node;
+    x->m_red = node->m_red;
+    node->m_red = true;
+    return x;
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::flipColors(Node* node)
+{
+    node->m_left = own(node->m_left);
+    node->m_right = own(node->m_right);
+
+    node->m_red = !node->m_red;
+    node->m_left->m_red = !node->m_left->m_red;
+    node->m_right->m_red = !node->m_right->m_red;
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::moveRedLeft(Node* node)
+{
+    flipColors(node);
+
+    if (isRed(node->m_right->m_left))
+    {
+        node->m_right = rotateRight(node->m_right);
+        node = rotateLeft(node);
+        flipColors(node);
+    }
+
+    return node;
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::moveRedRight(Node* node)
+{
+    flipColors(node);
+
+    if (isRed(node->m_left->m_left))
+    {
+        node = rotateRight(node);
+        flipColors(node);
+    }
+
+    return node;
+}
+
+template <typename K, typename V>
+typename TPersistentMap<K, V>::Node*
+TPersistentMap<K, V>::balance(Node* node)
+{
+    if (isRed(node->m_right) && !isRed(node->m_left))
+        node = rotateLeft(node);
+
+    if (isRed(node->m_left) && isRed(node->m_left->m_left))
+        node = rotateRight(node);
+
+    if (isRed(node->m_left) && isRed(node->m_right))
+        flipColors(node);
+
+    return node;
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::publish(Version* next)
+{
+    Version* version = m_current.load(std::memory_order_relaxed);
+    m_current.store(next, std::memory_order_release);
+
+    // only now are the replaced nodes unreachable for new snapshots; should
+    // a retire fail, the rest leak rather than being freed early
+    TEpoch::retire(version);
+
+    for (size_t i = 0; i < m_replaced.size(); i++)
+        TEpoch::retire(m_replaced[i]);
+
+    m_created.clear();
+    m_replaced.clear();
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::abandon(void)
+{
+    // nothing of this write was published, so its nodes can go at once and
+    // the nodes it meant to replace stay where they are
+    for (size_t i = 0; i < m_created.size(); i++)
+        delete m_created[i];
+
+    m_created.clear();
+    m_replaced.clear();
+}
+
+template <typename K, typename V>
+void
+TPersistentMap<K, V>::destroy(Node* node)
+{
+    while (node != NULL)
+    {
+        destroy(node->m_left);
+        Node* right = node->m_right;
+        delete node;
+        node = right;
+    }
+}
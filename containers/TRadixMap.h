@@ -0,0 +1,1442 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of an adaptive radix tree as described in The Adaptive Radix
+Tree: ARTful Indexing for Main-Memory Databases by Leis et al., mapping string
+or integer keys to values with the interface of TMap.
+
+A lookup reads the key a byte at a time, one node per byte, instead of
+comparing whole keys at every level of a balanced tree. Inner nodes come in
+four sizes, for up to 4, 16, 48 and 256 children, and grow or shrink as
+children are added and removed; a node of 16 is searched with SSE2. A chain
+of nodes with one child each is compressed into the prefix of the node below
+it. Only the first MAX_PREFIX bytes of a prefix are stored: lookups skip the
+rest and check the whole key at the leaf, while inserts and ordered searches
+read the missing bytes from a leaf below. A key is stored in a leaf as high
+as it can go, so a leaf may sit in place of a whole subtree, and a key that is
+a prefix of others hangs off the node where it ends.
+
+Leaves are linked in key order, so iteration, lower_bound and prefix scans
+walk the list once they have found their first leaf.
+
+Keys are read as bytes by KeyBytes. TRadixMapKey reads std::string in order
+and integers big-endian with the sign bit flipped, so byte order is key order.
+
+Example:
+
+    TRadixMap<std::string, Handler> routes;
+    routes.insert("/api/v1/users", usersHandler);
+
+    TRadixMap<std::string, Handler>::iterator itr = routes.find(path);
+    if (itr != routes.end())
+        (*itr)(request);
+
+    routes.for_each_prefix("/api/v1/", [](const TRadixMapPair<std::string, Handler>& pair) { ... });
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRADIXMAP_SSE2 1
+#endif
+
+// Reads key i bytes in, for i below size(key).
+//
+template <typename K>
+class TRadixMapKey
+{
+    typedef typename std::make_unsigned<K>::type Bits;
+
+public:
+
+    static size_t size(const K&) { return sizeof(K); }
+    static uint8_t at(const K& key, size_t i)
+    {
+        Bits bits = static_cast<Bits>(key);
+
+        if (std::is_signed<K>::value)
+            bits ^= static_cast<Bits>(Bits(1) << (8 * sizeof(K) - 1));
+
+        return static_cast<uint8_t>(bits >> (8 * (sizeof(K) - 1 - i)));
+    }
+};
+
+template <>
+class TRadixMapKey<std::string>
+{
+public:
+
+    static size_t size(const std::string& key) { return key.size(); }
+    static uint8_t at(const std::string& key, size_t i) { return static_cast<uint8_t>(key[i]); }
+};
+
+template <typename K, typename V>
+class TRadixMapPair
+{
+public:
+
+    template <typename... Args>
+    TRadixMapPair(const K& key, Args&&... args) : first(key), second(std::forward<Args>(args)...) { }
+
+    const K first;
+    V second;
+};
+
+template <typename K, typename V, typename KeyBytes = TRadixMapKey<K> > class TRadixMap;
+
+template <typename K, typename V>
+class TRadixMapNode
+{
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+
+protected:
+
+    enum { NODE4, NODE16, NODE48, NODE256, LEAF };
+
+    TRadixMapNode(uint8_t type) : m_type(type) { }
+
+    uint8_t m_type;
+};
+
+template <typename K, typename V>
+class TRadixMapLeaf : private TRadixMapNode<K, V>
+{
+    typedef TRadixMapNode<K, V> Node;
+    typedef TRadixMapPair<K, V> Pair;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+    template <typename K, typename V> friend class TRadixMapItr;
+    template <typename K, typename V> friend class TRadixMapConstItr;
+
+private:
+
+    template <typename... Args>
+    TRadixMapLeaf(const K& key, Args&&... args) : Node(Node::LEAF), m_prev(NULL), m_next(NULL), m_pair(key, std::forward<Args>(args)...) { }
+
+    Node* asNode(void) { return this; }
+
+    TRadixMapLeaf* m_prev;
+    TRadixMapLeaf* m_next;
+    Pair m_pair;
+};
+
+template <typename K, typename V>
+class TRadixMapInner : private TRadixMapNode<K, V>
+{
+    typedef TRadixMapNode<K, V> Node;
+    typedef TRadixMapLeaf<K, V> Leaf;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+
+protected:
+
+    // rounds the header up to 32 bytes
+    enum { MAX_PREFIX = 16 };
+
+    TRadixMapInner(uint8_t type) : Node(type), m_count(0), m_prefixLen(0), m_leaf(NULL) { }
+
+    Node* asNode(void) { return this; }
+
+    uint16_t m_count;
+    uint32_t m_prefixLen;
+    uint8_t m_prefix[MAX_PREFIX];
+    Leaf* m_leaf;   // the key that ends at this node, if any
+};
+
+template <typename K, typename V>
+class TRadixMapNode4 : private TRadixMapInner<K, V>
+{
+    typedef TRadixMapNode<K, V> Node;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+
+private:
+
+    TRadixMapNode4(void) : TRadixMapInner(Node::NODE4) { }
+
+    uint8_t m_keys[4];
+    Node* m_children[4];
+};
+
+template <typename K, typename V>
+class TRadixMapNode16 : private TRadixMapInner<K, V>
+{
+    typedef TRadixMapNode<K, V> Node;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+
+private:
+
+    TRadixMapNode16(void) : TRadixMapInner(Node::NODE16), m_keys() { }
+
+    uint8_t m_keys[16];
+    Node* m_children[16];
+};
+
+template <typename K, typename V>
+class TRadixMapNode48 : private TRadixMapInner<K, V>
+{
+    typedef TRadixMapNode<K, V> Node;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+
+private:
+
+    TRadixMapNode48(void) : TRadixMapInner(Node::NODE48), m_index(), m_children() { }
+
+    uint8_t m_index[256];   // slot + 1 of the child for each byte, 0 for none
+    Node* m_children[48];
+};
+
+template <typename K, typename V>
+class TRadixMapNode256 : private TRadixMapInner<K, V>
+{
+    typedef TRadixMapNode<K, V> Node;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+
+private:
+
+    TRadixMapNode256(void) : TRadixMapInner(Node::NODE256), m_children() { }
+
+    Node* m_children[256];
+};
+
+template <typename K, typename V>
+class TRadixMapItr
+{
+    typedef TRadixMapLeaf<K, V> Leaf;
+    typedef TRadixMapPair<K, V> Pair;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+    template <typename K, typename V> friend class TRadixMapConstItr;
+
+public:
+
+    TRadixMapItr(void) : m_leaf(NULL) { }
+    TRadixMapItr(const TRadixMapItr& other) : m_leaf(other.m_leaf) { }
+
+    bool operator==(const TRadixMapItr& other) const { return m_leaf == other.m_leaf; }
+    bool operator!=(const TRadixMapItr& other) const { return m_leaf != other.m_leaf; }
+    TRadixMapItr& operator++(void) { m_leaf = m_leaf->m_next; return *this; }
+    TRadixMapItr& operator--(void) { m_leaf = m_leaf->m_prev; return *this; }
+    V& operator*(void) const { return m_leaf->m_pair.second; }
+    Pair* operator->(void) const { return &m_leaf->m_pair; }
+
+private:
+
+    TRadixMapItr(Leaf* leaf) : m_leaf(leaf) { }
+
+    Leaf* m_leaf;
+};
+
+template <typename K, typename V>
+class TRadixMapConstItr
+{
+    typedef TRadixMapLeaf<K, V> Leaf;
+    typedef TRadixMapPair<K, V> Pair;
+    template <typename K, typename V, typename KeyBytes> friend class TRadixMap;
+    template <typename K, typename V> friend class TRadixMapItr;
+
+public:
+
+    TRadixMapConstItr(void) : m_leaf(NULL) { }
+    TRadixMapConstItr(const TRadixMapConstItr& other) : m_leaf(other.m_leaf) { }
+    TRadixMapConstItr(const TRadixMapItr<K, V>& other) : m_leaf(other.m_leaf) { }
+
+    bool operator==(const TRadixMapConstItr& other) const { return m_leaf == other.m_leaf; }
+    bool operator!=(const TRadixMapConstItr& other) const { return m_leaf != other.m_leaf; }
+    TRadixMapConstItr& operator++(void) { m_leaf = m_leaf->m_next; return *this; }
+    TRadixMapConstItr& operator--(void) { m_leaf = m_leaf->m_prev; return *this; }
+    const V& operator*(void) const { return m_leaf->m_pair.second; }
+    const Pair* operator->(void) const { return &m_leaf->m_pair; }
+
+private:
+
+    TRadixMapConstItr(Leaf* leaf) : m_leaf(leaf) { }
+
+    Leaf* m_leaf;
+};
+
+template <typename K, typename V, typename KeyBytes>
+class TRadixMap
+{
+    typedef TRadixMapNode<K, V> Node;
+    typedef TRadixMapLeaf<K, V> Leaf;
+    typedef TRadixMapInner<K, V> Inner;
+    typedef TRadixMapNode4<K, V> Node4;
+    typedef TRadixMapNode16<K, V> Node16;
+    typedef TRadixMapNode48<K, V> Node48;
+    typedef TRadixMapNode256<K, V> Node256;
+
+public:
+
+    typedef TRadixMapItr<K, V> iterator;
+    typedef TRadixMapConstItr<K, V> const_iterator;
+
+    TRadixMap(void) : m_root(NULL), m_first(NULL), m_last(NULL), m_size(0) { }
+    ~TRadixMap(void) { clear(); }
+
+    // Moving and swapping exchange the trees in O(1); there is no copy.
+    //
+    TRadixMap(TRadixMap&& other) : m_root(NULL), m_first(NULL), m_last(NULL), m_size(0) { swap(other); }
+    TRadixMap& operator=(TRadixMap&& other) { swap(other); return *this; }
+    void swap(TRadixMap& other);
+
+    // As for TMap: insert overwrites the value of a present key, try_emplace
+    // builds the value from args only if key is absent. Inserting and erasing
+    // never move a pair, so only iterators to an erased pair are invalidated.
+    //
+    std::pair<iterator, bool> insert(const K& key, const V& value);
+    template <typename... Args> std::pair<iterator, bool> try_emplace(const K& key, Args&&... args);
+    V& operator[](const K& key) { return *try_emplace(key).first; }
+
+    void erase(const K& key);
+    void erase(iterator itr) { if (itr != end()) erase(itr->first); }
+    void clear(void);
+
+    iterator find(const K& key) { return iterator(findLeaf(key)); }
+    iterator lower_bound(const K& key) { return iterator(lowerBound(key)); }
+    iterator upper_bound(const K& key) { return iterator(upperBound(key)); }
+    iterator begin(void) { return iterator(m_first); }
+    iterator end(void) { return iterator(NULL); }
+    iterator last(void) { return iterator(m_last); }
+
+    const_iterator find(const K& key) const { return const_iterator(findLeaf(key)); }
+    const_iterator lower_bound(const K& key) const { return const_iterator(lowerBound(key)); }
+    const_iterator upper_bound(const K& key) const { return const_iterator(upperBound(key)); }
+    const_iterator begin(void) const { return const_iterator(m_first); }
+    const_iterator end(void) const { return const_iterator(NULL); }
+    const_iterator last(void) const { return const_iterator(m_last); }
+
+    // The pairs whose keys start with the bytes of prefix, found in
+    // O(size of prefix) and visited in key order.
+    //
+    std::pair<iterator, iterator> prefix_range(const K& prefix);
+    std::pair<const_iterator, const_iterator> prefix_range(const K& prefix) const;
+    template <typename Func> void for_each_prefix(const K& prefix, Func func);
+    template <typename Func> void for_each_prefix(const K& prefix, Func func) const;
+
+    size_t size(void) const { return m_size; }
+
+private:
+
+    TRadixMap(const TRadixMap&);
+    TRadixMap& operator=(const TRadixMap&);
+
+    static size_t keySize(const K& key) { return KeyBytes::size(key); }
+    static uint8_t keyAt(const K& key, size_t i) { return KeyBytes::at(key, i); }
+
+    Leaf* findLeaf(const K& key) const;
+    Leaf* lowerBound(const K& key) const;
+    Leaf* upperBound(const K& key) const;
+
+    // The first and last leaves with keys starting with prefix, or NULLs.
+    //
+    std::pair<Leaf*, Leaf*> prefixLeaves(const K& prefix) const;
+
+    // Find the leaf for key or insert one built from key and args.
+    //
+    template <typename... Args> std::pair<Leaf*, bool> emplace(const K& key, Args&&... args);
+
+    static Node** findChild(Inner* inner, uint8_t byte);
+    static Node* childAbove(Inner* inner, int byte);
+    static Node* childBelow(Inner* inner, int byte);
+
+    // Add or remove the child for byte in the inner node at *ref, growing or
+    // shrinking it into a node of another size when needed.
+    //
+    static void addChild(Node** ref, uint8_t byte, Node* child);
+    static void removeChild(Node** ref, uint8_t byte);
+
+    // Replace the inner node at *ref, whose prefix starts depth bytes in, by
+    // its only entry once it has no other.
+    //
+    static void collapse(Node** ref, size_t depth);
+
+    static Leaf* minLeaf(Node* node);
+    static Leaf* maxLeaf(Node* node);
+
+    // The index of the first byte of the prefix of inner that differs from
+    // key at depth, or the prefix length if key matches all of it.
+    //
+    static size_t prefixMismatch(Inner* inner, const K& key, size_t depth);
+    static void setPrefix(Inner* inner, const K& key, size_t depth, size_t length);
+    static void copyHeader(Inner* to, const Inner* from);
+    static void deleteInner(Inner* inner);
+    static void destroy(Node* node);
+
+    void linkBefore(Leaf* leaf, Leaf* next);
+    void linkAfter(Leaf* leaf, Leaf* prev);
+    void unlink(Leaf* leaf);
+
+#ifdef TRADIXMAP_SSE2
+    static size_t bitCount(unsigned mask);
+#endif
+
+    Node* m_root;
+    Leaf* m_first;
+    Leaf* m_last;
+    size_t m_size;
+};
+
+// TRadixMap
+//
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::swap(TRadixMap& other)
+{
+    std::swap(m_root, other.m_root);
+    std::swap(m_first, other.m_first);
+    std::swap(m_last, other.m_last);
+    std::swap(m_size, other.m_size);
+}
+
+template <typename K, typename V, typename KeyBytes>
+std::pair<typename TRadixMap<K, V, KeyBytes>::iterator, bool>
+TRadixMap<K, V, KeyBytes>::insert(const K& key, const V& value)
+{
+    std::pair<Leaf*, bool> result = emplace(key, value);
+
+    if (!result.second)
+        result.first->m_pair.second = value;
+
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename KeyBytes>
+template <typename... Args>
+std::pair<typename TRadixMap<K, V, KeyBytes>::iterator, bool>
+TRadixMap<K, V, KeyBytes>::try_emplace(const K& key, Args&&... args)
+{
+    std::pair<Leaf*, bool> result = emplace(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::erase(const K& key)
+{
+    size_t size = keySize(key);
+    size_t depth = 0;
+    Node** ref = &m_root;
+    Node** parentRef = NULL;
+    size_t parentDepth = 0;
+    int branch = -1;
+    Node* node = m_root;
+
+    while (node != NULL && node->m_type != Node::LEAF)
+    {
+        Inner* inner = static_cast<Inner*>(node);
+        parentRef = ref;
+        parentDepth = depth;
+
+        // as in findLeaf, the leaf check covers the unstored prefix bytes
+        if (depth + inner->m_prefixLen > size)
+            return;
+
+        for (size_t i = 0; i < inner->m_prefixLen && i < Inner::MAX_PREFIX; i++)
+        {
+            if (inner->m_prefix[i] != keyAt(key, depth + i))
+                return;
+        }
+
+        depth += inner->m_prefixLen;
+
+        if (depth == size)
+        {
+            node = inner->m_leaf;
+            branch = -1;
+            break;
+        }
+
+        branch = keyAt(key, depth);
+        ref = findChild(inner, static_cast<uint8_t>(branch));
+
+        if (ref == NULL)
+            return;
+
+        node = *ref;
+        depth++;
+    }
+
+    if (node == NULL || !(static_cast<Leaf*>(node)->m_pair.first == key))
+        return;
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    unlink(leaf);
+    delete leaf;
+    m_size--;
+
+    if (parentRef == NULL)
+    {
+        m_root = NULL;
+        return;
+    }
+
+    if (branch < 0)
+        static_cast<Inner*>(*parentRef)->m_leaf = NULL;
+    else
+        removeChild(parentRef, static_cast<uint8_t>(branch));
+
+    collapse(parentRef, parentDepth);
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::clear(void)
+{
+    if (m_root != NULL)
+        destroy(m_root);
+
+    m_root = NULL;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+}
+
+template <typename K, typename V, typename KeyBytes>
+std::pair<typename TRadixMap<K, V, KeyBytes>::iterator, typename TRadixMap<K, V, KeyBytes>::iterator>
+TRadixMap<K, V, KeyBytes>::prefix_range(const K& prefix)
+{
+    std::pair<Leaf*, Leaf*> leaves = prefixLeaves(prefix);
+
+    if (leaves.first == NULL)
+        return std::make_pair(end(), end());
+
+    return std::make_pair(iterator(leaves.first), iterator(leaves.second->m_next));
+}
+
+template <typename K, typename V, typename KeyBytes>
+std::pair<typename TRadixMap<K, V, KeyBytes>::const_iterator, typename TRadixMap<K, V, KeyBytes>::const_iterator>
+TRadixMap<K, V, KeyBytes>::prefix_range(const K& prefix) const
+{
+    std::pair<Leaf*, Leaf*> leaves = prefixLeaves(prefix);
+
+    if (leaves.first == NULL)
+        return std::make_pair(end(), end());
+
+    return std::make_pair(const_iterator(leaves.first), const_iterator(leaves.second->m_next));
+}
+
+template <typename K, typename V, typename KeyBytes>
+template <typename Func>
+void
+TRadixMap<K, V, KeyBytes>::for_each_prefix(const K& prefix, Func func)
+{
+    std::pair<Leaf*, Leaf*> leaves = prefixLeaves(prefix);
+
+    for (Leaf* leaf = leaves.first; leaf != NULL; leaf = (leaf == leaves.second) ? NULL : leaf->m_next)
+        func(leaf->m_pair);
+}
+
+template <typename K, typename V, typename KeyBytes>
+template <typename Func>
+void
+TRadixMap<K, V, KeyBytes>::for_each_prefix(const K& prefix, Func func) const
+{
+    std::pair<Leaf*, Leaf*> leaves = prefixLeaves(prefix);
+
+    for (Leaf* leaf = leaves.first; leaf != NULL; leaf = (leaf == leaves.second) ? NULL : leaf->m_next)
+    {
+        const TRadixMapPair<K, V>& pair = leaf->m_pair;
+        func(pair);
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Leaf*
+TRadixMap<K, V, KeyBytes>::findLeaf(const K& key) const
+{
+    size_t size = keySize(key);
+    size_t depth = 0;
+    Node* node = m_root;
+
+    while (node != NULL && node->m_type != Node::LEAF)
+    {
+        Inner* inner = static_cast<Inner*>(node);
+
+        // bytes past MAX_PREFIX are skipped here and checked at the leaf
+        if (depth + inner->m_prefixLen > size)
+            return NULL;
+
+        for (size_t i = 0; i < inner->m_prefixLen && i < Inner::MAX_PREFIX; i++)
+        {
+            if (inner->m_prefix[i] != keyAt(key, depth + i))
+                return NULL;
+        }
+
+        depth += inner->m_prefixLen;
+
+        if (depth == size)
+        {
+            node = inner->m_leaf;
+            break;
+        }
+
+        Node** child = findChild(inner, keyAt(key, depth));
+        node = (child != NULL) ? *child : NULL;
+        depth++;
+    }
+
+    if (node == NULL || !(static_cast<Leaf*>(node)->m_pair.first == key))
+        return NULL;
+
+    return static_cast<Leaf*>(node);
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Leaf*
+TRadixMap<K, V, KeyBytes>::lowerBound(const K& key) const
+{
+    size_t size = keySize(key);
+    size_t depth = 0;
+    Node* node = m_root;
+
+    while (node != NULL)
+    {
+        if (node->m_type == Node::LEAF)
+        {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            return (leaf->m_pair.first < key) ? leaf->m_next : leaf;
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        Leaf* first = NULL;
+
+        // every key below inner is greater than key if key is shorter or
+        // smaller at the first differing byte of the prefix, and less if it
+        // is larger there
+        for (size_t i = 0; i < inner->m_prefixLen; i++)
+        {
+            if (depth + i == size)
+                return minLeaf(inner);
+
+            if (i == Inner::MAX_PREFIX)
+                first = minLeaf(inner);
+
+            uint8_t byte = (i < Inner::MAX_PREFIX) ? inner->m_prefix[i] : keyAt(first->m_pair.first, depth + i);
+            uint8_t keyByte = keyAt(key, depth + i);
+
+            if (keyByte < byte)
+                return minLeaf(inner);
+
+            if (byte < keyByte)
+                return maxLeaf(inner)->m_next;
+        }
+
+        depth += inner->m_prefixLen;
+
+        if (depth == size)
+            return minLeaf(inner);
+
+        uint8_t byte = keyAt(key, depth);
+        Node** child = findChild(inner, byte);
+
+        if (child == NULL)
+        {
+            Node* next = childAbove(inner, byte);
+            return (next != NULL) ? minLeaf(next) : maxLeaf(inner)->m_next;
+        }
+
+        node = *child;
+        depth++;
+    }
+
+    return NULL;
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Leaf*
+TRadixMap<K, V, KeyBytes>::upperBound(const K& key) const
+{
+    Leaf* leaf = lowerBound(key);
+    return (leaf != NULL && leaf->m_pair.first == key) ? leaf->m_next : leaf;
+}
+
+template <typename K, typename V, typename KeyBytes>
+std::pair<typename TRadixMap<K, V, KeyBytes>::Leaf*, typename TRadixMap<K, V, KeyBytes>::Leaf*>
+TRadixMap<K, V, KeyBytes>::prefixLeaves(const K& prefix) const
+{
+    std::pair<Leaf*, Leaf*> none(static_cast<Leaf*>(NULL), static_cast<Leaf*>(NULL));
+    size_t size = keySize(prefix);
+    size_t depth = 0;
+    Node* node = m_root;
+
+    while (node != NULL)
+    {
+        if (depth == size)
+            return std::make_pair(minLeaf(node), maxLeaf(node));
+
+        if (node->m_type == Node::LEAF)
+        {
+            // the bytes before depth matched on the way down
+            const K& key = static_cast<Leaf*>(node)->m_pair.first;
+
+            if (keySize(key) < size)
+                return none;
+
+            for (size_t i = depth; i < size; i++)
+            {
+                if (keyAt(key, i) != keyAt(prefix, i))
+                    return none;
+            }
+
+            return std::make_pair(static_cast<Leaf*>(node), static_cast<Leaf*>(node));
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        size_t length = inner->m_prefixLen;
+
+        if (depth + length > size)
+            length = size - depth;
+
+        if (prefixMismatch(inner, prefix, depth) < length)
+            return none;
+
+        // prefix ends within or right after the prefix of inner
+        if (depth + inner->m_prefixLen >= size)
+            return std::make_pair(minLeaf(inner), maxLeaf(inner));
+
+        depth += inner->m_prefixLen;
+
+        Node** child = findChild(inner, keyAt(prefix, depth));
+
+        if (child == NULL)
+            return none;
+
+        node = *child;
+        depth++;
+    }
+
+    return none;
+}
+
+template <typename K, typename V, typename KeyBytes>
+template <typename... Args>
+std::pair<typename TRadixMap<K, V, KeyBytes>::Leaf*, bool>
+TRadixMap<K, V, KeyBytes>::emplace(const K& key, Args&&... args)
+{
+    size_t size = keySize(key);
+
+    if (m_root == NULL)
+    {
+        Leaf* leaf = new Leaf(key, std::forward<Args>(args)...);
+        m_root = leaf->asNode();
+        m_first = leaf;
+        m_last = leaf;
+        m_size++;
+        return std::make_pair(leaf, true);
+    }
+
+    Node** ref = &m_root;
+    size_t depth = 0;
+
+    while (true)
+    {
+        Node* node = *ref;
+
+        if (node->m_type == Node::LEAF)
+        {
+            // replace the leaf by a node for the bytes both keys share and
+            // the first one where they differ
+            Leaf* other = static_cast<Leaf*>(node);
+            const K& otherKey = other->m_pair.first;
+            size_t otherSize = keySize(otherKey);
+            size_t common = depth;
+
+            while (common < size && common < otherSize && keyAt(key, common) == keyAt(otherKey, common))
+                common++;
+
+            if (common == size && common == otherSize)
+                return std::make_pair(other, false);
+
+            Leaf* leaf = new Leaf(key, std::forward<Args>(args)...);
+            Node4* inner = new Node4();
+            setPrefix(inner, key, depth, common - depth);
+            *ref = inner->asNode();
+
+            if (common == size)
+                inner->m_leaf = leaf;
+            else
+                addChild(ref, keyAt(key, common), leaf->asNode());
+
+            if (common == otherSize)
+                inner->m_leaf = other;
+            else
+                addChild(ref, keyAt(otherKey, common), other->asNode());
+
+            if (common == size || (common < otherSize && keyAt(key, common) < keyAt(otherKey, common)))
+                linkBefore(leaf, other);
+            else
+                linkAfter(leaf, other);
+
+            m_size++;
+            return std::make_pair(leaf, true);
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+
+        if (inner->m_prefixLen > 0)
+        {
+            size_t mismatch = prefixMismatch(inner, key, depth);
+
+            if (mismatch < inner->m_prefixLen)
+            {
+                // split the prefix: a new node takes the matching part and
+                // branches to inner, which keeps the part after the
+                // differing byte, and to the new leaf
+                Leaf* first = minLeaf(inner);
+                uint8_t innerByte = keyAt(first->m_pair.first, depth + mismatch);
+                Node4* split = new Node4();
+                setPrefix(split, key, depth, mismatch);
+                setPrefix(inner, first->m_pair.first, depth + mismatch + 1, inner->m_prefixLen - mismatch - 1);
+                *ref = split->asNode();
+                addChild(ref, innerByte, inner->asNode());
+
+                Leaf* leaf = new Leaf(key, std::forward<Args>(args)...);
+
+                if (depth + mismatch == size)
+                {
+                    split->m_leaf = leaf;
+                    linkBefore(leaf, first);
+                }
+                else
+                {
+                    uint8_t byte = keyAt(key, depth + mismatch);
+                    addChild(ref, byte, leaf->asNode());
+
+                    if (byte < innerByte)
+                        linkBefore(leaf, first);
+                    else
+                        linkAfter(leaf, maxLeaf(inner->asNode()));
+                }
+
+                m_size++;
+                return std::make_pair(leaf, true);
+            }
+
+            depth += inner->m_prefixLen;
+        }
+
+        if (depth == size)
+        {
+            if (inner->m_leaf != NULL)
+                return std::make_pair(inner->m_leaf, false);
+
+            // the shortest key below inner comes first
+            Leaf* leaf = new Leaf(key, std::forward<Args>(args)...);
+            linkBefore(leaf, minLeaf(inner->asNode()));
+            inner->m_leaf = leaf;
+            m_size++;
+            return std::make_pair(leaf, true);
+        }
+
+        uint8_t byte = keyAt(key, depth);
+        Node** child = findChild(inner, byte);
+
+        if (child != NULL)
+        {
+            ref = child;
+            depth++;
+            continue;
+        }
+
+        // an inner node has at least two entries, so the new leaf has a
+        // neighbour among them
+        Leaf* leaf = new Leaf(key, std::forward<Args>(args)...);
+        Node* prev = childBelow(inner, byte);
+
+        if (prev != NULL)
+            linkAfter(leaf, maxLeaf(prev));
+        else if (inner->m_leaf != NULL)
+            linkAfter(leaf, inner->m_leaf);
+        else
+            linkBefore(leaf, minLeaf(childAbove(inner, byte)));
+
+        addChild(ref, byte, leaf->asNode());
+        m_size++;
+        return std::make_pair(leaf, true);
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Node**
+TRadixMap<K, V, KeyBytes>::findChild(Inner* inner, uint8_t byte)
+{
+    switch (inner->m_type)
+    {
+    case Node::NODE4:
+        {
+            Node4* node = static_cast<Node4*>(inner);
+
+            for (size_t i = 0; i < node->m_count; i++)
+            {
+                if (node->m_keys[i] == byte)
+                    return &node->m_children[i];
+            }
+
+            return NULL;
+        }
+    case Node::NODE16:
+        {
+            Node16* node = static_cast<Node16*>(inner);
+
+#ifdef TRADIXMAP_SSE2
+            __m128i keys = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node->m_keys));
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(keys, _mm_set1_epi8(static_cast<char>(byte)))) & ((1u << node->m_count) - 1);
+
+            // the index of the lowest set bit
+            return (mask != 0) ? &node->m_children[bitCount((mask & (0u - mask)) - 1)] : NULL;
+#else
+            for (size_t i = 0; i < node->m_count; i++)
+            {
+                if (node->m_keys[i] == byte)
+                    return &node->m_children[i];
+            }
+
+            return NULL;
+#endif
+        }
+    case Node::NODE48:
+        {
+            Node48* node = static_cast<Node48*>(inner);
+            return (node->m_index[byte] != 0) ? &node->m_children[node->m_index[byte] - 1] : NULL;
+        }
+    default:
+        {
+            Node256* node = static_cast<Node256*>(inner);
+            return (node->m_children[byte] != NULL) ? &node->m_children[byte] : NULL;
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Node*
+TRadixMap<K, V, KeyBytes>::childAbove(Inner* inner, int byte)
+{
+    switch (inner->m_type)
+    {
+    case Node::NODE4:
+    case Node::NODE16:
+        {
+            const uint8_t* keys = (inner->m_type == Node::NODE4) ? static_cast<Node4*>(inner)->m_keys : static_cast<Node16*>(inner)->m_keys;
+            Node** children = (inner->m_type == Node::NODE4) ? static_cast<Node4*>(inner)->m_children : static_cast<Node16*>(inner)->m_children;
+
+            for (size_t i = 0; i < inner->m_count; i++)
+            {
+                if (keys[i] > byte)
+                    return children[i];
+            }
+
+            return NULL;
+        }
+    case Node::NODE48:
+        {
+            Node48* node = static_cast<Node48*>(inner);
+
+            for (int i = byte + 1; i < 256; i++)
+            {
+                if (node->m_index[i] != 0)
+                    return node->m_children[node->m_index[i] - 1];
+            }
+
+            return NULL;
+        }
+    default:
+        {
+            Node256* node = static_cast<Node256*>(inner);
+
+            for (int i = byte + 1; i < 256; i++)
+            {
+                if (node->m_children[i] != NULL)
+                    return node->m_children[i];
+            }
+
+            return NULL;
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Node*
+TRadixMap<K, V, KeyBytes>::childBelow(Inner* inner, int byte)
+{
+    switch (inner->m_type)
+    {
+    case Node::NODE4:
+    case Node::NODE16:
+        {
+            const uint8_t* keys = (inner->m_type == Node::NODE4) ? static_cast<Node4*>(inner)->m_keys : static_cast<Node16*>(inner)->m_keys;
+            Node** children = (inner->m_type == Node::NODE4) ? static_cast<Node4*>(inner)->m_children : static_cast<Node16*>(inner)->m_children;
+
+            for (size_t i = inner->m_count; i > 0; i--)
+            {
+                if (keys[i - 1] < byte)
+                    return children[i - 1];
+            }
+
+            return NULL;
+        }
+    case Node::NODE48:
+        {
+            Node48* node = static_cast<Node48*>(inner);
+
+            for (int i = byte - 1; i >= 0; i--)
+            {
+                if (node->m_index[i] != 0)
+                    return node->m_children[node->m_index[i] - 1];
+            }
+
+            return NULL;
+        }
+    default:
+        {
+            Node256* node = static_cast<Node256*>(inner);
+
+            for (int i = byte - 1; i >= 0; i--)
+            {
+                if (node->m_children[i] != NULL)
+                    return node->m_children[i];
+            }
+
+            return NULL;
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::addChild(Node** ref, uint8_t byte, Node* child)
+{
+    Inner* inner = static_cast<Inner*>(*ref);
+
+    switch (inner->m_type)
+    {
+    case Node::NODE4:
+        {
+            Node4* node = static_cast<Node4*>(inner);
+
+            if (node->m_count < 4)
+            {
+                size_t pos = node->m_count;
+
+                for (; pos > 0 && node->m_keys[pos - 1] > byte; pos--)
+                {
+                    node->m_keys[pos] = node->m_keys[pos - 1];
+                    node->m_children[pos] = node->m_children[pos - 1];
+                }
+
+                node->m_keys[pos] = byte;
+                node->m_children[pos] = child;
+                node->m_count++;
+                return;
+            }
+
+            Node16* grown = new Node16();
+            copyHeader(grown, node);
+
+            for (size_t i = 0; i < 4; i++)
+            {
+                grown->m_keys[i] = node->m_keys[i];
+                grown->m_children[i] = node->m_children[i];
+            }
+
+            delete node;
+            *ref = grown->asNode();
+            break;
+        }
+    case Node::NODE16:
+        {
+            Node16* node = static_cast<Node16*>(inner);
+
+            if (node->m_count < 16)
+            {
+                size_t pos = node->m_count;
+
+                for (; pos > 0 && node->m_keys[pos - 1] > byte; pos--)
+                {
+                    node->m_keys[pos] = node->m_keys[pos - 1];
+                    node->m_children[pos] = node->m_children[pos - 1];
+                }
+
+                node->m_keys[pos] = byte;
+                node->m_children[pos] = child;
+                node->m_count++;
+                return;
+            }
+
+            Node48* grown = new Node48();
+            copyHeader(grown, node);
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                grown->m_index[node->m_keys[i]] = static_cast<uint8_t>(i + 1);
+                grown->m_children[i] = node->m_children[i];
+            }
+
+            delete node;
+            *ref = grown->asNode();
+            break;
+        }
+    case Node::NODE48:
+        {
+            Node48* node = static_cast<Node48*>(inner);
+
+            if (node->m_count < 48)
+            {
+                // removed children leave holes, so look for a free slot
+                size_t slot = 0;
+
+                while (node->m_children[slot] != NULL)
+                    slot++;
+
+                node->m_index[byte] = static_cast<uint8_t>(slot + 1);
+                node->m_children[slot] = child;
+                node->m_count++;
+                return;
+            }
+
+            Node256* grown = new Node256();
+            copyHeader(grown, node);
+
+            for (size_t i = 0; i < 256; i++)
+            {
+                if (node->m_index[i] != 0)
+                    grown->m_children[i] = node->m_children[node->m_index[i] - 1];
+            }
+
+            delete node;
+            *ref = grown->asNode();
+            break;
+        }
+    default:
+        {
+            Node256* node = static_cast<Node256*>(inner);
+            node->m_children[byte] = child;
+            node->m_count++;
+            return;
+        }
+    }
+
+    addChild(ref, byte, child);
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::removeChild(Node** ref, uint8_t byte)
+{
+    Inner* inner = static_cast<Inner*>(*ref);
+
+    switch (inner->m_type)
+    {
+    case Node::NODE4:
+    case Node::NODE16:
+        {
+            uint8_t* keys = (inner->m_type == Node::NODE4) ? static_cast<Node4*>(inner)->m_keys : static_cast<Node16*>(inner)->m_keys;
+            Node** children = (inner->m_type == Node::NODE4) ? static_cast<Node4*>(inner)->m_children : static_cast<Node16*>(inner)->m_children;
+            size_t pos = 0;
+
+            while (keys[pos] != byte)
+                pos++;
+
+            for (; pos + 1 < inner->m_count; pos++)
+            {
+                keys[pos] = keys[pos + 1];
+                children[pos] = children[pos + 1];
+            }
+
+            inner->m_count--;
+
+            if (inner->m_type == Node::NODE4 || inner->m_count > 3)
+                return;
+
+            Node16* node = static_cast<Node16*>(inner);
+            Node4* shrunk = new Node4();
+            copyHeader(shrunk, node);
+
+            for (size_t i = 0; i < node->m_count; i++)
+            {
+                shrunk->m_keys[i] = node->m_keys[i];
+                shrunk->m_children[i] = node->m_children[i];
+            }
+
+            delete node;
+            *ref = shrunk->asNode();
+            return;
+        }
+    case Node::NODE48:
+        {
+            Node48* node = static_cast<Node48*>(inner);
+            node->m_children[node->m_index[byte] - 1] = NULL;
+            node->m_index[byte] = 0;
+            node->m_count--;
+
+            if (node->m_count > 12)
+                return;
+
+            Node16* shrunk = new Node16();
+            copyHeader(shrunk, node);
+            shrunk->m_count = 0;
+
+            for (size_t i = 0; i < 256; i++)
+            {
+                if (node->m_index[i] != 0)
+                {
+                    shrunk->m_keys[shrunk->m_count] = static_cast<uint8_t>(i);
+                    shrunk->m_children[shrunk->m_count++] = node->m_children[node->m_index[i] - 1];
+                }
+            }
+
+            delete node;
+            *ref = shrunk->asNode();
+            return;
+        }
+    default:
+        {
+            Node256* node = static_cast<Node256*>(inner);
+            node->m_children[byte] = NULL;
+            node->m_count--;
+
+            if (node->m_count > 37)
+                return;
+
+            Node48* shrunk = new Node48();
+            copyHeader(shrunk, node);
+            shrunk->m_count = 0;
+
+            for (size_t i = 0; i < 256; i++)
+            {
+                if (node->m_children[i] != NULL)
+                {
+                    shrunk->m_children[shrunk->m_count] = node->m_children[i];
+                    shrunk->m_index[i] = static_cast<uint8_t>(++shrunk->m_count);
+                }
+            }
+
+            delete node;
+            *ref = shrunk->asNode();
+            return;
+        }
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::collapse(Node** ref, size_t depth)
+{
+    Inner* inner = static_cast<Inner*>(*ref);
+
+    if (inner->m_count + (inner->m_leaf != NULL ? 1 : 0) != 1)
+        return;
+
+    Node* only = (inner->m_leaf != NULL) ? inner->m_leaf->asNode() : childAbove(inner, -1);
+
+    // an inner child absorbs the prefix of inner and the byte between them
+    if (only->m_type != Node::LEAF)
+    {
+        Inner* child = static_cast<Inner*>(only);
+        setPrefix(child, minLeaf(only)->m_pair.first, depth, inner->m_prefixLen + 1 + child->m_prefixLen);
+    }
+
+    *ref = only;
+    deleteInner(inner);
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Leaf*
+TRadixMap<K, V, KeyBytes>::minLeaf(Node* node)
+{
+    while (node->m_type != Node::LEAF)
+    {
+        Inner* inner = static_cast<Inner*>(node);
+
+        if (inner->m_leaf != NULL)
+            return inner->m_leaf;
+
+        node = childAbove(inner, -1);
+    }
+
+    return static_cast<Leaf*>(node);
+}
+
+template <typename K, typename V, typename KeyBytes>
+typename TRadixMap<K, V, KeyBytes>::Leaf*
+TRadixMap<K, V, KeyBytes>::maxLeaf(Node* node)
+{
+    while (node->m_type != Node::LEAF)
+    {
+        Inner* inner = static_cast<Inner*>(node);
+        Node* last = childBelow(inner, 256);
+
+        if (last == NULL)
+            return inner->m_leaf;
+
+        node = last;
+    }
+
+    return static_cast<Leaf*>(node);
+}
+
+template <typename K, typename V, typename KeyBytes>
+size_t
+TRadixMap<K, V, KeyBytes>::prefixMismatch(Inner* inner, const K& key, size_t depth)
+{
+    size_t size = keySize(key);
+    Leaf* first = NULL;
+
+    for (size_t i = 0; i < inner->m_prefixLen; i++)
+    {
+        if (depth + i == size)
+            return i;
+
+        if (i == Inner::MAX_PREFIX)
+            first = minLeaf(inner->asNode());
+
+        uint8_t byte = (i < Inner::MAX_PREFIX) ? inner->m_prefix[i] : keyAt(first->m_pair.first, depth + i);
+
+        if (byte != keyAt(key, depth + i))
+            return i;
+    }
+
+    return inner->m_prefixLen;
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::setPrefix(Inner* inner, const K& key, size_t depth, size_t length)
+{
+    inner->m_prefixLen = static_cast<uint32_t>(length);
+
+    for (size_t i = 0; i < length && i < Inner::MAX_PREFIX; i++)
+        inner->m_prefix[i] = keyAt(key, depth + i);
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::copyHeader(Inner* to, const Inner* from)
+{
+    to->m_count = from->m_count;
+    to->m_prefixLen = from->m_prefixLen;
+    to->m_leaf = from->m_leaf;
+
+    for (size_t i = 0; i < Inner::MAX_PREFIX; i++)
+        to->m_prefix[i] = from->m_prefix[i];
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::deleteInner(Inner* inner)
+{
+    switch (inner->m_type)
+    {
+    case Node::NODE4: delete static_cast<Node4*>(inner); break;
+    case Node::NODE16: delete static_cast<Node16*>(inner); break;
+    case Node::NODE48: delete static_cast<Node48*>(inner); break;
+    default: delete static_cast<Node256*>(inner); break;
+    }
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::destroy(Node* node)
+{
+    if (node->m_type == Node::LEAF)
+    {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+
+    if (inner->m_leaf != NULL)
+        delete inner->m_leaf;
+
+    switch (inner->m_type)
+    {
+    case Node::NODE4:
+        for (size_t i = 0; i < inner->m_count; i++)
+            destroy(static_cast<Node4*>(inner)->m_children[i]);
+        break;
+    case Node::NODE16:
+        for (size_t i = 0; i < inner->m_count; i++)
+            destroy(static_cast<Node16*>(inner)->m_children[i]);
+        break;
+    case Node::NODE48:
+        for (size_t i = 0; i < 48; i++)
+        {
+            if (static_cast<Node48*>(inner)->m_children[i] != NULL)
+                destroy(static_cast<Node48*>(inner)->m_children[i]);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < 256; i++)
+        {
+            if (static_cast<Node256*>(inner)->m_children[i] != NULL)
+                destroy(static_cast<Node256*>(inner)->m_children[i]);
+        }
+        break;
+    }
+
+    deleteInner(inner);
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::linkBefore(Leaf* leaf, Leaf* next)
+{
+    leaf->m_next = next;
+    leaf->m_prev = next->m_prev;
+
+    if (next->m_prev != NULL)
+        next->m_prev->m_next = leaf;
+    else
+        m_first = leaf;
+
+    next->m_prev = leaf;
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::linkAfter(Leaf* leaf, Leaf* prev)
+{
+    leaf->m_prev = prev;
+    leaf->m_next = prev->m_next;
+
+    if (prev->m_next != NULL)
+        prev->m_next->m_prev = leaf;
+    else
+        m_last = leaf;
+
+    prev->m_next = leaf;
+}
+
+template <typename K, typename V, typename KeyBytes>
+void
+TRadixMap<K, V, KeyBytes>::unlink(Leaf* leaf)
+{
+    if (leaf->m_prev != NULL)
+        leaf->m_prev->m_next = leaf->m_next;
+    else
+        m_first = leaf->m_next;
+
+    if (leaf->m_next != NULL)
+        leaf->m_next->m_prev = leaf->m_prev;
+    else
+        m_last = leaf->m_prev;
+}
+
+#ifdef TRADIXMAP_SSE2
+
+template <typename K, typename V, typename KeyBytes>
+size_t
+TRadixMap<K, V, KeyBytes>::bitCount(unsigned mask)
+{
+    static const unsigned char bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    size_t count = 0;
+
+    for (; mask != 0; mask >>= 4)
+        count += bits[mask & 15];
+
+    return count;
+}
+
+#endif
@@ -2,42 +2,159 @@
 Copyright 2016 Tom Kim
 Implementation of a red-black tree as described in Introduction to Algorithms
 by Corman et al.
+
+Keys are ordered by the comparator C, std::less<K> by default, which the tree
+constructs or copies from its constructor argument.
 */
 #pragma once
 
 #include <stdlib.h>
 #include <cassert>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUC__)
+#define TRBTREE_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define TRBTREE_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define TRBTREE_PREFETCH(address)
+#endif
+
+// Augmentation policies. A policy is a base class of every node, so it holds
+// the per-node data, and update recomputes that data from the node's key and
+// its children's data after any change below the node. The sentinel holds a
+// default-constructed policy.
+//
+class TRbTreeNoAugment
+{
+public:
+
+    enum { ENABLED = 0 };
+
+    template <typename K>
+    static void update(TRbTreeNoAugment&, const K&, const TRbTreeNoAugment&, const TRbTreeNoAugment&) { }
+};
+
+// Keeps subtree sizes, enabling rank, select and count_range in O(log n).
+//
+class TRbTreeOrderStatistics
+{
+public:
+
+    enum { ENABLED = 1 };
+
+    TRbTreeOrderStatistics(void) : m_subtreeSize(0) { }
+
+    template <typename K>
+    static void update(TRbTreeOrderStatistics& node, const K& key, const TRbTreeOrderStatistics& left, const TRbTreeOrderStatistics& right)
+    {
+        node.m_subtreeSize = left.m_subtreeSize + right.m_subtreeSize + 1;
+    }
+
+    size_t m_subtreeSize;
+};
+
+// Defines Type when the comparator C declares is_transparent, as std::less<>
+// does, so that keys may be looked up by any type Q that C can compare with
+// them. Otherwise lookups take K only, and Q would be converted to K on every
+// comparison.
+//
+template <typename T>
+class TRbTreeVoid
+{
+public:
+
+    typedef void Type;
+};
+
+template <typename C, typename Q, typename T = void>
+class TRbTreeTransparent
+{
+};
+
+template <typename C, typename Q>
+class TRbTreeTransparent<C, Q, typename TRbTreeVoid<typename C::is_transparent>::Type>
+{
+public:
+
+    typedef void Type;
+};
 
-template <typename K>
-class TRbTreeNode
+template <typename K, typename KeyOf> class TBTree;
+
+// Whether a TMap or TSet backed by Tree orders its keys K by the comparator
+// C. TBTree orders them by operator<, which only std::less matches.
+//
+template <typename Tree, typename C, typename K>
+class TRbTreeOrdersBy
+{
+public:
+
+    enum { VALUE = 1 };
+};
+
+template <typename T, typename KeyOf, typename C, typename K>
+class TRbTreeOrdersBy<TBTree<T, KeyOf>, C, K>
+{
+public:
+
+    enum { VALUE = std::is_same<C, std::less<K> >::value || std::is_same<C, std::less<> >::value };
+};
+
+template <typename K, typename A = TRbTreeNoAugment, typename C = std::less<K> > class TRbTreeNode;
+template <typename K, typename A = TRbTreeNoAugment, typename C = std::less<K> > class TRbTreeItrBase;
+template <typename K, typename A = TRbTreeNoAugment, typename C = std::less<K> > class TRbTreeItr;
+template <typename K, typename A = TRbTreeNoAugment, typename C = std::less<K> > class TRbTreeConstItr;
+template <typename K, typename A = TRbTreeNoAugment, typename C = std::less<K> > class TRbTree;
+template <typename K, typename A = TRbTreeNoAugment, typename C = std::less<K> > class TRbTreeBuilder;
+template <typename E, typename V> class TIntervalMap;
+
+template <typename K, typename A, typename C>
+class TRbTreeNode : public A
 {
-    template <typename K> friend class TRbTree;
-    template <typename K> friend class TRbTreeItrBase;
-    template <typename K> friend class TRbTreeItr;
-    template <typename K> friend class TRbTreeConstItr;
+    template <typename K, typename A, typename C> friend class TRbTree;
+    template <typename K, typename A, typename C> friend class TRbTreeItrBase;
+    template <typename K, typename A, typename C> friend class TRbTreeItr;
+    template <typename K, typename A, typename C> friend class TRbTreeConstItr;
+    template <typename K, typename A, typename C> friend class TRbTreeBuilder;
+    template <typename E, typename V> friend class TIntervalMap;
 
 private:
 
     enum Color { RED, BLACK };
 
-    TRbTreeNode(void) : m_color(BLACK), m_parent(NIL), m_right(NIL), m_left(NIL) { }
+    TRbTreeNode(void) : m_color(BLACK), m_pooled(false), m_parent(NULL), m_right(NULL), m_left(NULL) { }
+
+    // builds the key in place from args
+    template <typename... Args>
+    TRbTreeNode(Args&&... args) : m_color(BLACK), m_pooled(false), m_parent(NULL), m_right(NULL), m_left(NULL), m_key(std::forward<Args>(args)...) { }
 
-    static TRbTreeNode* NIL;
     Color m_color;
+    bool m_pooled;      // lives in a block owned by the tree, see TRbTree::m_blocks
     TRbTreeNode* m_parent;
     TRbTreeNode* m_right;
     TRbTreeNode* m_left;
     K m_key;
 };
 
-template <typename K>
+template <typename K, typename A, typename C>
 class TRbTreeItrBase
 {
 protected:
 
-    typedef TRbTreeNode<K> Node;
-    typedef TRbTree<K> Tree;
+    typedef TRbTreeNode<K, A, C> Node;
+    typedef TRbTree<K, A, C> Tree;
 
+    TRbTreeItrBase(void) : m_tree(NULL), m_node(NULL) { }
     TRbTreeItrBase(Tree* tree, Node* node) : m_tree(tree), m_node(node) { }
     void increment(void);
     void decrement(void);
@@ -46,83 +163,299 @@ protected:
     Node* m_node;
 };
 
-template <typename K>
-class TRbTreeItr : private TRbTreeItrBase<K>
+template <typename K, typename A, typename C>
+class TRbTreeItr : private TRbTreeItrBase<K, A, C>
 {
-    template <typename K> friend class TRbTree;
-    template <typename K> friend class TRbTreeConstItr;
+    template <typename K, typename A, typename C> friend class TRbTree;
+    template <typename K, typename A, typename C> friend class TRbTreeConstItr;
 
 public:
 
+    TRbTreeItr(void) { }
     TRbTreeItr(Tree* tree, Node* node) : TRbTreeItrBase(tree, node) { }
     TRbTreeItr(const TRbTreeItr& other) : TRbTreeItrBase(other.m_tree, other.m_node) { }
-    TRbTreeItr(const TRbTreeConstItr<K>& other) : TRbTreeItrBase(other.m_tree, other.m_node) { } // made private to avoid conversion outside of friends
+    TRbTreeItr(const TRbTreeConstItr<K, A, C>& other) : TRbTreeItrBase(other.m_tree, other.m_node) { } // made private to avoid conversion outside of friends
 
     bool operator==(const TRbTreeItr& other) const { return m_node == other.m_node; }
     bool operator!=(const TRbTreeItr& other) const { return m_node != other.m_node; }
-    bool operator==(const TRbTreeConstItr<K>& other) const { return m_node == other.m_node; }
-    bool operator!=(const TRbTreeConstItr<K>& other) const { return m_node != other.m_node; }
+    bool operator==(const TRbTreeConstItr<K, A, C>& other) const { return m_node == other.m_node; }
+    bool operator!=(const TRbTreeConstItr<K, A, C>& other) const { return m_node != other.m_node; }
     TRbTreeItr& operator++(void) { increment(); return *this; }
     TRbTreeItr& operator--(void) { decrement(); return *this; }
     K& operator*(void) { return m_node->m_key; }
 
 };
 
-template <typename K>
-class TRbTreeConstItr : private TRbTreeItrBase<K>
+template <typename K, typename A, typename C>
+class TRbTreeConstItr : private TRbTreeItrBase<K, A, C>
 {
-    template <typename K> friend class TRbTree;
-    template <typename K> friend class TRbTreeItr;
+    template <typename K, typename A, typename C> friend class TRbTree;
+    template <typename K, typename A, typename C> friend class TRbTreeItr;
 
 public:
 
+    TRbTreeConstItr(void) { }
     TRbTreeConstItr(const Tree* tree, Node* node) : TRbTreeItrBase(const_cast<Tree*>(tree), node) { }
     TRbTreeConstItr(const TRbTreeConstItr& other) : TRbTreeItrBase(other.m_tree, other.m_node) { }
-    TRbTreeConstItr(const TRbTreeItr<K>& other) : TRbTreeItrBase(other.m_tree, other.m_node) { }
+    TRbTreeConstItr(const TRbTreeItr<K, A, C>& other) : TRbTreeItrBase(other.m_tree, other.m_node) { }
 
     bool operator==(const TRbTreeConstItr& other) const { return m_node == other.m_node; }
     bool operator!=(const TRbTreeConstItr& other) const { return m_node != other.m_node; }
-    bool operator==(const TRbTreeItr<K>& other) const { return m_node == other.m_node; }
-    bool operator!=(const TRbTreeItr<K>& other) const { return m_node != other.m_node; }
+    bool operator==(const TRbTreeItr<K, A, C>& other) const { return m_node == other.m_node; }
+    bool operator!=(const TRbTreeItr<K, A, C>& other) const { return m_node != other.m_node; }
     TRbTreeConstItr& operator++(void) { increment(); return *this; }
     TRbTreeConstItr& operator--(void) { decrement(); return *this; }
     const K& operator*(void) const { return m_node->m_key; }
 };
 
-template <typename K>
+template <typename K, typename A, typename C>
 class TRbTree
 {
-    typedef class TRbTreeNode<K> Node;
+    typedef class TRbTreeNode<K, A, C> Node;
+    template <typename K, typename A, typename C> friend class TRbTreeItrBase;
+    template <typename K, typename A, typename C> friend class TRbTreeBuilder;
+    template <typename E, typename V> friend class TIntervalMap;
 
 public:
 
-    typedef TRbTreeItr<K> iterator;
-    typedef TRbTreeConstItr<K> const_iterator;
+    typedef TRbTreeItr<K, A, C> iterator;
+    typedef TRbTreeConstItr<K, A, C> const_iterator;
+    typedef TRbTreeBuilder<K, A, C> builder;
 
     TRbTree(void);
+    explicit TRbTree(const C& compare);
+    ~TRbTree(void);
+
+    // Copying clones the shape of other in one O(n) traversal, with the
+    // nodes in a single block in key order; no comparisons or rebalancing
+    // are needed. Assignment copies first, so on failure this is unchanged.
+    //
+    TRbTree(const TRbTree& other);
+    TRbTree& operator=(const TRbTree& other);
+
+    // Moving and swapping exchange the trees in O(1), sentinels included.
+    // A move leaves the source empty when constructing, and holding this
+    // tree's old contents when assigning. Iterators keep pointing at the
+    // tree they came from, so they must not be used across a swap or move.
+    // Move construction allocates the sentinel the source is left with, so
+    // unlike swap and move assignment it can throw std::bad_alloc.
+    //
+    TRbTree(TRbTree&& other);
+    TRbTree& operator=(TRbTree&& other) { swap(other); return *this; }
+    void swap(TRbTree& other);
+
+    // Insert key, or overwrite the equal key already present. Returns where
+    // key now is and whether it was new; a node is allocated only if it was.
+    //
+    std::pair<iterator, bool> insert(const K& key);
+    std::pair<iterator, bool> insert(K&& key);
+
+    // Same as insert, but O(1) amortized when key belongs right before or
+    // right after hint. Feeding ascending keys with end() as the hint, or
+    // with the previous result, therefore needs no descent.
+    //
+    iterator insert_hint(iterator hint, const K& key);
+    iterator insert_hint(iterator hint, K&& key);
+
+    // Look up key and, only if it is absent, build a new key in its node
+    // from args. The built key must compare equal to key, which may be of
+    // any type C compares with K; TMap looks up by the key of a pair and
+    // builds the pair. Nothing is constructed or assigned if key is present.
+    //
+    template <typename Q, typename... Args> std::pair<iterator, bool> try_emplace(const Q& key, Args&&... args);
+    template <typename Q, typename... Args> std::pair<iterator, bool> try_emplace_hint(iterator hint, const Q& key, Args&&... args);
 
-    void insert(const K& key);
     void erase(const K& key);
     void erase(iterator itr);
-
-    iterator find(const K& key) { return iterator(const_cast<const TRbTree*>(this)->find(key)); }
+    void clear(void);
+
+    // Erase the keys in [first, last). A short range is erased key by key;
+    // a longer one is split off at first and last, dropped whole without
+    // rebalancing and the rest joined back, in O(k + log n) for k keys. An
+    // expiry sweep is erase(begin(), lower_bound(cutoff)).
+    //
+    void erase(iterator first, iterator last);
+
+    // Erase the keys for which pred(key) is true and return how many, with
+    // pred called once per key in order. A long run of consecutive erased
+    // keys is erased as a range, so sweeping a prefix costs O(k + log n) on
+    // top of the walk.
+    //
+    template <typename Pred> size_t erase_if(Pred pred);
+
+    // Replace the contents with keys from [first, last) in O(n). The range
+    // must be sorted by the comparator; for equal keys the last one wins, as
+    // with insert. It is walked twice, once to size the node block, so it
+    // must be a forward range; assign_unsorted takes any input range.
+    //
+    template <typename ForwardItr> void assign_sorted(ForwardItr first, ForwardItr last);
+
+    // Same as assign_sorted but for a range in any order, at the cost of an
+    // O(n log n) sort of a temporary copy.
+    //
+    template <typename InputItr> void assign_unsorted(InputItr first, InputItr last);
+
+    iterator find(const K& key) { return iterator(this, findNode(key)); }
+    iterator lower_bound(const K& key) { return iterator(this, lowerBound(key)); }
+    iterator upper_bound(const K& key) { return iterator(this, upperBound(key)); }
+    std::pair<iterator, iterator> equal_range(const K& key) { return std::make_pair(lower_bound(key), upper_bound(key)); }
     iterator begin(void) { return iterator(this, m_first); }
     iterator end(void) { return iterator(this, NULL); }
     iterator last(void) { return iterator(this, m_last); }
 
-    const_iterator find(const K& key) const;
+    const_iterator find(const K& key) const { return const_iterator(this, findNode(key)); }
+    const_iterator lower_bound(const K& key) const { return const_iterator(this, lowerBound(key)); }
+    const_iterator upper_bound(const K& key) const { return const_iterator(this, upperBound(key)); }
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const { return std::make_pair(lower_bound(key), upper_bound(key)); }
     const_iterator begin(void) const { return const_iterator(this, m_first); }
     const_iterator end(void) const { return const_iterator(this, NULL); }
     const_iterator last(void) const { return const_iterator(this, m_last); }
 
+    // Heterogeneous lookups, available when C is transparent: key may be of
+    // any type C compares with K, and no K is constructed for the search.
+    //
+    template <typename Q> iterator find(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return iterator(this, findNode(key)); }
+    template <typename Q> iterator lower_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return iterator(this, lowerBound(key)); }
+    template <typename Q> iterator upper_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return iterator(this, upperBound(key)); }
+    template <typename Q> std::pair<iterator, iterator> equal_range(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return std::make_pair(lower_bound(key), upper_bound(key)); }
+
+    template <typename Q> const_iterator find(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return const_iterator(this, findNode(key)); }
+    template <typename Q> const_iterator lower_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return const_iterator(this, lowerBound(key)); }
+    template <typename Q> const_iterator upper_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return const_iterator(this, upperBound(key)); }
+    template <typename Q> std::pair<const_iterator, const_iterator> equal_range(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return std::make_pair(lower_bound(key), upper_bound(key)); }
+
+    // Find keys[i] into out[i] for every i < n, end() where it is absent.
+    // Lookups descend in groups, one level per step, prefetching the node
+    // each will visit next, so that the cache misses of a group overlap
+    // instead of following one another. Worthwhile for trees well beyond the
+    // cache; the transparent overloads take keys of any type C compares with K.
+    //
+    void find_batch(const K* keys, size_t n, iterator* out) { findBatch(keys, n, out); }
+    void find_batch(const K* keys, size_t n, const_iterator* out) const { findBatch(keys, n, out); }
+    template <typename Q> void find_batch(const Q* keys, size_t n, iterator* out, typename TRbTreeTransparent<C, Q>::Type* = NULL) { findBatch(keys, n, out); }
+    template <typename Q> void find_batch(const Q* keys, size_t n, const_iterator* out, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { findBatch(keys, n, out); }
+
+    const C& key_comp(void) const { return m_compare; }
+
+    // Call func(key) for every key in [lo, hi) in order, in O(log n + k).
+    //
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func);
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func) const;
+
+    // Order statistics, available when A is TRbTreeOrderStatistics. rank is
+    // the number of keys less than key, select the k-th smallest key counting
+    // from 0 (end() if k >= size) and count_range the number of keys in
+    // [lo, hi), all in O(log n).
+    //
+    size_t rank(const K& key) const;
+    iterator select(size_t k) { return iterator(this, selectNode(k)); }
+    const_iterator select(size_t k) const { return const_iterator(this, selectNode(k)); }
+    size_t count_range(const K& lo, const K& hi) const { return m_compare(lo, hi) ? rank(hi) - rank(lo) : 0; }
+
+    // Join-based set operations. Each takes over the nodes of other, keeps
+    // those the operation selects and leaves other empty; for equal keys the
+    // node of this tree is kept. With m <= n the work is O(m log(n / m + 1)),
+    // plus O(m) to bind the smaller tree to the larger one's sentinel, and
+    // large inputs are recursed on in parallel. If the comparator throws,
+    // the exception reaches the caller once any forked work has finished;
+    // both trees are then left empty and the nodes they held are leaked, as
+    // by then they no longer form a tree.
+    //
+    void set_union(TRbTree& other);
+    void set_intersection(TRbTree& other);
+    void set_difference(TRbTree& other);
+
+    // Keep only the keys for which pred(key) is true, in O(n) work. pred may
+    // be called from several threads at once. If it throws, this tree is
+    // left empty as for a throwing set operation.
+    //
+    template <typename Pred> void filter(Pred pred);
+
+    // join appends right, whose keys must all be greater than this tree's,
+    // and leaves it empty. split moves the keys not less than key into right,
+    // which must be empty, in O(log n + k) for k keys moved; moved nodes from
+    // a bulk load are copied since their block stays with this tree. With a
+    // transparent comparator key may be of any type it accepts.
+    //
+    void join(TRbTree& right);
+    void split(const K& key, TRbTree& right) { splitOff(key, right); }
+    template <typename Q> void split(const Q& key, TRbTree& right, typename TRbTreeTransparent<C, Q>::Type* = NULL) { splitOff(key, right); }
+
+    // Move every node into one new block in key order and release the old
+    // blocks, so that iteration walks memory front to back instead of
+    // wherever churn has left the nodes. O(n); iterators are invalidated.
+    //
+    void compact(void) { compact_step(size_t(-1)); }
+
+    // The same in slices of up to count nodes each, returning true once the
+    // compaction is done and the old memory released. Between slices the
+    // tree may be read, though iterators to moved nodes are invalidated.
+    // Inserts and erases may come in between too, and the next call goes on
+    // filling the same block; keys inserted behind the compaction's position
+    // stay where insert put them. A set operation, join, split, filter or
+    // range erase abandons the compaction, keeping the nodes moved so far
+    // and returning the block's unused slots to insert, and the next call
+    // starts a new one.
+    //
+    bool compact_step(size_t count);
+
     size_t size(void) const { return m_size; }
     size_t maxDepth(void) const;
 
 private:
 
+    struct Block
+    {
+        Block* m_next;
+        Node* m_nodes;
+    };
+
+    // A compaction in progress, if m_block is not NULL: the block being
+    // filled in key order, how many of its slots are taken and the next
+    // node to move, NULL past the last. Free slots outside m_block are set
+    // aside on m_free here rather than on the tree's, so that insert never
+    // puts a node into an old block behind m_next.
+    //
+    struct Compaction
+    {
+        Block* m_block;
+        size_t m_capacity;
+        size_t m_count;
+        Node* m_next;
+        void* m_free;
+    };
+
+    template <typename... Args> Node* createNode(Args&&... args);
+    void destroyNode(Node* node);
+    Node* allocBlock(size_t count);
+    void freeNode(Node* node);
+    Node* relocate(Node* node, Node* slot);
+    bool compacting(Node* node) const;
+    void releaseSlots(void);
+    void stopCompact(void);
+    Node* buildBalanced(Node* nodes, size_t count, Node* parent, size_t depth, size_t redDepth);
+    Node* clone(const Node* node, const Node* otherNil, Node* parent, Node* nodes, size_t& next);
+
+    // the node equal to key (findNode), the first with key >= key
+    // (lowerBound) or key > key (upperBound), NULL if there is none
+    template <typename Q> Node* findNode(const Q& key) const;
+    template <typename Q, typename Itr> void findBatch(const Q* keys, size_t n, Itr* out) const;
+    template <typename Q> Node* lowerBound(const Q& key) const;
+    template <typename Q> Node* upperBound(const Q& key) const;
+    Node* selectNode(size_t k) const;
+
+    void update(Node* x) { A::update(*x, x->m_key, *x->m_left, *x->m_right); }
+    void updatePath(Node* x);
     void leftRotate(Node* x);
     void rightRotate(Node* x);
-    void insert(Node* z);
+
+    // Find the node equal to key, or return NULL and set where a new node
+    // for key belongs: on side left of parent, the sentinel for an empty
+    // tree. locateHint does the same in O(1) when key is next to hint.
+    //
+    template <typename Q> Node* locate(const Q& key, Node*& parent, bool& left);
+    template <typename Q> Node* locateHint(iterator hint, const Q& key, Node*& parent, bool& left);
+    template <typename... Args> Node* attach(Node* parent, bool left, Args&&... args);
     void insertFixup(Node* z);
 
     void transplant(Node* u, Node* v);
@@ -132,30 +465,147 @@ private:
 
     size_t maxDepth(Node* node, size_t depth) const;
 
+    // A detached subtree and its black height, the number of black nodes on
+    // any path from its root down to the sentinel. The root may be red.
+    //
+    struct Piece
+    {
+        Node* m_root;
+        size_t m_blackHeight;
+    };
+
+    struct Split
+    {
+        Piece m_left;
+        Node* m_found;      // the node equal to the key, if any
+        Piece m_right;
+    };
+
+    // Nodes dropped by a set operation, chained through m_parent and
+    // destroyed by settle once every thread is done.
+    //
+    struct Discards
+    {
+        Node* m_head;
+        Node* m_tail;
+        size_t m_count;
+    };
+
+    // Below this black height a subtree has too few nodes to be worth a
+    // thread.
+    //
+    enum { PARALLEL_BLACK_HEIGHT = 10 };
+
+    // erase(first, last) erases ranges shorter than this key by key.
+    //
+    enum { SHORT_RANGE = 32 };
+
+    Piece rootPiece(Node* root) const;
+    Piece emptyPiece(void) const { Piece piece = { m_nil, 0 }; return piece; }
+    Piece childPiece(Node* child, const Piece& parent) const;
+    void absorb(TRbTree& other, Piece& mine, Piece& theirs);
+    Node* rebind(Node* node, Node* oldNil, Node* newNil);
+    Node* adopt(Node* node, TRbTree& from, size_t& count);
+    void settle(Piece result, size_t size, Discards& discards);
+
+    Node* joinRotateLeft(Node* x);
+    Node* joinRotateRight(Node* x);
+    Node* joinRight(Node* left, size_t leftHeight, Node* key, Node* right, size_t rightHeight);
+    Node* joinLeft(Node* left, size_t leftHeight, Node* key, Node* right, size_t rightHeight);
+    Piece join(Piece left, Node* key, Piece right);
+    Piece concat(Piece left, Piece right);
+    Piece splitLast(Piece piece, Node*& last);
+    template <typename Q> void splitOff(const Q& key, TRbTree& right);
+    template <typename Q> void split(Piece piece, const Q& key, Split& parts);
+
+    Piece unite(Piece mine, Piece theirs, Discards& discards, size_t threads);
+    Piece intersect(Piece mine, Piece theirs, Discards& discards, size_t threads);
+    Piece subtract(Piece mine, Piece theirs, Discards& discards, size_t threads);
+    template <typename Pred> Piece filter(Piece piece, Pred& pred, Discards& discards, size_t threads);
+
+    void discard(Node* node, Discards& discards);
+    void forget(void);
+    size_t destroyTree(Node* node);
+    void discardTree(Node* node, Discards& discards);
+    static void mergeDiscards(Discards& into, Discards& from);
+    static size_t threadBudget(void);
+    static bool parallel(const Piece& a, const Piece& b, size_t threads);
+    template <typename Left, typename Right> static void invoke(bool parallel, Left left, Right right);
+
+    // Per-tree sentinel; erase writes its parent and color, so sharing one
+    // between trees would race across threads.
+    //
+    Node* m_nil;
     Node* m_root;
     Node* m_first;
     Node* m_last;
     size_t m_size;
+
+    // Nodes from a bulk load are allocated contiguously in blocks. They are
+    // never deleted one by one; erase puts them on m_free for reuse by insert
+    // and clear releases the blocks.
+    //
+    Block* m_blocks;
+    void* m_free;
+
+    // compact_step's progress, kept across inserts and erases; bulk
+    // changes stop the compaction.
+    //
+    Compaction m_compaction;
+
+    C m_compare;
 };
 
-// TRbTreeNode
+// Builds a perfectly balanced tree from keys pushed in ascending order, with
+// the nodes laid out contiguously in key order. The tree is cleared on
+// construction and holds the keys once finish is called.
+//
+// Example:
+//
+//     TRbTreeBuilder<int> builder(tree, count);
+//     for (size_t i = 0; i < count; i++)
+//         builder.push_back(sortedKeys[i]);
+//     builder.finish();
 //
-template <typename K>
-TRbTreeNode<K>* TRbTreeNode<K>::NIL = new TRbTreeNode();
+template <typename K, typename A, typename C>
+class TRbTreeBuilder
+{
+    typedef TRbTreeNode<K, A, C> Node;
+    typedef TRbTree<K, A, C> Tree;
+
+public:
+
+    TRbTreeBuilder(Tree& tree, size_t capacity);
+    ~TRbTreeBuilder(void) { if (!m_finished) finish(); }
+
+    void push_back(const K& key);
+    void finish(void);
+
+private:
+
+    TRbTreeBuilder(const TRbTreeBuilder&);
+    TRbTreeBuilder& operator=(const TRbTreeBuilder&);
+
+    Tree& m_tree;
+    Node* m_nodes;
+    size_t m_capacity;
+    size_t m_count;
+    bool m_finished;
+};
 
 // TRbTreeItrBase
 //
-template <typename K>
+template <typename K, typename A, typename C>
 void
-TRbTreeItrBase<K>::increment(void)
+TRbTreeItrBase<K, A, C>::increment(void)
 {
     assert(m_node != NULL);
 
-    if (m_node->m_right != Node::NIL)
+    if (m_node->m_right != m_tree->m_nil)
     {
         m_node = m_node->m_right;
 
-        while (m_node->m_left != Node::NIL)
+        while (m_node->m_left != m_tree->m_nil)
             m_node = m_node->m_left;
 
         return;
@@ -166,27 +616,27 @@ TRbTreeItrBase<K>::increment(void)
         Node* m_old = m_node;
         m_node = m_node->m_parent;
 
-        if (m_node == Node::NIL || m_node->m_left == m_old)
+        if (m_node == m_tree->m_nil || m_node->m_left == m_old)
             break;
     }
 
-    if (m_node == Node::NIL)
+    if (m_node == m_tree->m_nil)
         m_node = NULL;
 
     return;
 }
 
-template <typename K>
+template <typename K, typename A, typename C>
 void
-TRbTreeItrBase<K>::decrement(void)
+TRbTreeItrBase<K, A, C>::decrement(void)
 {
     assert(m_node != NULL);
 
-    if (m_node->m_left != Node::NIL)
+    if (m_node->m_left != m_tree->m_nil)
     {
         m_node = m_node->m_left;
 
-        while (m_node->m_right != Node::NIL)
+        while (m_node->m_right != m_tree->m_nil)
             m_node = m_node->m_right;
 
         return;
@@ -197,11 +647,11 @@ TRbTreeItrBase<K>::decrement(void)
         Node* m_old = m_node;
         m_node = m_node->m_parent;
 
-        if (m_node == Node::NIL || m_node->m_right == m_old)
+        if (m_node == m_tree->m_nil || m_node->m_right == m_old)
             break;
     }
 
-    if (m_node == Node::NIL)
+    if (m_node == m_tree->m_nil)
         m_node = NULL;
 
     return;
@@ -209,50 +659,237 @@ TRbTreeItrBase<K>::decrement(void)
 
 // TRbTree
 //
-template <typename K>
-TRbTree<K>::TRbTree(void)
+template <typename K, typename A, typename C>
+TRbTree<K, A, C>::TRbTree(void)
+{
+    m_nil = new Node();
+    m_root = m_nil;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+    m_blocks = NULL;
+    m_free = NULL;
+    m_compaction.m_block = NULL;
+}
+
+template <typename K, typename A, typename C>
+TRbTree<K, A, C>::TRbTree(const C& compare)
+    : m_compare(compare)
+{
+    m_nil = new Node();
+    m_root = m_nil;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+    m_blocks = NULL;
+    m_free = NULL;
+    m_compaction.m_block = NULL;
+}
+
+template <typename K, typename A, typename C>
+TRbTree<K, A, C>::TRbTree(const TRbTree& other)
+    : m_compare(other.m_compare)
+{
+    m_nil = new Node();
+    m_root = m_nil;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+    m_blocks = NULL;
+    m_free = NULL;
+    m_compaction.m_block = NULL;
+
+    if (other.m_size == 0)
+        return;
+
+    size_t next = 0;
+    Node* nodes = NULL;
+
+    try
+    {
+        nodes = allocBlock(other.m_size);
+        m_root = clone(other.m_root, other.m_nil, m_nil, nodes, next);
+    }
+    catch (...)
+    {
+        // a throwing constructor gets no destructor call: destroy the keys
+        // cloned so far, which are nodes [0, next), then the block and m_nil
+        while (next > 0)
+            nodes[--next].~Node();
+
+        m_root = m_nil;
+        clear();
+        delete m_nil;
+        throw;
+    }
+
+    m_first = nodes;
+    m_last = nodes + other.m_size - 1;
+    m_size = other.m_size;
+}
+
+template <typename K, typename A, typename C>
+TRbTree<K, A, C>::TRbTree(TRbTree&& other)
+    : m_compare(other.m_compare)
 {
-    m_root = Node::NIL;
+    m_nil = new Node();
+    m_root = m_nil;
     m_first = NULL;
     m_last = NULL;
     m_size = 0;
+    m_blocks = NULL;
+    m_free = NULL;
+    m_compaction.m_block = NULL;
+
+    swap(other);
+}
+
+template <typename K, typename A, typename C>
+TRbTree<K, A, C>::~TRbTree(void)
+{
+    clear();
+    delete m_nil;
+}
+
+template <typename K, typename A, typename C>
+TRbTree<K, A, C>&
+TRbTree<K, A, C>::operator=(const TRbTree& other)
+{
+    if (this != &other)
+    {
+        TRbTree copy(other);
+        swap(copy);
+    }
+
+    return *this;
 }
 
-template <typename K>
+template <typename K, typename A, typename C>
 void
-TRbTree<K>::insert(const K& key)
+TRbTree<K, A, C>::swap(TRbTree& other)
 {
-    Node* node = new Node();
-    node->m_key = key;
+    // nodes only refer to their own tree's sentinel, so exchanging the
+    // sentinels along with the roots keeps both trees consistent
+    std::swap(m_nil, other.m_nil);
+    std::swap(m_root, other.m_root);
+    std::swap(m_first, other.m_first);
+    std::swap(m_last, other.m_last);
+    std::swap(m_size, other.m_size);
+    std::swap(m_blocks, other.m_blocks);
+    std::swap(m_free, other.m_free);
+    std::swap(m_compaction, other.m_compaction);
+    std::swap(m_compare, other.m_compare);
+}
 
-    insert(node);
+template <typename K, typename A, typename C>
+std::pair<typename TRbTree<K, A, C>::iterator, bool>
+TRbTree<K, A, C>::insert(const K& key)
+{
+    Node* parent;
+    bool left;
+    Node* node = locate(key, parent, left);
 
-    // fix first and last
-    if (m_first == NULL || m_last == NULL)
+    if (node != NULL)
     {
-        m_first = node;
-        m_last = node;
+        node->m_key = key;
+        return std::make_pair(iterator(this, node), false);
     }
-    else
+
+    return std::make_pair(iterator(this, attach(parent, left, key)), true);
+}
+
+template <typename K, typename A, typename C>
+std::pair<typename TRbTree<K, A, C>::iterator, bool>
+TRbTree<K, A, C>::insert(K&& key)
+{
+    Node* parent;
+    bool left;
+    Node* node = locate(key, parent, left);
+
+    if (node != NULL)
+    {
+        node->m_key = std::move(key);
+        return std::make_pair(iterator(this, node), false);
+    }
+
+    return std::make_pair(iterator(this, attach(parent, left, std::move(key))), true);
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::iterator
+TRbTree<K, A, C>::insert_hint(iterator hint, const K& key)
+{
+    Node* parent;
+    bool left;
+    Node* node = locateHint(hint, key, parent, left);
+
+    if (node != NULL)
+    {
+        node->m_key = key;
+        return iterator(this, node);
+    }
+
+    return iterator(this, attach(parent, left, key));
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::iterator
+TRbTree<K, A, C>::insert_hint(iterator hint, K&& key)
+{
+    Node* parent;
+    bool left;
+    Node* node = locateHint(hint, key, parent, left);
+
+    if (node != NULL)
     {
-        if (node->m_key < m_first->m_key)
-            m_first = node;
-        else if (m_last->m_key < node->m_key)
-            m_last = node;
+        node->m_key = std::move(key);
+        return iterator(this, node);
     }
+
+    return iterator(this, attach(parent, left, std::move(key)));
+}
+
+template <typename K, typename A, typename C>
+template <typename Q, typename... Args>
+std::pair<typename TRbTree<K, A, C>::iterator, bool>
+TRbTree<K, A, C>::try_emplace(const Q& key, Args&&... args)
+{
+    Node* parent;
+    bool left;
+    Node* node = locate(key, parent, left);
+
+    if (node != NULL)
+        return std::make_pair(iterator(this, node), false);
+
+    return std::make_pair(iterator(this, attach(parent, left, std::forward<Args>(args)...)), true);
+}
+
+template <typename K, typename A, typename C>
+template <typename Q, typename... Args>
+std::pair<typename TRbTree<K, A, C>::iterator, bool>
+TRbTree<K, A, C>::try_emplace_hint(iterator hint, const Q& key, Args&&... args)
+{
+    Node* parent;
+    bool left;
+    Node* node = locateHint(hint, key, parent, left);
+
+    if (node != NULL)
+        return std::make_pair(iterator(this, node), false);
+
+    return std::make_pair(iterator(this, attach(parent, left, std::forward<Args>(args)...)), true);
 }
 
-template <typename K>
+template <typename K, typename A, typename C>
 void
-TRbTree<K>::erase(const K& key)
+TRbTree<K, A, C>::erase(const K& key)
 {
     iterator itr = find(key);
     erase(itr);
 }
 
-template <typename K>
+template <typename K, typename A, typename C>
 void
-TRbTree<K>::erase(iterator itr)
+TRbTree<K, A, C>::erase(iterator itr)
 {
     if (itr != end())
     {
@@ -276,341 +913,1974 @@ TRbTree<K>::erase(iterator itr)
     }
 }
 
-template <typename K>
-typename TRbTree<K>::const_iterator
-TRbTree<K>::find(const K& key) const
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::erase(iterator first, iterator last)
 {
-    Node* node = m_root;
+    if (first == last)
+        return;
 
-    while (node != Node::NIL)
+    if (first.m_node == m_first && last == end())
     {
-        if (key < node->m_key)
-            node = node->m_left;
-        else if (node->m_key < key)
-            node = node->m_right;
-        else
-            return const_iterator(this, node);
+        clear();
+        return;
     }
 
-    return const_iterator(this, NULL);
-}
-
-template <typename K>
-inline void
-TRbTree<K>::leftRotate(Node* x)
-{
-    Node* y = x->m_right;
-    x->m_right = y->m_left;
-
-    if (y->m_left != Node::NIL)
-        y->m_left->m_parent = x;
-
-    y->m_parent = x->m_parent;
+    iterator itr = first;
 
-    if (x->m_parent == Node::NIL)
-        m_root = y;
-    else if (x == x->m_parent->m_left)
-        x->m_parent->m_left = y;
-    else
-        x->m_parent->m_right = y;
+    for (size_t count = 0; itr != last && count < SHORT_RANGE; count++)
+        ++itr;
 
-    y->m_left = x;
-    x->m_parent = y;
-}
+    if (itr == last)
+    {
+        // erase keeps the other nodes in place, so next stays valid
+        while (first != last)
+        {
+            iterator next = first;
+            ++next;
+            erase(first);
+            first = next;
+        }
 
-template <typename K>
-inline void
-TRbTree<K>::rightRotate(Node* x)
-{
-    Node* y = x->m_left;
-    x->m_left = y->m_right;
+        return;
+    }
 
-    if (y->m_right != Node::NIL)
-        y->m_right->m_parent = x;
+    Split lower;
+    split(rootPiece(m_root), first.m_node->m_key, lower);
 
-    y->m_parent = x->m_parent;
+    Piece rest = lower.m_left;
+    size_t count = 1;
 
-    if (x->m_parent == Node::NIL)
-        m_root = y;
-    else if (x == x->m_parent->m_right)
-        x->m_parent->m_right = y;
+    if (last == end())
+        count += destroyTree(lower.m_right.m_root);
     else
-        x->m_parent->m_left = y;
+    {
+        Split upper;
+        split(lower.m_right, last.m_node->m_key, upper);
+        count += destroyTree(upper.m_left.m_root);
+        rest = join(lower.m_left, upper.m_found, upper.m_right);
+    }
 
-    y->m_right = x;
-    x->m_parent = y;
+    destroyNode(lower.m_found);
+
+    Discards discards = { NULL, NULL, 0 };
+    settle(rest, m_size - count, discards);
 }
 
-template <typename K>
-inline void
-TRbTree<K>::insert(Node* z)
+template <typename K, typename A, typename C>
+template <typename Pred>
+size_t
+TRbTree<K, A, C>::erase_if(Pred pred)
 {
-    Node* y = Node::NIL;
-    Node* x = m_root;
+    // keys go one by one until SHORT_RANGE of them in a row have; the rest
+    // of such a run is erased as a range once its end is found
+    size_t size = m_size;
+    size_t run = 0;
+    iterator itr = begin();
 
-    while (x != Node::NIL)
+    while (itr != end())
     {
-        y = x;
+        if (!pred(static_cast<const K&>(itr.m_node->m_key)))
+        {
+            ++itr;
+            run = 0;
+            continue;
+        }
 
-        if (z->m_key < x->m_key)
-            x = x->m_left;
-        else if (x->m_key < z->m_key)
-            x = x->m_right;
-        else
+        if (run < SHORT_RANGE)
         {
-            x->m_key = z->m_key;
-            return;
+            iterator next = itr;
+            ++next;
+            erase(itr);
+            itr = next;
+            run++;
+            continue;
         }
-    }
 
-    z->m_parent = y;
+        iterator first = itr;
 
-    if (y == Node::NIL)
-        m_root = z;
-    else if (z->m_key < y->m_key)
-        y->m_left = z;
-    else
-        y->m_right = z;
+        do
+            ++itr;
+        while (itr != end() && pred(static_cast<const K&>(itr.m_node->m_key)));
 
-    z->m_left = Node::NIL;
-    z->m_right = Node::NIL;
-    z->m_color = Node::RED;
-    insertFixup(z);
+        erase(first, itr);
+        run = 0;
 
-    m_size++;
+        // pred was false for the key that ended the run, which erase kept
+        if (itr != end())
+            ++itr;
+    }
+
+    return size - m_size;
 }
 
-template <typename K>
-inline void
-TRbTree<K>::insertFixup(Node* z)
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::clear(void)
 {
-    while (z->m_parent->m_color == Node::RED)
-    {
-        if (z->m_parent == z->m_parent->m_parent->m_left)
-        {
-            Node* y = z->m_parent->m_parent->m_right;
-
-            if (y->m_color == Node::RED)
-            {
-                z->m_parent->m_color = Node::BLACK;
-                y->m_color = Node::BLACK;
-                z->m_parent->m_parent->m_color = Node::RED;
-                z = z->m_parent->m_parent;
-            }
-            else
-            {
-                if (z == z->m_parent->m_right)
-                {
-                    z = z->m_parent;
-                    leftRotate(z);
-                }
+    // post-order walk that unhooks each leaf before freeing it, so no
+    // recursion or stack is needed
+    Node* node = m_root;
 
-                z->m_parent->m_color = Node::BLACK;
-                z->m_parent->m_parent->m_color = Node::RED;
-                rightRotate(z->m_parent->m_parent);
-            }
-        }
+    while (node != m_nil)
+    {
+        if (node->m_left != m_nil)
+            node = node->m_left;
+        else if (node->m_right != m_nil)
+            node = node->m_right;
         else
         {
-            Node* y = z->m_parent->m_parent->m_left;
+            Node* parent = node->m_parent;
 
-            if (y->m_color == Node::RED)
+            if (parent != m_nil)
             {
-                z->m_parent->m_color = Node::BLACK;
-                y->m_color = Node::BLACK;
-                z->m_parent->m_parent->m_color = Node::RED;
-                z = z->m_parent->m_parent;
+                if (parent->m_left == node)
+                    parent->m_left = m_nil;
+                else
+                    parent->m_right = m_nil;
             }
-            else
-            {
-                if (z == z->m_parent->m_left)
-                {
-                    z = z->m_parent;
-                    rightRotate(z);
-                }
 
-                z->m_parent->m_color = Node::BLACK;
-                z->m_parent->m_parent->m_color = Node::RED;
-                leftRotate(z->m_parent->m_parent);
-            }
+            destroyNode(node);
+            node = parent;
         }
     }
 
-    m_root->m_color = Node::BLACK;
-}
+    while (m_blocks != NULL)
+    {
+        Block* block = m_blocks;
+        m_blocks = block->m_next;
+        operator delete(block->m_nodes);
+        delete block;
+    }
 
-template <typename K>
-void
-TRbTree<K>::transplant(Node* u, Node* v)
-{
-    if (u->m_parent == Node::NIL)
+    m_root = m_nil;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+    m_free = NULL;
+
+    // a compaction's block went with the others
+    m_compaction.m_block = NULL;
+}
+
+template <typename K, typename A, typename C>
+template <typename ForwardItr>
+void
+TRbTree<K, A, C>::assign_sorted(ForwardItr first, ForwardItr last)
+{
+    size_t count = 0;
+
+    for (ForwardItr itr = first; itr != last; ++itr)
+        count++;
+
+    TRbTreeBuilder<K, A, C> builder(*this, count);
+
+    for (ForwardItr itr = first; itr != last; ++itr)
+        builder.push_back(*itr);
+
+    builder.finish();
+}
+
+template <typename K, typename A, typename C>
+template <typename InputItr>
+void
+TRbTree<K, A, C>::assign_unsorted(InputItr first, InputItr last)
+{
+    std::vector<K> keys;
+
+    for (InputItr itr = first; itr != last; ++itr)
+        keys.push_back(*itr);
+
+    // stable so that the last of equal keys still wins
+    std::stable_sort(keys.begin(), keys.end(), m_compare);
+    assign_sorted(keys.begin(), keys.end());
+}
+
+
+template <typename K, typename A, typename C>
+template <typename Func>
+void
+TRbTree<K, A, C>::for_each_in_range(const K& lo, const K& hi, Func func)
+{
+    for (iterator itr = lower_bound(lo); itr != end() && m_compare(*itr, hi); ++itr)
+        func(*itr);
+}
+
+template <typename K, typename A, typename C>
+template <typename Func>
+void
+TRbTree<K, A, C>::for_each_in_range(const K& lo, const K& hi, Func func) const
+{
+    for (const_iterator itr = lower_bound(lo); itr != end() && m_compare(*itr, hi); ++itr)
+        func(*itr);
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::findNode(const Q& key) const
+{
+    Node* node = m_root;
+
+    while (node != m_nil)
+    {
+        if (m_compare(key, node->m_key))
+            node = node->m_left;
+        else if (m_compare(node->m_key, key))
+            node = node->m_right;
+        else
+            return node;
+    }
+
+    return NULL;
+}
+
+template <typename K, typename A, typename C>
+template <typename Q, typename Itr>
+void
+TRbTree<K, A, C>::findBatch(const Q* keys, size_t n, Itr* out) const
+{
+    // enough lookups in flight to cover a miss, few enough to stay in registers
+    enum { GROUP = 16 };
+
+    TRbTree* tree = const_cast<TRbTree*>(this);
+
+    for (size_t first = 0; first < n; first += GROUP)
+    {
+        size_t count = std::min<size_t>(GROUP, n - first);
+        Node* nodes[GROUP];
+
+        for (size_t i = 0; i < count; i++)
+            nodes[i] = m_root;
+
+        // a lookup leaves the group, its slot set to NULL, when it finds its
+        // key or falls off the tree
+        size_t active = count;
+
+        while (active > 0)
+        {
+            active = 0;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                Node* node = nodes[i];
+
+                if (node == NULL)
+                    continue;
+
+                const Q& key = keys[first + i];
+
+                if (node == m_nil)
+                    out[first + i] = Itr(tree, NULL);
+                else if (m_compare(key, node->m_key))
+                    node = node->m_left;
+                else if (m_compare(node->m_key, key))
+                    node = node->m_right;
+                else
+                    out[first + i] = Itr(tree, node);
+
+                if (node == nodes[i])
+                {
+                    nodes[i] = NULL;
+                    continue;
+                }
+
+                TRBTREE_PREFETCH(node);
+                nodes[i] = node;
+                active++;
+            }
+        }
+    }
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::lowerBound(const Q& key) const
+{
+    Node* node = m_root;
+    Node* bound = NULL;
+
+    while (node != m_nil)
+    {
+        if (m_compare(node->m_key, key))
+            node = node->m_right;
+        else
+        {
+            bound = node;
+            node = node->m_left;
+        }
+    }
+
+    return bound;
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::upperBound(const Q& key) const
+{
+    Node* node = m_root;
+    Node* bound = NULL;
+
+    while (node != m_nil)
+    {
+        if (m_compare(key, node->m_key))
+        {
+            bound = node;
+            node = node->m_left;
+        }
+        else
+            node = node->m_right;
+    }
+
+    return bound;
+}
+
+template <typename K, typename A, typename C>
+size_t
+TRbTree<K, A, C>::rank(const K& key) const
+{
+    Node* node = m_root;
+    size_t rank = 0;
+
+    while (node != m_nil)
+    {
+        if (m_compare(node->m_key, key))
+        {
+            rank += node->m_left->m_subtreeSize + 1;
+            node = node->m_right;
+        }
+        else
+            node = node->m_left;
+    }
+
+    return rank;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::selectNode(size_t k) const
+{
+    if (k >= m_size)
+        return NULL;
+
+    Node* node = m_root;
+
+    while (1)
+    {
+        size_t leftSize = node->m_left->m_subtreeSize;
+
+        if (k < leftSize)
+            node = node->m_left;
+        else if (k > leftSize)
+        {
+            k -= leftSize + 1;
+            node = node->m_right;
+        }
+        else
+            return node;
+    }
+}
+
+template <typename K, typename A, typename C>
+inline void
+TRbTree<K, A, C>::updatePath(Node* x)
+{
+    if (!A::ENABLED)
+        return;
+
+    for (; x != m_nil; x = x->m_parent)
+        update(x);
+}
+
+template <typename K, typename A, typename C>
+inline void
+TRbTree<K, A, C>::leftRotate(Node* x)
+{
+    Node* y = x->m_right;
+    x->m_right = y->m_left;
+
+    if (y->m_left != m_nil)
+        y->m_left->m_parent = x;
+
+    y->m_parent = x->m_parent;
+
+    if (x->m_parent == m_nil)
+        m_root = y;
+    else if (x == x->m_parent->m_left)
+        x->m_parent->m_left = y;
+    else
+        x->m_parent->m_right = y;
+
+    y->m_left = x;
+    x->m_parent = y;
+
+    update(x);
+    update(y);
+}
+
+template <typename K, typename A, typename C>
+inline void
+TRbTree<K, A, C>::rightRotate(Node* x)
+{
+    Node* y = x->m_left;
+    x->m_left = y->m_right;
+
+    if (y->m_right != m_nil)
+        y->m_right->m_parent = x;
+
+    y->m_parent = x->m_parent;
+
+    if (x->m_parent == m_nil)
+        m_root = y;
+    else if (x == x->m_parent->m_right)
+        x->m_parent->m_right = y;
+    else
+        x->m_parent->m_left = y;
+
+    y->m_right = x;
+    x->m_parent = y;
+
+    update(x);
+    update(y);
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::locate(const Q& key, Node*& parent, bool& left)
+{
+    Node* y = m_nil;
+    Node* x = m_root;
+
+    while (x != m_nil)
+    {
+        y = x;
+
+        if (m_compare(key, x->m_key))
+            x = x->m_left;
+        else if (m_compare(x->m_key, key))
+            x = x->m_right;
+        else
+            return x;
+    }
+
+    parent = y;
+    left = (y != m_nil && m_compare(key, y->m_key));
+    return NULL;
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::locateHint(iterator hint, const Q& key, Node*& parent, bool& left)
+{
+    Node* node = hint.m_node;
+
+    if (node == NULL)
+    {
+        // after the last key
+        if (m_last == NULL || m_compare(m_last->m_key, key))
+        {
+            parent = (m_last == NULL) ? m_nil : m_last;
+            left = false;
+            return NULL;
+        }
+    }
+    else if (m_compare(key, node->m_key))
+    {
+        // between the predecessor and hint: the predecessor has no right
+        // child if hint has a left subtree, otherwise hint has no left child
+        iterator prev = hint;
+
+        if (node == m_first || m_compare(*(--prev), key))
+        {
+            left = (node->m_left == m_nil);
+            parent = left ? node : prev.m_node;
+            return NULL;
+        }
+    }
+    else if (m_compare(node->m_key, key))
+    {
+        iterator next = hint;
+
+        if (node == m_last || m_compare(key, *(++next)))
+        {
+            left = (node->m_right != m_nil);
+            parent = left ? next.m_node : node;
+            return NULL;
+        }
+    }
+    else
+        return node;
+
+    return locate(key, parent, left);
+}
+
+template <typename K, typename A, typename C>
+template <typename... Args>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::attach(Node* parent, bool left, Args&&... args)
+{
+    // parent is the sentinel for an empty tree, otherwise its child on the
+    // given side is the sentinel and the new key belongs there
+    Node* z = createNode(std::forward<Args>(args)...);
+    z->m_parent = parent;
+
+    if (parent == m_nil)
+        m_root = z;
+    else if (left)
+        parent->m_left = z;
+    else
+        parent->m_right = z;
+
+    z->m_left = m_nil;
+    z->m_right = m_nil;
+    z->m_color = Node::RED;
+    updatePath(z);
+    insertFixup(z);
+
+    m_size++;
+
+    if (parent == m_nil)
+    {
+        m_first = z;
+        m_last = z;
+    }
+    else if (left && parent == m_first)
+        m_first = z;
+    else if (!left && parent == m_last)
+        m_last = z;
+
+    return z;
+}
+
+template <typename K, typename A, typename C>
+inline void
+TRbTree<K, A, C>::insertFixup(Node* z)
+{
+    while (z->m_parent->m_color == Node::RED)
+    {
+        if (z->m_parent == z->m_parent->m_parent->m_left)
+        {
+            Node* y = z->m_parent->m_parent->m_right;
+
+            if (y->m_color == Node::RED)
+            {
+                z->m_parent->m_color = Node::BLACK;
+                y->m_color = Node::BLACK;
+                z->m_parent->m_parent->m_color = Node::RED;
+                z = z->m_parent->m_parent;
+            }
+            else
+            {
+                if (z == z->m_parent->m_right)
+                {
+                    z = z->m_parent;
+                    leftRotate(z);
+                }
+
+                z->m_parent->m_color = Node::BLACK;
+                z->m_parent->m_parent->m_color = Node::RED;
+                rightRotate(z->m_parent->m_parent);
+            }
+        }
+        else
+        {
+            Node* y = z->m_parent->m_parent->m_left;
+
+            if (y->m_color == Node::RED)
+            {
+                z->m_parent->m_color = Node::BLACK;
+                y->m_color = Node::BLACK;
+                z->m_parent->m_parent->m_color = Node::RED;
+                z = z->m_parent->m_parent;
+            }
+            else
+            {
+                if (z == z->m_parent->m_left)
+                {
+                    z = z->m_parent;
+                    rightRotate(z);
+                }
+
+                z->m_parent->m_color = Node::BLACK;
+                z->m_parent->m_parent->m_color = Node::RED;
+                leftRotate(z->m_parent->m_parent);
+            }
+        }
+    }
+
+    m_root->m_color = Node::BLACK;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::transplant(Node* u, Node* v)
+{
+    if (u->m_parent == m_nil)
         m_root = v;
     else if (u == u->m_parent->m_left)
         u->m_parent->m_left = v;
     else
-        u->m_parent->m_right = v;
+        u->m_parent->m_right = v;
+
+    v->m_parent = u->m_parent;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::minimum(Node* x)
+{
+    while (x->m_left != m_nil)
+        x = x->m_left;
+    return x;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::erase(Node* z)
+{
+    assert(z != NULL && z != m_nil);
+
+    // a compaction goes on from the next key
+    if (m_compaction.m_block != NULL && z == m_compaction.m_next)
+    {
+        iterator itr(this, z);
+        ++itr;
+        m_compaction.m_next = itr.m_node;
+    }
+
+    Node* x = NULL;
+    Node* y = z;
+    Node::Color yOriginalColor = y->m_color;
+
+    if (z->m_left == m_nil)
+    {
+        x = z->m_right;
+        transplant(z, z->m_right);
+    }
+    else if (z->m_right == m_nil)
+    {
+        x = z->m_left;
+        transplant(z, z->m_left);
+    }
+    else
+    {
+        y = minimum(z->m_right);
+        yOriginalColor = y->m_color;
+        x = y->m_right;
+
+        if (y->m_parent == z)
+            x->m_parent = y;
+        else
+        {
+            transplant(y, y->m_right);
+            y->m_right = z->m_right;
+            y->m_right->m_parent = y;
+        }
+
+        transplant(z, y);
+        y->m_left = z->m_left;
+        y->m_left->m_parent = y;
+        y->m_color = z->m_color;
+    }
+
+    // x->m_parent is the lowest node whose subtree changed, even if x is the
+    // sentinel
+    updatePath(x->m_parent);
+
+    if (yOriginalColor == Node::BLACK)
+        eraseFixup(x);
+    
+    destroyNode(z);
+    m_size--;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::eraseFixup(Node* x)
+{
+    while (x != m_root && x->m_color == Node::BLACK)
+    {
+        if (x == x->m_parent->m_left)
+        {
+            Node* w = x->m_parent->m_right;
+
+            if (w->m_color == Node::RED)
+            {
+                w->m_color = Node::BLACK;
+                x->m_parent->m_color = Node::RED;
+                leftRotate(x->m_parent);
+                w = x->m_parent->m_right;
+            }
+
+            if (w->m_left->m_color == Node::BLACK && w->m_right->m_color == Node::BLACK)
+            {
+                w->m_color = Node::RED;
+                x = x->m_parent;
+            }
+            else
+            {
+                if (w->m_right->m_color == Node::BLACK)
+                {
+                    w->m_left->m_color = Node::BLACK;
+                    w->m_color = Node::RED;
+                    rightRotate(w);
+                    w = x->m_parent->m_right;
+                }
+
+                w->m_color = x->m_parent->m_color;
+                x->m_parent->m_color = Node::BLACK;
+                w->m_right->m_color = Node::BLACK;
+                leftRotate(x->m_parent);
+                x = m_root;
+            }
+        }
+        else
+        {
+            Node* w = x->m_parent->m_left;
+
+            if (w->m_color == Node::RED)
+            {
+                w->m_color = Node::BLACK;
+                x->m_parent->m_color = Node::RED;
+                rightRotate(x->m_parent);
+                w = x->m_parent->m_left;
+            }
+
+            if (w->m_right->m_color == Node::BLACK && w->m_left->m_color == Node::BLACK)
+            {
+                w->m_color = Node::RED;
+                x = x->m_parent;
+            }
+            else
+            {
+                if (w->m_left->m_color == Node::BLACK)
+                {
+                    w->m_right->m_color = Node::BLACK;
+                    w->m_color = Node::RED;
+                    leftRotate(w);
+                    w = x->m_parent->m_left;
+                }
+
+                w->m_color = x->m_parent->m_color;
+                x->m_parent->m_color = Node::BLACK;
+                w->m_left->m_color = Node::BLACK;
+                rightRotate(x->m_parent);
+                x = m_root;
+            }
+        }
+    }
+
+    x->m_color = Node::BLACK;
+}
+
+template <typename K, typename A, typename C>
+template <typename... Args>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::createNode(Args&&... args)
+{
+    if (m_free == NULL)
+        return new Node(std::forward<Args>(args)...);
+
+    void* memory = m_free;
+    m_free = *static_cast<void**>(memory);
+
+    Node* node = new (memory) Node(std::forward<Args>(args)...);
+    node->m_pooled = true;
+    return node;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::destroyNode(Node* node)
+{
+    if (!node->m_pooled)
+    {
+        delete node;
+        return;
+    }
+
+    node->~Node();
+    freeNode(node);
+}
+
+// Copies the subtree at node into nodes, taking them in key order from
+// next on. The recursion is as deep as the tree, O(log n).
+//
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::clone(const Node* node, const Node* otherNil, Node* parent, Node* nodes, size_t& next)
+{
+    if (node == otherNil)
+        return m_nil;
+
+    // the left subtree takes the slots before this node's; its root learns
+    // its parent once this node is placed
+    Node* left = clone(node->m_left, otherNil, NULL, nodes, next);
+    Node* copy = nodes + next;
+
+    // count the node only once its key is built, so that on a throw the
+    // caller destroys exactly the constructed ones
+    new (copy) Node(node->m_key);
+    next++;
+    static_cast<A&>(*copy) = static_cast<const A&>(*node);
+    copy->m_pooled = true;
+    copy->m_color = node->m_color;
+    copy->m_parent = parent;
+    copy->m_left = left;
+
+    if (left != m_nil)
+        left->m_parent = copy;
+
+    copy->m_right = clone(node->m_right, otherNil, copy, nodes, next);
+    return copy;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::allocBlock(size_t count)
+{
+    Node* nodes = static_cast<Node*>(operator new(sizeof(Node) * count));
+    Block* block;
+
+    try
+    {
+        block = new Block();
+    }
+    catch (...)
+    {
+        operator delete(nodes);
+        throw;
+    }
+
+    block->m_nodes = nodes;
+    block->m_next = m_blocks;
+    m_blocks = block;
+    return block->m_nodes;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::freeNode(Node* node)
+{
+    // node is raw block memory here, so reuse it as the free list link
+    void*& head = (m_compaction.m_block != NULL && !compacting(node)) ? m_compaction.m_free : m_free;
+
+    *reinterpret_cast<void**>(node) = head;
+    head = node;
+}
+
+// Moves node into slot, which is raw block memory, or into a node of its
+// own if slot is NULL, and points its parent, its children and the tree at
+// the new place.
+//
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::relocate(Node* node, Node* slot)
+{
+    Node* copy = (slot != NULL) ? new (slot) Node(std::move(node->m_key)) : new Node(std::move(node->m_key));
+    static_cast<A&>(*copy) = static_cast<const A&>(*node);
+    copy->m_pooled = (slot != NULL);
+    copy->m_color = node->m_color;
+    copy->m_parent = node->m_parent;
+    copy->m_left = node->m_left;
+    copy->m_right = node->m_right;
+
+    if (copy->m_parent == m_nil)
+        m_root = copy;
+    else if (copy->m_parent->m_left == node)
+        copy->m_parent->m_left = copy;
+    else
+        copy->m_parent->m_right = copy;
+
+    if (copy->m_left != m_nil)
+        copy->m_left->m_parent = copy;
+
+    if (copy->m_right != m_nil)
+        copy->m_right->m_parent = copy;
+
+    if (m_first == node)
+        m_first = copy;
+
+    if (m_last == node)
+        m_last = copy;
+
+    destroyNode(node);
+    return copy;
+}
+
+template <typename K, typename A, typename C>
+inline bool
+TRbTree<K, A, C>::compacting(Node* node) const
+{
+    Node* nodes = m_compaction.m_block->m_nodes;
+    return node >= nodes && node < nodes + m_compaction.m_capacity;
+}
+
+// Puts the slots of the compaction's block that no node took on m_free.
+//
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::releaseSlots(void)
+{
+    Node* nodes = m_compaction.m_block->m_nodes;
+
+    for (size_t i = m_compaction.m_capacity; i > m_compaction.m_count; i--)
+    {
+        *reinterpret_cast<void**>(nodes + i - 1) = m_free;
+        m_free = nodes + i - 1;
+    }
+}
+
+// Abandons the compaction in progress, if any. Its block stays as it is and
+// every slot set aside goes back on m_free, so nothing is lost until the
+// blocks are released.
+//
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::stopCompact(void)
+{
+    if (m_compaction.m_block == NULL)
+        return;
+
+    // m_free holds only the block's slots erased since the start, the
+    // shorter list, so the slots set aside are appended to it
+    if (m_free == NULL)
+        m_free = m_compaction.m_free;
+    else
+    {
+        void* tail = m_free;
+
+        while (*static_cast<void**>(tail) != NULL)
+            tail = *static_cast<void**>(tail);
+
+        *static_cast<void**>(tail) = m_compaction.m_free;
+    }
+
+    releaseSlots();
+    m_compaction.m_block = NULL;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::buildBalanced(Node* nodes, size_t count, Node* parent, size_t depth, size_t redDepth)
+{
+    if (count == 0)
+        return m_nil;
+
+    // halves differ by at most one in size, so every level is full except
+    // the deepest, whose nodes are red; all paths then have equal black height
+    size_t mid = count / 2;
+    Node* node = nodes + mid;
+
+    node->m_parent = parent;
+    node->m_color = (depth == redDepth) ? Node::RED : Node::BLACK;
+    node->m_left = buildBalanced(nodes, mid, node, depth + 1, redDepth);
+    node->m_right = buildBalanced(nodes + mid + 1, count - mid - 1, node, depth + 1, redDepth);
+    update(node);
+    return node;
+}
+
+template <typename K, typename A, typename C>
+size_t
+TRbTree<K, A, C>::maxDepth(void) const
+{
+    if (m_root == m_nil)
+        return 0;
+
+    size_t depth = 1;
+    size_t leftDepth = maxDepth(m_root->m_left, depth);
+    size_t rightDepth = maxDepth(m_root->m_right, depth);
+    return (leftDepth > rightDepth) ? leftDepth : rightDepth;
+}
+
+template <typename K, typename A, typename C>
+size_t
+TRbTree<K, A, C>::maxDepth(Node* node, size_t depth) const
+{
+    if (node == m_nil)
+        return depth;
+
+    depth++;
+    size_t leftDepth = maxDepth(node->m_left, depth);
+    size_t rightDepth = maxDepth(node->m_right, depth);
+    return (leftDepth > rightDepth) ? leftDepth : rightDepth;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::set_union(TRbTree& other)
+{
+    if (&other == this)
+        return;
+
+    size_t size = m_size + other.m_size;
+    Piece mine;
+    Piece theirs;
+    absorb(other, mine, theirs);
+
+    Discards discards = { NULL, NULL, 0 };
+    Piece result;
+
+    try
+    {
+        result = unite(mine, theirs, discards, threadBudget());
+    }
+    catch (...)
+    {
+        forget();
+        throw;
+    }
+
+    settle(result, size - discards.m_count, discards);
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::set_intersection(TRbTree& other)
+{
+    if (&other == this)
+        return;
+
+    size_t size = m_size + other.m_size;
+    Piece mine;
+    Piece theirs;
+    absorb(other, mine, theirs);
+
+    Discards discards = { NULL, NULL, 0 };
+    Piece result;
+
+    try
+    {
+        result = intersect(mine, theirs, discards, threadBudget());
+    }
+    catch (...)
+    {
+        forget();
+        throw;
+    }
+
+    settle(result, size - discards.m_count, discards);
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::set_difference(TRbTree& other)
+{
+    if (&other == this)
+    {
+        clear();
+        return;
+    }
+
+    size_t size = m_size + other.m_size;
+    Piece mine;
+    Piece theirs;
+    absorb(other, mine, theirs);
+
+    Discards discards = { NULL, NULL, 0 };
+    Piece result;
+
+    try
+    {
+        result = subtract(mine, theirs, discards, threadBudget());
+    }
+    catch (...)
+    {
+        forget();
+        throw;
+    }
+
+    settle(result, size - discards.m_count, discards);
+}
+
+template <typename K, typename A, typename C>
+template <typename Pred>
+void
+TRbTree<K, A, C>::filter(Pred pred)
+{
+    Discards discards = { NULL, NULL, 0 };
+    Piece result;
+
+    try
+    {
+        result = filter(rootPiece(m_root), pred, discards, threadBudget());
+    }
+    catch (...)
+    {
+        forget();
+        throw;
+    }
+
+    settle(result, m_size - discards.m_count, discards);
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::join(TRbTree& right)
+{
+    if (&right == this || right.m_size == 0)
+        return;
+
+    assert(m_last == NULL || m_compare(m_last->m_key, right.m_first->m_key));
+
+    size_t size = m_size + right.m_size;
+    Piece mine;
+    Piece theirs;
+    absorb(right, mine, theirs);
+
+    Discards discards = { NULL, NULL, 0 };
+    settle(concat(mine, theirs), size, discards);
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
+void
+TRbTree<K, A, C>::splitOff(const Q& key, TRbTree& right)
+{
+    assert(&right != this && right.m_size == 0);
+
+    if (m_root == m_nil)
+        return;
+
+    stopCompact();
+
+    Split parts;
+    split(rootPiece(m_root), key, parts);
+
+    Piece upper = parts.m_right;
+
+    if (parts.m_found != NULL)
+        upper = join(emptyPiece(), parts.m_found, upper);
+
+    size_t moved = 0;
+    Discards discards = { NULL, NULL, 0 };
+    Piece upperPiece = { right.adopt(upper.m_root, *this, moved), upper.m_blackHeight };
+
+    right.settle(upperPiece, moved, discards);
+    settle(parts.m_left, m_size - moved, discards);
+}
+
+template <typename K, typename A, typename C>
+bool
+TRbTree<K, A, C>::compact_step(size_t count)
+{
+    if (m_compaction.m_block == NULL)
+    {
+        if (m_size == 0)
+        {
+            clear();
+            return true;
+        }
+
+        // the old blocks stay behind the new one until every node is out
+        allocBlock(m_size);
+        m_compaction.m_block = m_blocks;
+        m_compaction.m_capacity = m_size;
+        m_compaction.m_count = 0;
+        m_compaction.m_next = m_first;
+        m_compaction.m_free = m_free;
+        m_free = NULL;
+    }
+
+    for (; count > 0 && m_compaction.m_next != NULL; count--)
+    {
+        Node* node = m_compaction.m_next;
+        bool room = m_compaction.m_count < m_compaction.m_capacity;
+
+        // inserts ahead of the position can outnumber erases and fill the
+        // block; what remains of the old blocks then moves to nodes of its own
+        if (!compacting(node) && (room || node->m_pooled))
+            node = relocate(node, room ? m_compaction.m_block->m_nodes + m_compaction.m_count++ : NULL);
+
+        iterator itr(this, node);
+        ++itr;
+        m_compaction.m_next = itr.m_node;
+    }
+
+    if (m_compaction.m_next != NULL)
+        return false;
+
+    // no allocBlock since the start, or the compaction would have stopped
+    assert(m_blocks == m_compaction.m_block);
+
+    Block* old = m_blocks->m_next;
+    m_blocks->m_next = NULL;
+
+    while (old != NULL)
+    {
+        Block* block = old;
+        old = block->m_next;
+        operator delete(block->m_nodes);
+        delete block;
+    }
+
+    // the slots set aside were in the old blocks
+    releaseSlots();
+    m_compaction.m_block = NULL;
+    return true;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::rootPiece(Node* root) const
+{
+    Piece piece = { root, 0 };
+
+    for (Node* node = root; node != m_nil; node = node->m_left)
+    {
+        if (node->m_color == Node::BLACK)
+            piece.m_blackHeight++;
+    }
+
+    return piece;
+}
+
+template <typename K, typename A, typename C>
+inline typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::childPiece(Node* child, const Piece& parent) const
+{
+    Piece piece = { child, parent.m_blackHeight - ((parent.m_root->m_color == Node::BLACK) ? 1 : 0) };
+    return piece;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::absorb(TRbTree& other, Piece& mine, Piece& theirs)
+{
+    // the nodes and blocks of both trees are about to mix
+    stopCompact();
+    other.stopCompact();
+
+    // Nodes of both trees must end at the same sentinel, so rebind the
+    // smaller tree. Sentinels are interchangeable, so this tree can as well
+    // take over the sentinel of other.
+    if (m_size < other.m_size)
+    {
+        m_root = rebind(m_root, m_nil, other.m_nil);
+        std::swap(m_nil, other.m_nil);
+    }
+    else
+        other.m_root = rebind(other.m_root, other.m_nil, m_nil);
+
+    mine = rootPiece(m_root);
+    theirs = rootPiece(other.m_root);
+
+    // the blocks and free slots of other come along with its nodes
+    if (other.m_blocks != NULL)
+    {
+        Block* tail = other.m_blocks;
+
+        while (tail->m_next != NULL)
+            tail = tail->m_next;
+
+        tail->m_next = m_blocks;
+        m_blocks = other.m_blocks;
+    }
+
+    if (other.m_free != NULL)
+    {
+        void* tail = other.m_free;
+
+        while (*static_cast<void**>(tail) != NULL)
+            tail = *static_cast<void**>(tail);
+
+        *static_cast<void**>(tail) = m_free;
+        m_free = other.m_free;
+    }
+
+    other.m_root = other.m_nil;
+    other.m_first = NULL;
+    other.m_last = NULL;
+    other.m_size = 0;
+    other.m_blocks = NULL;
+    other.m_free = NULL;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::rebind(Node* node, Node* oldNil, Node* newNil)
+{
+    if (node == oldNil)
+        return newNil;
+
+    node->m_left = rebind(node->m_left, oldNil, newNil);
+    node->m_right = rebind(node->m_right, oldNil, newNil);
+    return node;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::adopt(Node* node, TRbTree& from, size_t& count)
+{
+    if (node == from.m_nil)
+        return m_nil;
+
+    Node* left = node->m_left;
+    Node* right = node->m_right;
+
+    // a pooled node must not outlive its block, which stays with from
+    if (node->m_pooled)
+    {
+        Node* copy = new Node(node->m_key);
+        static_cast<A&>(*copy) = static_cast<const A&>(*node);
+        copy->m_color = node->m_color;
+        from.destroyNode(node);
+        node = copy;
+    }
+
+    node->m_left = adopt(left, from, count);
+    node->m_right = adopt(right, from, count);
+
+    if (node->m_left != m_nil)
+        node->m_left->m_parent = node;
+
+    if (node->m_right != m_nil)
+        node->m_right->m_parent = node;
+
+    count++;
+    return node;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::settle(Piece result, size_t size, Discards& discards)
+{
+    stopCompact();
+
+    for (Node* node = discards.m_head; node != NULL; )
+    {
+        Node* next = node->m_parent;
+        destroyNode(node);
+        node = next;
+    }
+
+    m_root = result.m_root;
+    m_size = size;
+    m_first = NULL;
+    m_last = NULL;
+
+    if (m_root == m_nil)
+        return;
+
+    m_root->m_parent = m_nil;
+    m_root->m_color = Node::BLACK;
+
+    for (m_first = m_root; m_first->m_left != m_nil; m_first = m_first->m_left)
+        ;
+
+    for (m_last = m_root; m_last->m_right != m_nil; m_last = m_last->m_right)
+        ;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::joinRotateLeft(Node* x)
+{
+    // as leftRotate, for a detached subtree whose parent link the caller sets
+    Node* y = x->m_right;
+    x->m_right = y->m_left;
+
+    if (y->m_left != m_nil)
+        y->m_left->m_parent = x;
+
+    y->m_left = x;
+    x->m_parent = y;
+
+    update(x);
+    update(y);
+    return y;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::joinRotateRight(Node* x)
+{
+    Node* y = x->m_left;
+    x->m_left = y->m_right;
+
+    if (y->m_right != m_nil)
+        y->m_right->m_parent = x;
+
+    y->m_right = x;
+    x->m_parent = y;
+
+    update(x);
+    update(y);
+    return y;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::joinRight(Node* left, size_t leftHeight, Node* key, Node* right, size_t rightHeight)
+{
+    // walk down the right spine of left to a black node as high as right,
+    // put key there as a red node and fix red-red pairs on the way back up
+    if (left->m_color == Node::BLACK && leftHeight == rightHeight)
+    {
+        key->m_color = Node::RED;
+        key->m_left = left;
+        key->m_right = right;
+
+        if (left != m_nil)
+            left->m_parent = key;
+
+        if (right != m_nil)
+            right->m_parent = key;
+
+        update(key);
+        return key;
+    }
+
+    size_t childHeight = leftHeight - ((left->m_color == Node::BLACK) ? 1 : 0);
+    Node* child = joinRight(left->m_right, childHeight, key, right, rightHeight);
+
+    left->m_right = child;
+    child->m_parent = left;
+
+    if (left->m_color == Node::BLACK && child->m_color == Node::RED && child->m_right->m_color == Node::RED)
+    {
+        child->m_right->m_color = Node::BLACK;
+        return joinRotateLeft(left);
+    }
+
+    update(left);
+    return left;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Node*
+TRbTree<K, A, C>::joinLeft(Node* left, size_t leftHeight, Node* key, Node* right, size_t rightHeight)
+{
+    if (right->m_color == Node::BLACK && leftHeight == rightHeight)
+    {
+        key->m_color = Node::RED;
+        key->m_left = left;
+        key->m_right = right;
+
+        if (left != m_nil)
+            left->m_parent = key;
+
+        if (right != m_nil)
+            right->m_parent = key;
+
+        update(key);
+        return key;
+    }
+
+    size_t childHeight = rightHeight - ((right->m_color == Node::BLACK) ? 1 : 0);
+    Node* child = joinLeft(left, leftHeight, key, right->m_left, childHeight);
+
+    right->m_left = child;
+    child->m_parent = right;
+
+    if (right->m_color == Node::BLACK && child->m_color == Node::RED && child->m_left->m_color == Node::RED)
+    {
+        child->m_left->m_color = Node::BLACK;
+        return joinRotateRight(right);
+    }
+
+    update(right);
+    return right;
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::join(Piece left, Node* key, Piece right)
+{
+    // every key in left < key < every key in right; black roots keep the
+    // spine walks simple and never break the tree
+    if (left.m_root->m_color == Node::RED)
+    {
+        left.m_root->m_color = Node::BLACK;
+        left.m_blackHeight++;
+    }
+
+    if (right.m_root->m_color == Node::RED)
+    {
+        right.m_root->m_color = Node::BLACK;
+        right.m_blackHeight++;
+    }
+
+    Piece piece;
+
+    if (left.m_blackHeight > right.m_blackHeight)
+    {
+        piece.m_root = joinRight(left.m_root, left.m_blackHeight, key, right.m_root, right.m_blackHeight);
+        piece.m_blackHeight = left.m_blackHeight;
+
+        if (piece.m_root->m_color == Node::RED && piece.m_root->m_right->m_color == Node::RED)
+        {
+            piece.m_root->m_color = Node::BLACK;
+            piece.m_blackHeight++;
+        }
+    }
+    else if (right.m_blackHeight > left.m_blackHeight)
+    {
+        piece.m_root = joinLeft(left.m_root, left.m_blackHeight, key, right.m_root, right.m_blackHeight);
+        piece.m_blackHeight = right.m_blackHeight;
+
+        if (piece.m_root->m_color == Node::RED && piece.m_root->m_left->m_color == Node::RED)
+        {
+            piece.m_root->m_color = Node::BLACK;
+            piece.m_blackHeight++;
+        }
+    }
+    else
+    {
+        // key becomes a red root over the two black ones
+        piece.m_root = joinRight(left.m_root, left.m_blackHeight, key, right.m_root, right.m_blackHeight);
+        piece.m_blackHeight = left.m_blackHeight;
+    }
 
-    v->m_parent = u->m_parent;
+    return piece;
 }
 
-template <typename K>
-typename TRbTree<K>::Node*
-TRbTree<K>::minimum(Node* x)
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::concat(Piece left, Piece right)
 {
-    while (x->m_left != Node::NIL)
-        x = x->m_left;
-    return x;
+    if (left.m_root == m_nil)
+        return right;
+
+    if (right.m_root == m_nil)
+        return left;
+
+    Node* last;
+    Piece rest = splitLast(left, last);
+    return join(rest, last, right);
 }
 
-template <typename K>
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::splitLast(Piece piece, Node*& last)
+{
+    Node* node = piece.m_root;
+
+    if (node->m_right == m_nil)
+    {
+        last = node;
+        return childPiece(node->m_left, piece);
+    }
+
+    Piece rest = splitLast(childPiece(node->m_right, piece), last);
+    return join(childPiece(node->m_left, piece), node, rest);
+}
+
+template <typename K, typename A, typename C>
+template <typename Q>
 void
-TRbTree<K>::erase(Node* z)
+TRbTree<K, A, C>::split(Piece piece, const Q& key, Split& parts)
 {
-    assert(z != NULL && z != Node::NIL);
+    Node* node = piece.m_root;
 
-    Node* x = NULL;
-    Node* y = z;
-    Node::Color yOriginalColor = y->m_color;
+    if (node == m_nil)
+    {
+        parts.m_left = emptyPiece();
+        parts.m_found = NULL;
+        parts.m_right = emptyPiece();
+        return;
+    }
+
+    Piece left = childPiece(node->m_left, piece);
+    Piece right = childPiece(node->m_right, piece);
 
-    if (z->m_left == Node::NIL)
+    if (m_compare(key, node->m_key))
     {
-        x = z->m_right;
-        transplant(z, z->m_right);
+        split(left, key, parts);
+        parts.m_right = join(parts.m_right, node, right);
     }
-    else if (z->m_right == Node::NIL)
+    else if (m_compare(node->m_key, key))
     {
-        x = z->m_left;
-        transplant(z, z->m_left);
+        split(right, key, parts);
+        parts.m_left = join(left, node, parts.m_left);
     }
     else
     {
-        y = minimum(z->m_right);
-        yOriginalColor = y->m_color;
-        x = y->m_right;
+        parts.m_left = left;
+        parts.m_found = node;
+        parts.m_right = right;
+    }
+}
 
-        if (y->m_parent == z)
-            x->m_parent = y;
+// The set operations expose the root of the smaller piece, split the larger
+// one by its key and recurse on both sides, in parallel when both sides are
+// large and threads are left; the budget is halved at each fork.
+//
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::unite(Piece mine, Piece theirs, Discards& discards, size_t threads)
+{
+    if (mine.m_root == m_nil)
+        return theirs;
+
+    if (theirs.m_root == m_nil)
+        return mine;
+
+    bool exposeMine = mine.m_blackHeight < theirs.m_blackHeight;
+    Piece exposed = exposeMine ? mine : theirs;
+    Node* key = exposed.m_root;
+    Piece exposedLeft = childPiece(key->m_left, exposed);
+    Piece exposedRight = childPiece(key->m_right, exposed);
+
+    Split parts;
+    split(exposeMine ? theirs : mine, key->m_key, parts);
+
+    if (parts.m_found != NULL)
+    {
+        if (exposeMine)
+            discard(parts.m_found, discards);
         else
         {
-            transplant(y, y->m_right);
-            y->m_right = z->m_right;
-            y->m_right->m_parent = y;
+            discard(key, discards);
+            key = parts.m_found;
         }
+    }
 
-        transplant(z, y);
-        y->m_left = z->m_left;
-        y->m_left->m_parent = y;
-        y->m_color = z->m_color;
+    Piece myLeft = exposeMine ? exposedLeft : parts.m_left;
+    Piece myRight = exposeMine ? exposedRight : parts.m_right;
+    Piece theirLeft = exposeMine ? parts.m_left : exposedLeft;
+    Piece theirRight = exposeMine ? parts.m_right : exposedRight;
+
+    Piece left;
+    Piece right;
+    Discards leftDiscards = { NULL, NULL, 0 };
+
+    invoke(parallel(myLeft, theirLeft, threads),
+        [&]() { left = unite(myLeft, theirLeft, leftDiscards, threads / 2); },
+        [&]() { right = unite(myRight, theirRight, discards, threads - threads / 2); });
+
+    mergeDiscards(discards, leftDiscards);
+    return join(left, key, right);
+}
+
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::intersect(Piece mine, Piece theirs, Discards& discards, size_t threads)
+{
+    if (mine.m_root == m_nil || theirs.m_root == m_nil)
+    {
+        discardTree(mine.m_root, discards);
+        discardTree(theirs.m_root, discards);
+        return emptyPiece();
     }
 
-    if (yOriginalColor == Node::BLACK)
-        eraseFixup(x);
-    
-    delete z;
-    m_size--;
+    bool exposeMine = mine.m_blackHeight < theirs.m_blackHeight;
+    Piece exposed = exposeMine ? mine : theirs;
+    Node* key = exposed.m_root;
+    Piece exposedLeft = childPiece(key->m_left, exposed);
+    Piece exposedRight = childPiece(key->m_right, exposed);
+
+    Split parts;
+    split(exposeMine ? theirs : mine, key->m_key, parts);
+
+    Piece myLeft = exposeMine ? exposedLeft : parts.m_left;
+    Piece myRight = exposeMine ? exposedRight : parts.m_right;
+    Piece theirLeft = exposeMine ? parts.m_left : exposedLeft;
+    Piece theirRight = exposeMine ? parts.m_right : exposedRight;
+
+    Piece left;
+    Piece right;
+    Discards leftDiscards = { NULL, NULL, 0 };
+
+    invoke(parallel(myLeft, theirLeft, threads),
+        [&]() { left = intersect(myLeft, theirLeft, leftDiscards, threads / 2); },
+        [&]() { right = intersect(myRight, theirRight, discards, threads - threads / 2); });
+
+    mergeDiscards(discards, leftDiscards);
+
+    if (parts.m_found == NULL)
+    {
+        discard(key, discards);
+        return concat(left, right);
+    }
+
+    if (exposeMine)
+        discard(parts.m_found, discards);
+    else
+    {
+        discard(key, discards);
+        key = parts.m_found;
+    }
+
+    return join(left, key, right);
 }
 
-template <typename K>
-void
-TRbTree<K>::eraseFixup(Node* x)
+template <typename K, typename A, typename C>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::subtract(Piece mine, Piece theirs, Discards& discards, size_t threads)
 {
-    while (x != m_root && x->m_color == Node::BLACK)
+    if (mine.m_root == m_nil || theirs.m_root == m_nil)
     {
-        if (x == x->m_parent->m_left)
-        {
-            Node* w = x->m_parent->m_right;
+        discardTree(theirs.m_root, discards);
+        return mine;
+    }
 
-            if (w->m_color == Node::RED)
-            {
-                w->m_color = Node::BLACK;
-                x->m_parent->m_color = Node::RED;
-                leftRotate(x->m_parent);
-                w = x->m_parent->m_right;
-            }
+    bool exposeMine = mine.m_blackHeight < theirs.m_blackHeight;
+    Piece exposed = exposeMine ? mine : theirs;
+    Node* key = exposed.m_root;
+    Piece exposedLeft = childPiece(key->m_left, exposed);
+    Piece exposedRight = childPiece(key->m_right, exposed);
 
-            if (w->m_left->m_color == Node::BLACK && w->m_right->m_color == Node::BLACK)
-            {
-                w->m_color = Node::RED;
-                x = x->m_parent;
-            }
-            else
-            {
-                if (w->m_right->m_color == Node::BLACK)
-                {
-                    w->m_left->m_color = Node::BLACK;
-                    w->m_color = Node::RED;
-                    rightRotate(w);
-                    w = x->m_parent->m_right;
-                }
+    Split parts;
+    split(exposeMine ? theirs : mine, key->m_key, parts);
 
-                w->m_color = x->m_parent->m_color;
-                x->m_parent->m_color = Node::BLACK;
-                w->m_right->m_color = Node::BLACK;
-                leftRotate(x->m_parent);
-                x = m_root;
-            }
-        }
-        else
-        {
-            Node* w = x->m_parent->m_left;
+    Piece myLeft = exposeMine ? exposedLeft : parts.m_left;
+    Piece myRight = exposeMine ? exposedRight : parts.m_right;
+    Piece theirLeft = exposeMine ? parts.m_left : exposedLeft;
+    Piece theirRight = exposeMine ? parts.m_right : exposedRight;
 
-            if (w->m_color == Node::RED)
-            {
-                w->m_color = Node::BLACK;
-                x->m_parent->m_color = Node::RED;
-                rightRotate(x->m_parent);
-                w = x->m_parent->m_left;
-            }
+    Piece left;
+    Piece right;
+    Discards leftDiscards = { NULL, NULL, 0 };
 
-            if (w->m_right->m_color == Node::BLACK && w->m_left->m_color == Node::BLACK)
+    invoke(parallel(myLeft, theirLeft, threads),
+        [&]() { left = subtract(myLeft, theirLeft, leftDiscards, threads / 2); },
+        [&]() { right = subtract(myRight, theirRight, discards, threads - threads / 2); });
+
+    mergeDiscards(discards, leftDiscards);
+
+    // my key survives only if other does not have it
+    if (exposeMine && parts.m_found == NULL)
+        return join(left, key, right);
+
+    discard(key, discards);
+
+    if (parts.m_found != NULL)
+        discard(parts.m_found, discards);
+
+    return concat(left, right);
+}
+
+template <typename K, typename A, typename C>
+template <typename Pred>
+typename TRbTree<K, A, C>::Piece
+TRbTree<K, A, C>::filter(Piece piece, Pred& pred, Discards& discards, size_t threads)
+{
+    Node* node = piece.m_root;
+
+    if (node == m_nil)
+        return piece;
+
+    Piece children[2] = { childPiece(node->m_left, piece), childPiece(node->m_right, piece) };
+    Piece left;
+    Piece right;
+    Discards leftDiscards = { NULL, NULL, 0 };
+
+    invoke(parallel(children[0], children[1], threads),
+        [&]() { left = filter(children[0], pred, leftDiscards, threads / 2); },
+        [&]() { right = filter(children[1], pred, discards, threads - threads / 2); });
+
+    mergeDiscards(discards, leftDiscards);
+
+    if (pred(static_cast<const K&>(node->m_key)))
+        return join(left, node, right);
+
+    discard(node, discards);
+    return concat(left, right);
+}
+
+template <typename K, typename A, typename C>
+inline void
+TRbTree<K, A, C>::discard(Node* node, Discards& discards)
+{
+    node->m_parent = discards.m_head;
+    discards.m_head = node;
+
+    if (discards.m_tail == NULL)
+        discards.m_tail = node;
+
+    discards.m_count++;
+}
+
+// After a set operation or filter threw partway, its nodes are spread over
+// pieces on the unwound stack and no longer form a tree. Leave this a valid
+// empty tree instead; the blocks are still freed with it, but the keys in
+// them and the nodes of their own leak.
+//
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::forget(void)
+{
+    m_root = m_nil;
+    m_first = NULL;
+    m_last = NULL;
+    m_size = 0;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::discardTree(Node* node, Discards& discards)
+{
+    if (node == m_nil)
+        return;
+
+    discardTree(node->m_left, discards);
+    discardTree(node->m_right, discards);
+    discard(node, discards);
+}
+
+// Destroys a detached subtree in key order, which walks a bulk-loaded one
+// front to back, and returns how many nodes it had.
+//
+template <typename K, typename A, typename C>
+size_t
+TRbTree<K, A, C>::destroyTree(Node* node)
+{
+    if (node == m_nil)
+        return 0;
+
+    // the right child is needed only after the whole left subtree, so its
+    // cache miss can overlap that work
+    Node* right = node->m_right;
+    TRBTREE_PREFETCH(right);
+    size_t count = destroyTree(node->m_left);
+
+    destroyNode(node);
+    return count + 1 + destroyTree(right);
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTree<K, A, C>::mergeDiscards(Discards& into, Discards& from)
+{
+    if (from.m_head == NULL)
+        return;
+
+    from.m_tail->m_parent = into.m_head;
+    into.m_head = from.m_head;
+
+    if (into.m_tail == NULL)
+        into.m_tail = from.m_tail;
+
+    into.m_count += from.m_count;
+}
+
+template <typename K, typename A, typename C>
+size_t
+TRbTree<K, A, C>::threadBudget(void)
+{
+    size_t threads = std::thread::hardware_concurrency();
+    return (threads == 0) ? 1 : threads;
+}
+
+template <typename K, typename A, typename C>
+inline bool
+TRbTree<K, A, C>::parallel(const Piece& a, const Piece& b, size_t threads)
+{
+    return threads > 1 && a.m_blackHeight >= PARALLEL_BLACK_HEIGHT && b.m_blackHeight >= PARALLEL_BLACK_HEIGHT;
+}
+
+template <typename K, typename A, typename C>
+template <typename Left, typename Right>
+void
+TRbTree<K, A, C>::invoke(bool parallel, Left left, Right right)
+{
+    if (!parallel)
+    {
+        left();
+        right();
+        return;
+    }
+
+    // an exception must not end a thread, so the fork's is carried back here
+    std::exception_ptr failure;
+    std::thread thread;
+
+    try
+    {
+        thread = std::thread([&]() {
+            try
             {
-                w->m_color = Node::RED;
-                x = x->m_parent;
+                left();
             }
-            else
+            catch (...)
             {
-                if (w->m_left->m_color == Node::BLACK)
-                {
-                    w->m_right->m_color = Node::BLACK;
-                    w->m_color = Node::RED;
-                    leftRotate(w);
-                    w = x->m_parent->m_left;
-                }
-
-                w->m_color = x->m_parent->m_color;
-                x->m_parent->m_color = Node::BLACK;
-                w->m_left->m_color = Node::BLACK;
-                rightRotate(x->m_parent);
-                x = m_root;
+                failure = std::current_exception();
             }
-        }
+        });
+    }
+    catch (const std::system_error&)
+    {
+        // no thread to be had; the work is the same either way
+        left();
+        right();
+        return;
     }
 
-    x->m_color = Node::BLACK;
+    try
+    {
+        right();
+    }
+    catch (...)
+    {
+        thread.join();
+        throw;
+    }
+
+    thread.join();
+
+    if (failure)
+        std::rethrow_exception(failure);
 }
 
-template <typename K>
-size_t
-TRbTree<K>::maxDepth(void) const
+// TRbTreeBuilder
+//
+template <typename K, typename A, typename C>
+TRbTreeBuilder<K, A, C>::TRbTreeBuilder(Tree& tree, size_t capacity)
+    : m_tree(tree), m_nodes(NULL), m_capacity(capacity), m_count(0), m_finished(false)
 {
-    if (m_root == Node::NIL)
-        return 0;
+    m_tree.clear();
 
-    size_t depth = 1;
-    size_t leftDepth = maxDepth(m_root->m_left, depth);
-    size_t rightDepth = maxDepth(m_root->m_right, depth);
-    return (leftDepth > rightDepth) ? leftDepth : rightDepth;
+    if (m_capacity > 0)
+        m_nodes = m_tree.allocBlock(m_capacity);
 }
 
-template <typename K>
-size_t
-TRbTree<K>::maxDepth(Node* node, size_t depth) const
+template <typename K, typename A, typename C>
+void
+TRbTreeBuilder<K, A, C>::push_back(const K& key)
 {
-    if (node == Node::NIL)
-        return depth;
+    assert(!m_finished);
 
-    depth++;
-    size_t leftDepth = maxDepth(node->m_left, depth);
-    size_t rightDepth = maxDepth(node->m_right, depth);
-    return (leftDepth > rightDepth) ? leftDepth : rightDepth;
+    if (m_count > 0 && !m_tree.m_compare(m_nodes[m_count - 1].m_key, key))
+    {
+        assert(!m_tree.m_compare(key, m_nodes[m_count - 1].m_key));   // input must be sorted
+        m_nodes[m_count - 1].m_key = key;
+        return;
+    }
+
+    assert(m_count < m_capacity);
+
+    Node* node = new (m_nodes + m_count) Node(key);
+    node->m_pooled = true;
+    m_count++;
+}
+
+template <typename K, typename A, typename C>
+void
+TRbTreeBuilder<K, A, C>::finish(void)
+{
+    assert(!m_finished);
+    m_finished = true;
+
+    // slots left over by duplicate keys go to the free list
+    for (size_t i = m_count; i < m_capacity; i++)
+        m_tree.freeNode(m_nodes + i);
+
+    if (m_count == 0)
+        return;
+
+    // depth of the last, incomplete level: floor(log2(count + 1))
+    size_t redDepth = 0;
+
+    for (size_t n = m_count + 1; n > 1; n >>= 1)
+        redDepth++;
+
+    m_tree.m_root = m_tree.buildBalanced(m_nodes, m_count, m_tree.m_nil, 0, redDepth);
+    m_tree.m_first = m_nodes;
+    m_tree.m_last = m_nodes + m_count - 1;
+    m_tree.m_size = m_count;
 }
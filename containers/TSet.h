@@ -2,30 +2,122 @@
 Copyright 2016 Tom Kim
 Implementation of a set container backed by a red-black tree with an STL-like
 interface.
+
+Keys are ordered by the comparator C, a copy of the one the set was
+constructed from, if any. With a transparent comparator such as
+std::less<> the lookups also accept any type C compares with K, e.g. a
+TSet<std::string, std::less<> > can be searched by const char* without
+building a string.
+
+The backing tree is a template parameter, e.g. TSet<int, std::less<int>,
+TBTree<int> > for a B+ tree, or TSet<K, std::less<K>, TRbTree<K,
+TRbTreeOrderStatistics> > for rank and select. TBTree orders keys by operator<,
+so C must then be std::less.
 */
 #pragma once
 
 #include "TSet.h"
 
-template <typename K>
-class TSet : private TRbTree<K>
+template <typename K, typename C = std::less<K>, typename Tree = TRbTree<K, TRbTreeNoAugment, C> >
+class TSet : private Tree
 {
+    static_assert(TRbTreeOrdersBy<Tree, C, K>::VALUE, "TBTree orders keys by operator< and cannot use C");
+
 public:
 
-    typedef TRbTreeItr<K> iterator;
-    typedef TRbTreeConstItr<K> const_iterator;
+    typedef typename Tree::iterator iterator;
+    typedef typename Tree::const_iterator const_iterator;
+
+    TSet(void) { }
+    explicit TSet(const C& compare) : Tree(compare) { }
+
+    std::pair<iterator, bool> insert(const K& key) { return Tree::insert(key); }
+    std::pair<iterator, bool> insert(K&& key) { return Tree::insert(std::move(key)); }
+    iterator insert_hint(iterator hint, const K& key) { return Tree::insert_hint(hint, key); }
+    iterator insert_hint(iterator hint, K&& key) { return Tree::insert_hint(hint, std::move(key)); }
+    void erase(const K& key) { Tree::erase(key); }
+    void erase(const_iterator itr) { Tree::erase(itr); }
+    void clear(void) { Tree::clear(); }
+
+    // Erase the keys in [first, last), or those for which pred(key) is
+    // true, returning how many; see TRbTree.
+    //
+    void erase(const_iterator first, const_iterator last) { Tree::erase(first, last); }
+    template <typename Pred> size_t erase_if(Pred pred) { return Tree::erase_if(pred); }
+
+    // Copies clone the tree in O(n); moves and swap are O(1). See TRbTree.
+    //
+    void swap(TSet& other) { Tree::swap(static_cast<Tree&>(other)); }
+
+    // Replace the contents in O(n) from a forward range sorted by C, or from
+    // any input range in any order by sorting a copy first.
+    //
+    template <typename ForwardItr> void assign_sorted(ForwardItr first, ForwardItr last) { Tree::assign_sorted(first, last); }
+    template <typename InputItr> void assign_unsorted(InputItr first, InputItr last) { Tree::assign_unsorted(first, last); }
+
+    iterator find(const K& key) { return iterator(Tree::find(key)); }
+    iterator lower_bound(const K& key) { return Tree::lower_bound(key); }
+    iterator upper_bound(const K& key) { return Tree::upper_bound(key); }
+    std::pair<iterator, iterator> equal_range(const K& key) { return Tree::equal_range(key); }
+    iterator begin(void) { return iterator(Tree::begin()); }
+    iterator end(void) { return iterator(Tree::end()); }
+    iterator last(void) { return iterator(Tree::last()); }
+
+    const_iterator find(const K& key) const { return const_iterator(Tree::find(key)); }
+    const_iterator lower_bound(const K& key) const { return Tree::lower_bound(key); }
+    const_iterator upper_bound(const K& key) const { return Tree::upper_bound(key); }
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const { return Tree::equal_range(key); }
+    const_iterator begin(void) const { return const_iterator(Tree::begin()); }
+    const_iterator end(void) const { return const_iterator(Tree::end()); }
+    const_iterator last(void) const { return const_iterator(Tree::last()); }
+
+    // Heterogeneous lookups, available when C is transparent.
+    //
+    template <typename Q> iterator find(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return Tree::find(key); }
+    template <typename Q> iterator lower_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return Tree::lower_bound(key); }
+    template <typename Q> iterator upper_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return Tree::upper_bound(key); }
+    template <typename Q> std::pair<iterator, iterator> equal_range(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) { return Tree::equal_range(key); }
+
+    template <typename Q> const_iterator find(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return Tree::find(key); }
+    template <typename Q> const_iterator lower_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return Tree::lower_bound(key); }
+    template <typename Q> const_iterator upper_bound(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return Tree::upper_bound(key); }
+    template <typename Q> std::pair<const_iterator, const_iterator> equal_range(const Q& key, typename TRbTreeTransparent<C, Q>::Type* = NULL) const { return Tree::equal_range(key); }
+
+    // Find keys[i] into out[i] for every i < n, end() where it is absent,
+    // overlapping the cache misses of neighbouring lookups. See TRbTree.
+    //
+    void find_batch(const K* keys, size_t n, iterator* out) { Tree::find_batch(keys, n, out); }
+    void find_batch(const K* keys, size_t n, const_iterator* out) const { Tree::find_batch(keys, n, out); }
+
+    // Order statistics, available with TSet<K, C, TRbTree<K, TRbTreeOrderStatistics, C> >.
+    //
+    size_t rank(const K& key) const { return Tree::rank(key); }
+    iterator select(size_t k) { return Tree::select(k); }
+    const_iterator select(size_t k) const { return Tree::select(k); }
+    size_t count_range(const K& lo, const K& hi) const { return Tree::count_range(lo, hi); }
+
+    // Call func(key) for every key in [lo, hi) in order, in O(log n + k).
+    //
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func) { Tree::for_each_in_range(lo, hi, func); }
+    template <typename Func> void for_each_in_range(const K& lo, const K& hi, Func func) const { Tree::for_each_in_range(lo, hi, func); }
 
-    void insert(const K& key) { TRbTree::insert(key); }
-    void erase(const K& key) { TRbTree::erase(key); }
-    void erase(const_iterator itr) { TRbTree::erase(itr); }
+    // Set operations that take over the nodes of other and leave it empty;
+    // see TRbTree. filter keeps the keys for which pred(key) is true.
+    //
+    void set_union(TSet& other) { Tree::set_union(static_cast<Tree&>(other)); }
+    void set_intersection(TSet& other) { Tree::set_intersection(static_cast<Tree&>(other)); }
+    void set_difference(TSet& other) { Tree::set_difference(static_cast<Tree&>(other)); }
+    template <typename Pred> void filter(Pred pred) { Tree::filter(pred); }
 
-    iterator find(const K& key) { return iterator(TRbTree::find(key)); }
-    iterator begin(void) { return iterator(TRbTree::begin()); }
-    iterator end(void) { return iterator(TRbTree::end()); }
-    iterator last(void) { return iterator(TRbTree::last()); }
+    // join appends other, whose keys must all be greater; split moves the
+    // keys not less than key into the empty right.
+    //
+    void join(TSet& other) { Tree::join(static_cast<Tree&>(other)); }
+    void split(const K& key, TSet& right) { Tree::split(key, static_cast<Tree&>(right)); }
 
-    const_iterator find(const K& key) const { return const_iterator(TRbTree::find(Pair(key))); }
-    const_iterator begin(void) const { return const_iterator(TRbTree::begin()); }
-    const_iterator end(void) const { return const_iterator(TRbTree::end()); }
-    const_iterator last(void) const { return const_iterator(TRbTree::last()); }
+    // Move the nodes into one block in key order, all at once or in slices
+    // of up to count nodes; see TRbTree.
+    //
+    void compact(void) { Tree::compact(); }
+    bool compact_step(size_t count) { return Tree::compact_step(count); }
 };
@@ -0,0 +1,682 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a binary snapshot format for TMap and TSet with trivially
+copyable keys and values.
+
+A snapshot is a 64-byte header followed by the entries as a sorted array of
+fixed-size records, TSnapshotPair<K, V> for a map and K for a set. The header
+holds a version, the record and key sizes, the count and a checksum of the
+records, all in the byte order of the machine that wrote it, so a snapshot
+is only meant to be read back on the same platform.
+
+Because the records are already sorted, a snapshot can be used in place:
+TSnapshotView maps the file read-only and searches it directly, and loading
+it into a map or set builds the tree in O(n) with no descents or rebalancing,
+only one comparison of each record with the one before to drop duplicates.
+Writing streams entries through a large buffer and TSnapshotReader streams
+them back, so neither needs memory for more than the buffer; a view relies on
+the page cache and also works for snapshots larger than RAM.
+
+Example:
+
+    TSnapshot::save(orders, "orders.snap");
+
+    TMap<int, Order> restored;
+    if (!TSnapshot::load(restored, "orders.snap"))
+        ...
+
+    TSnapshotView<TSnapshotPair<int, Order> > view;
+    if (view.open("orders.snap"))
+    {
+        const TSnapshotPair<int, Order>* order = view.find(id);
+        ...
+    }
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <type_traits>
+#include <vector>
+#include "TRbTree.h"
+#include "TMap.h"
+#include "TSet.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The record of a map entry. Unlike TMapPair it is trivially copyable, so an
+// array of them can be written and mapped as is. Both constructors zero the
+// whole record first, so the padding between and after the members is
+// written as zeros rather than stack garbage; padding inside K or V is
+// copied as the caller left it.
+//
+template <typename K, typename V>
+class TSnapshotPair
+{
+public:
+
+    TSnapshotPair(void) { memset(this, 0, sizeof(*this)); }
+    TSnapshotPair(const K& key, const V& value);
+
+    K first;
+    V second;
+};
+
+// The key of a record: the record itself for a set, first for a map.
+//
+template <typename R>
+class TSnapshotKeyOf
+{
+public:
+
+    typedef R Key;
+
+    static const Key& key(const R& record) { return record; }
+};
+
+template <typename K, typename V>
+class TSnapshotKeyOf<TSnapshotPair<K, V> >
+{
+public:
+
+    typedef K Key;
+
+    static const Key& key(const TSnapshotPair<K, V>& record) { return record.first; }
+};
+
+class TSnapshotHeader
+{
+public:
+
+    enum { MAGIC = 0x504e5354, VERSION = 1 };   // "TSNP" in little-endian
+
+    TSnapshotHeader(void) { memset(this, 0, sizeof(*this)); }
+
+    // Whether the header describes count records of R in a file of size
+    // bytes; a snapshot whose writer did not finish has no magic.
+    //
+    template <typename R> bool valid(uint64_t size) const;
+
+    // Folds size bytes into the checksum h, eight at a time. Records are
+    // hashed one by one, starting from SEED.
+    //
+    static const uint64_t SEED = 0xcbf29ce484222325ull;
+    static uint64_t hash(uint64_t h, const void* data, size_t size);
+
+    uint32_t m_magic;
+    uint32_t m_version;
+    uint32_t m_recordSize;
+    uint32_t m_keySize;
+    uint64_t m_count;
+    uint64_t m_checksum;
+    char m_reserved[32];    // records start at 64 bytes, aligned for any key
+};
+
+// Writes a snapshot from records pushed in ascending key order. The header
+// is written last, so a snapshot cut short by a crash is never valid.
+//
+// Example:
+//
+//     TSnapshotWriter<TSnapshotPair<int, Order> > writer;
+//     writer.open("orders.snap");
+//     writer.push_back(TSnapshotPair<int, Order>(id, order));
+//     ...
+//     if (!writer.finish())
+//         ...
+//
+template <typename R>
+class TSnapshotWriter
+{
+public:
+
+    enum { BUFFER_BYTES = 1 << 20 };
+
+    TSnapshotWriter(void) : m_file(NULL), m_count(0), m_checksum(TSnapshotHeader::SEED), m_failed(false) { }
+    ~TSnapshotWriter(void) { if (m_file != NULL) fclose(m_file); }
+
+    bool open(const char* path);
+    void push_back(const R& record);
+
+    // Flush the records, write the header and sync the file to disk; returns
+    // false if any write failed.
+    //
+    bool finish(void);
+
+private:
+
+    TSnapshotWriter(const TSnapshotWriter&);
+    TSnapshotWriter& operator=(const TSnapshotWriter&);
+
+    void flush(void);
+
+    FILE* m_file;
+    std::vector<char> m_buffer;
+    uint64_t m_count;
+    uint64_t m_checksum;
+    bool m_failed;
+};
+
+// Reads the records of a snapshot front to back through a fixed buffer.
+// The checksum is known to match only once next has returned false and
+// verified returns true.
+//
+template <typename R>
+class TSnapshotReader
+{
+public:
+
+    enum { BUFFER_BYTES = 1 << 20 };
+
+    TSnapshotReader(void) : m_file(NULL), m_remaining(0), m_pos(0), m_end(0), m_checksum(TSnapshotHeader::SEED), m_failed(false) { }
+    ~TSnapshotReader(void) { if (m_file != NULL) fclose(m_file); }
+
+    bool open(const char* path);
+    bool next(R& record);
+    bool verified(void) const { return !m_failed && m_remaining == 0 && m_checksum == m_header.m_checksum; }
+    size_t size(void) const { return static_cast<size_t>(m_header.m_count); }
+
+private:
+
+    TSnapshotReader(const TSnapshotReader&);
+    TSnapshotReader& operator=(const TSnapshotReader&);
+
+    FILE* m_file;
+    TSnapshotHeader m_header;
+    std::vector<char> m_buffer;
+    uint64_t m_remaining;   // records not yet returned
+    size_t m_pos;
+    size_t m_end;
+    uint64_t m_checksum;
+    bool m_failed;
+};
+
+// A snapshot mapped read-only into memory as a sorted array of records.
+// Pages are read on first touch, so opening is O(1) without verification;
+// with it, open reads the whole file once to check the checksum.
+//
+template <typename R, typename C = std::less<typename TSnapshotKeyOf<R>::Key> >
+class TSnapshotView
+{
+public:
+
+    typedef typename TSnapshotKeyOf<R>::Key Key;
+
+    TSnapshotView(void);
+    ~TSnapshotView(void) { close(); }
+
+    bool open(const char* path, bool verify = true);
+    void close(void);
+
+    const R* begin(void) const { return m_records; }
+    const R* end(void) const { return m_records + m_count; }
+    size_t size(void) const { return m_count; }
+
+    // NULL if key is absent
+    const R* find(const Key& key) const;
+    const R* lower_bound(const Key& key) const;
+    const R* upper_bound(const Key& key) const;
+
+private:
+
+    TSnapshotView(const TSnapshotView&);
+    TSnapshotView& operator=(const TSnapshotView&);
+
+    // order records against bare keys, in the argument order std::lower_bound
+    // and std::upper_bound use; for a set R and Key are the same type, so
+    // one class cannot take both orders
+    class RecordLess
+    {
+    public:
+
+        bool operator()(const R& record, const Key& key) const { return m_compare(TSnapshotKeyOf<R>::key(record), key); }
+
+        C m_compare;
+    };
+
+    class KeyLess
+    {
+    public:
+
+        bool operator()(const Key& key, const R& record) const { return m_compare(key, TSnapshotKeyOf<R>::key(record)); }
+
+        C m_compare;
+    };
+
+    const char* m_data;
+    size_t m_bytes;
+    const R* m_records;
+    size_t m_count;
+
+#if defined(_WIN32)
+    HANDLE m_file;
+    HANDLE m_mapping;
+#endif
+};
+
+// Saving and loading whole maps and sets.
+//
+class TSnapshot
+{
+public:
+
+    template <typename K, typename V, typename C, typename Tree> static bool save(const TMap<K, V, C, Tree>& map, const char* path);
+    template <typename K, typename C, typename Tree> static bool save(const TSet<K, C, Tree>& set, const char* path);
+
+    // Replace the contents with a snapshot in O(n). The snapshot is mapped
+    // and verified, and the tree built straight from the mapping. On failure
+    // the container is left unchanged.
+    //
+    template <typename K, typename V, typename C, typename Tree> static bool load(TMap<K, V, C, Tree>& map, const char* path);
+    template <typename K, typename C, typename Tree> static bool load(TSet<K, C, Tree>& set, const char* path);
+};
+
+// TSnapshotPair
+//
+template <typename K, typename V>
+TSnapshotPair<K, V>::TSnapshotPair(const K& key, const V& value)
+{
+    memset(this, 0, sizeof(*this));
+    memcpy(&first, &key, sizeof(K));
+    memcpy(&second, &value, sizeof(V));
+}
+
+// TSnapshotHeader
+//
+template <typename R>
+bool
+TSnapshotHeader::valid(uint64_t size) const
+{
+    return m_magic == MAGIC && m_version == VERSION && m_recordSize == sizeof(R) && m_keySize == sizeof(typename TSnapshotKeyOf<R>::Key)
+        && size >= sizeof(TSnapshotHeader) && (size - sizeof(TSnapshotHeader)) / sizeof(R) == m_count && (size - sizeof(TSnapshotHeader)) % sizeof(R) == 0;
+}
+
+inline uint64_t
+TSnapshotHeader::hash(uint64_t h, const void* data, size_t size)
+{
+    // FNV-1a over 64-bit words instead of bytes, with a final shift to
+    // bring the high bits of each product back down
+    const uint64_t PRIME = 0x100000001b3ull;
+    const char* bytes = static_cast<const char*>(data);
+
+    for (; size >= 8; bytes += 8, size -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        h = (h ^ word) * PRIME;
+        h ^= h >> 32;
+    }
+
+    for (; size > 0; bytes++, size--)
+        h = (h ^ static_cast<unsigned char>(*bytes)) * PRIME;
+
+    return h;
+}
+
+// TSnapshotWriter
+//
+template <typename R>
+bool
+TSnapshotWriter<R>::open(const char* path)
+{
+    static_assert(std::is_trivially_copyable<R>::value, "snapshot records must be trivially copyable");
+    assert(m_file == NULL);
+
+#if defined(_WIN32)
+    if (fopen_s(&m_file, path, "wb") != 0)
+        m_file = NULL;
+#else
+    m_file = fopen(path, "wb");
+#endif
+
+    if (m_file == NULL)
+        return false;
+
+    // the buffer below is the only one
+    setvbuf(m_file, NULL, _IONBF, 0);
+
+    m_buffer.reserve(BUFFER_BYTES);
+    m_count = 0;
+    m_checksum = TSnapshotHeader::SEED;
+    m_failed = false;
+
+    // a placeholder without magic until finish
+    TSnapshotHeader header;
+    m_buffer.insert(m_buffer.end(), reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header + 1));
+    return true;
+}
+
+template <typename R>
+void
+TSnapshotWriter<R>::push_back(const R& record)
+{
+    assert(m_file != NULL);
+
+    if (m_buffer.size() + sizeof(R) > BUFFER_BYTES)
+        flush();
+
+    const char* bytes = reinterpret_cast<const char*>(&record);
+    m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(R));
+    m_checksum = TSnapshotHeader::hash(m_checksum, bytes, sizeof(R));
+    m_count++;
+}
+
+template <typename R>
+bool
+TSnapshotWriter<R>::finish(void)
+{
+    assert(m_file != NULL);
+
+    flush();
+
+    TSnapshotHeader header;
+    header.m_magic = TSnapshotHeader::MAGIC;
+    header.m_version = TSnapshotHeader::VERSION;
+    header.m_recordSize = sizeof(R);
+    header.m_keySize = sizeof(typename TSnapshotKeyOf<R>::Key);
+    header.m_count = m_count;
+    header.m_checksum = m_checksum;
+
+    if (fseek(m_file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, m_file) != 1 || fflush(m_file) != 0)
+        m_failed = true;
+
+#if defined(_WIN32)
+    if (_commit(_fileno(m_file)) != 0)
+        m_failed = true;
+#else
+    if (fsync(fileno(m_file)) != 0)
+        m_failed = true;
+#endif
+
+    if (fclose(m_file) != 0)
+        m_failed = true;
+
+    m_file = NULL;
+    return !m_failed;
+}
+
+template <typename R>
+void
+TSnapshotWriter<R>::flush(void)
+{
+    if (!m_buffer.empty() && fwrite(&m_buffer[0], m_buffer.size(), 1, m_file) != 1)
+        m_failed = true;
+
+    m_buffer.clear();
+}
+
+// TSnapshotReader
+//
+template <typename R>
+bool
+TSnapshotReader<R>::open(const char* path)
+{
+    static_assert(std::is_trivially_copyable<R>::value, "snapshot records must be trivially copyable");
+    assert(m_file == NULL);
+
+#if defined(_WIN32)
+    if (fopen_s(&m_file, path, "rb") != 0)
+        m_file = NULL;
+#else
+    m_file = fopen(path, "rb");
+#endif
+
+    if (m_file == NULL)
+        return false;
+
+    setvbuf(m_file, NULL, _IONBF, 0);
+
+    // the count in the header is checked against the records actually
+    // read, as next goes
+    if (fread(&m_header, sizeof(m_header), 1, m_file) != 1 || m_header.m_magic != TSnapshotHeader::MAGIC || m_header.m_version != TSnapshotHeader::VERSION
+        || m_header.m_recordSize != sizeof(R) || m_header.m_keySize != sizeof(typename TSnapshotKeyOf<R>::Key))
+    {
+        fclose(m_file);
+        m_file = NULL;
+        return false;
+    }
+
+    m_buffer.resize(BUFFER_BYTES / sizeof(R) * sizeof(R) + sizeof(R));
+    m_remaining = m_header.m_count;
+    m_pos = 0;
+    m_end = 0;
+    m_checksum = TSnapshotHeader::SEED;
+    m_failed = false;
+    return true;
+}
+
+template <typename R>
+bool
+TSnapshotReader<R>::next(R& record)
+{
+    if (m_remaining == 0 || m_failed)
+        return false;
+
+    if (m_pos == m_end)
+    {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(m_remaining, m_buffer.size() / sizeof(R)));
+        size_t got = fread(&m_buffer[0], sizeof(R), want, m_file);
+
+        if (got == 0)
+        {
+            m_failed = true;
+            return false;
+        }
+
+        m_pos = 0;
+        m_end = got * sizeof(R);
+    }
+
+    const char* bytes = &m_buffer[m_pos];
+    memcpy(&record, bytes, sizeof(R));
+    m_checksum = TSnapshotHeader::hash(m_checksum, bytes, sizeof(R));
+    m_pos += sizeof(R);
+    m_remaining--;
+    return true;
+}
+
+// TSnapshotView
+//
+template <typename R, typename C>
+TSnapshotView<R, C>::TSnapshotView(void)
+    : m_data(NULL), m_bytes(0), m_records(NULL), m_count(0)
+{
+#if defined(_WIN32)
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#endif
+}
+
+template <typename R, typename C>
+bool
+TSnapshotView<R, C>::open(const char* path, bool verify)
+{
+    static_assert(std::is_trivially_copyable<R>::value, "snapshot records must be trivially copyable");
+    close();
+
+#if defined(_WIN32)
+    m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(m_file, &size) || static_cast<uint64_t>(size.QuadPart) < sizeof(TSnapshotHeader)
+        || (m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL
+        || (m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0))) == NULL)
+    {
+        close();
+        return false;
+    }
+
+    m_bytes = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(path, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+
+    if (fstat(fd, &status) != 0 || static_cast<uint64_t>(status.st_size) < sizeof(TSnapshotHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = static_cast<const char*>(data);
+    m_bytes = static_cast<size_t>(status.st_size);
+#endif
+
+    const TSnapshotHeader* header = reinterpret_cast<const TSnapshotHeader*>(m_data);
+
+    if (!header->template valid<R>(m_bytes))
+    {
+        close();
+        return false;
+    }
+
+    m_records = reinterpret_cast<const R*>(m_data + sizeof(TSnapshotHeader));
+    m_count = static_cast<size_t>(header->m_count);
+
+    if (verify)
+    {
+        uint64_t checksum = TSnapshotHeader::SEED;
+
+        for (size_t i = 0; i < m_count; i++)
+            checksum = TSnapshotHeader::hash(checksum, m_records + i, sizeof(R));
+
+        if (checksum != header->m_checksum)
+        {
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename R, typename C>
+void
+TSnapshotView<R, C>::close(void)
+{
+#if defined(_WIN32)
+    if (m_data != NULL)
+        UnmapViewOfFile(m_data);
+
+    if (m_mapping != NULL)
+        CloseHandle(m_mapping);
+
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#else
+    if (m_data != NULL)
+        munmap(const_cast<char*>(m_data), m_bytes);
+#endif
+
+    m_data = NULL;
+    m_bytes = 0;
+    m_records = NULL;
+    m_count = 0;
+}
+
+template <typename R, typename C>
+const R*
+TSnapshotView<R, C>::find(const Key& key) const
+{
+    const R* record = lower_bound(key);
+    return (record == end() || KeyLess()(key, *record)) ? NULL : record;
+}
+
+template <typename R, typename C>
+const R*
+TSnapshotView<R, C>::lower_bound(const Key& key) const
+{
+    return std::lower_bound(begin(), end(), key, RecordLess());
+}
+
+template <typename R, typename C>
+const R*
+TSnapshotView<R, C>::upper_bound(const Key& key) const
+{
+    return std::upper_bound(begin(), end(), key, KeyLess());
+}
+
+// TSnapshot
+//
+template <typename K, typename V, typename C, typename Tree>
+bool
+TSnapshot::save(const TMap<K, V, C, Tree>& map, const char* path)
+{
+    TSnapshotWriter<TSnapshotPair<K, V> > writer;
+
+    if (!writer.open(path))
+        return false;
+
+    for (typename TMap<K, V, C, Tree>::const_iterator itr = map.begin(); itr != map.end(); ++itr)
+        writer.push_back(TSnapshotPair<K, V>(itr->first, *itr));
+
+    return writer.finish();
+}
+
+template <typename K, typename C, typename Tree>
+bool
+TSnapshot::save(const TSet<K, C, Tree>& set, const char* path)
+{
+    TSnapshotWriter<K> writer;
+
+    if (!writer.open(path))
+        return false;
+
+    for (typename TSet<K, C, Tree>::const_iterator itr = set.begin(); itr != set.end(); ++itr)
+        writer.push_back(*itr);
+
+    return writer.finish();
+}
+
+template <typename K, typename V, typename C, typename Tree>
+bool
+TSnapshot::load(TMap<K, V, C, Tree>& map, const char* path)
+{
+    TSnapshotView<TSnapshotPair<K, V>, C> view;
+
+    if (!view.open(path))
+        return false;
+
+    map.assign_sorted(view.begin(), view.end());
+    return true;
+}
+
+template <typename K, typename C, typename Tree>
+bool
+TSnapshot::load(TSet<K, C, Tree>& set, const char* path)
+{
+    TSnapshotView<K, C> view;
+
+    if (!view.open(path))
+        return false;
+
+    set.assign_sorted(view.begin(), view.end());
+    return true;
+}
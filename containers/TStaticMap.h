@@ -0,0 +1,274 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of a read-only map over a key set fixed at compile time.
+
+The constructor builds a minimal perfect hash over the N keys, and it can run
+in a constant expression. Keys are hashed once into N buckets. Buckets with
+more than one key are placed largest first, each with the first seed that
+sends all its keys to free slots. The keys left alone in a bucket then take
+the remaining slots directly, so the build stays close to O(n). A lookup reads
+the seed of its bucket and then the one slot the key can be in: two probes,
+no allocation and no tree descent.
+
+Keys are hashed and compared by H. TStaticMapHash handles integers, enums and
+C strings (const char*, compared by content); other key types specialize it.
+Iteration visits the entries in slot order, not key order.
+
+Needs C++14 constexpr for constant initialization.
+
+Example:
+
+    constexpr TStaticMap<const char*, int, 3> methods({ { "GET", 0 }, { "PUT", 1 }, { "POST", 2 } });
+
+    TStaticMap<const char*, int, 3>::const_iterator itr = methods.find(name.c_str());
+    if (itr != methods.end())
+        return *itr;
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdexcept>
+
+template <typename K>
+class TStaticMapHash
+{
+public:
+
+    static constexpr uint64_t hash(const K& key) { return static_cast<uint64_t>(key); }
+    static constexpr bool equal(const K& a, const K& b) { return a == b; }
+};
+
+template <>
+class TStaticMapHash<const char*>
+{
+public:
+
+    // FNV-1a
+    static constexpr uint64_t hash(const char* key)
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        for (; *key != '\0'; key++)
+            h = (h ^ static_cast<unsigned char>(*key)) * 0x100000001b3ull;
+
+        return h;
+    }
+
+    static constexpr bool equal(const char* a, const char* b)
+    {
+        for (; *a == *b; a++, b++)
+        {
+            if (*a == '\0')
+                return true;
+        }
+
+        return false;
+    }
+};
+
+template <typename K, typename V>
+class TStaticMapPair
+{
+public:
+
+    constexpr TStaticMapPair(void) : first(), second() { }
+    constexpr TStaticMapPair(const K& key, const V& value) : first(key), second(value) { }
+
+    K first;
+    V second;
+};
+
+template <typename K, typename V>
+class TStaticMapConstItr
+{
+    typedef TStaticMapPair<K, V> Pair;
+    template <typename K, typename V, size_t N, typename H> friend class TStaticMap;
+
+public:
+
+    constexpr bool operator==(const TStaticMapConstItr& other) const { return m_pair == other.m_pair; }
+    constexpr bool operator!=(const TStaticMapConstItr& other) const { return m_pair != other.m_pair; }
+    TStaticMapConstItr& operator++(void) { ++m_pair; return *this; }
+    TStaticMapConstItr& operator--(void) { --m_pair; return *this; }
+    constexpr const V& operator*(void) const { return m_pair->second; }
+    constexpr const Pair* operator->(void) const { return m_pair; }
+
+private:
+
+    constexpr TStaticMapConstItr(const Pair* pair) : m_pair(pair) { }
+
+    const Pair* m_pair;
+};
+
+template <typename K, typename V, size_t N, typename H = TStaticMapHash<K> >
+class TStaticMap
+{
+    typedef TStaticMapPair<K, V> Pair;
+
+    static_assert(N > 0, "a static map needs at least one key");
+    static_assert(N < 0x80000000u, "slots must fit below the direct flag of a seed");
+
+public:
+
+    typedef TStaticMapConstItr<K, V> const_iterator;
+    typedef const_iterator iterator;
+
+    // Build the map from exactly N pairs with distinct keys. Two equal keys,
+    // or two keys whose 64-bit hashes by H are equal, cannot be told apart
+    // and throw std::invalid_argument, which in a constant expression fails
+    // the compile instead.
+    //
+    constexpr TStaticMap(const Pair (&pairs)[N]);
+
+    constexpr const_iterator find(const K& key) const { return const_iterator(findPair(key)); }
+    constexpr const_iterator begin(void) const { return const_iterator(m_pairs); }
+    constexpr const_iterator end(void) const { return const_iterator(m_pairs + N); }
+    constexpr size_t size(void) const { return N; }
+
+private:
+
+    // a seed with this bit set holds the slot of its bucket's single key
+    enum : uint32_t { DIRECT = 0x80000000u };
+
+    static constexpr uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static constexpr size_t bucketOf(uint64_t h) { return static_cast<size_t>(mix(h) % N); }
+    static constexpr size_t slotOf(uint64_t h, uint32_t seed) { return static_cast<size_t>(mix(h ^ (seed * 0x9e3779b97f4a7c15ull)) % N); }
+
+    constexpr const Pair* findPair(const K& key) const;
+
+    Pair m_pairs[N];
+    uint32_t m_seeds[N];
+};
+
+// TStaticMap
+//
+template <typename K, typename V, size_t N, typename H>
+constexpr
+TStaticMap<K, V, N, H>::TStaticMap(const Pair (&pairs)[N]) : m_pairs(), m_seeds()
+{
+    uint64_t hashes[N] = {};
+    size_t counts[N] = {};
+    size_t maxCount = 0;
+
+    for (size_t i = 0; i < N; i++)
+    {
+        hashes[i] = H::hash(pairs[i].first);
+        size_t count = ++counts[bucketOf(hashes[i])];
+
+        if (maxCount < count)
+            maxCount = count;
+    }
+
+    // group the keys by bucket: bucket b owns order[starts[b]] up to
+    // order[starts[b] + counts[b]]
+    size_t starts[N] = {};
+    size_t order[N] = {};
+    size_t next[N] = {};
+
+    for (size_t b = 1; b < N; b++)
+        starts[b] = starts[b - 1] + counts[b - 1];
+
+    for (size_t i = 0; i < N; i++)
+    {
+        size_t b = bucketOf(hashes[i]);
+        order[starts[b] + next[b]++] = i;
+    }
+
+    bool taken[N] = {};
+    size_t slots[N] = {};
+
+    for (size_t count = maxCount; count > 1; count--)
+    {
+        for (size_t b = 0; b < N; b++)
+        {
+            if (counts[b] != count)
+                continue;
+
+            const size_t* keys = order + starts[b];
+
+            // equal hashes share a bucket, and no seed could part them
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t j = 0; j < i; j++)
+                {
+                    if (H::equal(pairs[keys[i]].first, pairs[keys[j]].first))
+                        throw std::invalid_argument("TStaticMap: duplicate key");
+
+                    if (hashes[keys[i]] == hashes[keys[j]])
+                        throw std::invalid_argument("TStaticMap: two keys with the same hash");
+                }
+            }
+
+            for (uint32_t seed = 0; ; seed++)
+            {
+                // a seed must stay clear of the DIRECT flag
+                if (seed == DIRECT)
+                    throw std::invalid_argument("TStaticMap: no seed places a bucket");
+
+                size_t placed = 0;
+
+                for (; placed < count; placed++)
+                {
+                    size_t slot = slotOf(hashes[keys[placed]], seed);
+                    bool open = !taken[slot];
+
+                    for (size_t j = 0; j < placed && open; j++)
+                        open = slots[j] != slot;
+
+                    if (!open)
+                        break;
+
+                    slots[placed] = slot;
+                }
+
+                if (placed == count)
+                {
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        taken[slots[i]] = true;
+                        m_pairs[slots[i]] = pairs[keys[i]];
+                    }
+
+                    m_seeds[b] = seed;
+                    break;
+                }
+            }
+        }
+    }
+
+    size_t slot = 0;
+
+    for (size_t b = 0; b < N; b++)
+    {
+        if (counts[b] != 1)
+            continue;
+
+        while (taken[slot])
+            slot++;
+
+        taken[slot] = true;
+        m_pairs[slot] = pairs[order[starts[b]]];
+        m_seeds[b] = static_cast<uint32_t>(DIRECT | slot);
+    }
+}
+
+template <typename K, typename V, size_t N, typename H>
+constexpr const typename TStaticMap<K, V, N, H>::Pair*
+TStaticMap<K, V, N, H>::findPair(const K& key) const
+{
+    uint64_t h = H::hash(key);
+    uint32_t seed = m_seeds[bucketOf(h)];
+    size_t slot = (seed & DIRECT) ? (seed & ~DIRECT) : slotOf(h, seed);
+
+    return H::equal(m_pairs[slot].first, key) ? m_pairs + slot : m_pairs + N;
+}
@@ -0,0 +1,223 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of an unordered map container that stores key-value pairs in
+a THashTable, with the interface of TMap minus the ordered operations.
+
+Lookups, inserts and erases take O(1) expected time, and the pairs sit in one
+flat array rather than in a node each, so a lookup is usually one probe of 16
+control bytes and one key comparison. Iteration visits the pairs in slot
+order. Unlike TMap, an insert that grows the table moves every pair, which
+invalidates all iterators and pair references; see THashTable.
+
+Keys are hashed with H and compared with E. With THashTableHash and
+THashTableEqual, maps keyed by std::string can be searched by const char*
+without building a string; any H and E that both define is_transparent allow
+heterogeneous lookups the same way.
+
+Example:
+
+    TUnorderedMap<std::string, Session> sessions;
+    sessions.insert(token, session);
+
+    TUnorderedMap<std::string, Session>::iterator itr = sessions.find(token);
+    if (itr != sessions.end())
+        itr->second.touch();
+
+    sessions.erase(token);
+*/
+#pragma once
+
+#include "THashTable.h"
+
+// Selects the TUnorderedMapPair constructor that builds the value in place.
+//
+class TUnorderedMapEmplace
+{
+};
+
+template <typename K, typename V>
+class TUnorderedMapPair
+{
+public:
+
+    TUnorderedMapPair(const TUnorderedMapPair& other) : first(other.first), second(other.second) { }
+    TUnorderedMapPair(TUnorderedMapPair&& other) : first(std::move(other.first)), second(std::move(other.second)) { }
+
+    template <typename KeyArg, typename... Args>
+    TUnorderedMapPair(TUnorderedMapEmplace, KeyArg&& key, Args&&... args) : first(std::forward<KeyArg>(key)), second(std::forward<Args>(args)...) { }
+
+    // first must not be changed while the pair is in a map
+    K first;
+    V second;
+};
+
+template <typename K, typename V>
+class THashTableKeyOf<TUnorderedMapPair<K, V> >
+{
+public:
+
+    typedef K Key;
+
+    static const Key& key(const TUnorderedMapPair<K, V>& pair) { return pair.first; }
+};
+
+template <typename K, typename V, typename H = THashTableHash<K>, typename E = THashTableEqual<K> > class TUnorderedMap;
+template <typename K, typename V> class TUnorderedMapConstItr;
+
+template <typename K, typename V>
+class TUnorderedMapItr
+{
+    typedef TUnorderedMapPair<K, V> Pair;
+    typedef THashTableItr<Pair> BaseItr;
+    template <typename K, typename V, typename H, typename E> friend class TUnorderedMap;
+    template <typename K, typename V> friend class TUnorderedMapConstItr;
+
+public:
+
+    TUnorderedMapItr(void) { }
+    TUnorderedMapItr(const TUnorderedMapItr& other) : m_baseItr(other.m_baseItr) { }
+
+    bool operator==(const TUnorderedMapItr& other) const { return m_baseItr == other.m_baseItr; }
+    bool operator!=(const TUnorderedMapItr& other) const { return m_baseItr != other.m_baseItr; }
+    TUnorderedMapItr& operator++(void) { ++m_baseItr; return *this; }
+    V& operator*(void) const { return m_baseItr->second; }
+    Pair* operator->(void) const { return m_baseItr.operator->(); }
+
+private:
+
+    TUnorderedMapItr(const BaseItr& baseItr) : m_baseItr(baseItr) { }
+
+    BaseItr m_baseItr;
+};
+
+template <typename K, typename V>
+class TUnorderedMapConstItr
+{
+    typedef TUnorderedMapPair<K, V> Pair;
+    typedef THashTableConstItr<Pair> BaseItr;
+    template <typename K, typename V, typename H, typename E> friend class TUnorderedMap;
+
+public:
+
+    TUnorderedMapConstItr(void) { }
+    TUnorderedMapConstItr(const TUnorderedMapConstItr& other) : m_baseItr(other.m_baseItr) { }
+    TUnorderedMapConstItr(const TUnorderedMapItr<K, V>& other) : m_baseItr(other.m_baseItr) { }
+
+    bool operator==(const TUnorderedMapConstItr& other) const { return m_baseItr == other.m_baseItr; }
+    bool operator!=(const TUnorderedMapConstItr& other) const { return m_baseItr != other.m_baseItr; }
+    TUnorderedMapConstItr& operator++(void) { ++m_baseItr; return *this; }
+    const V& operator*(void) const { return m_baseItr->second; }
+    const Pair* operator->(void) const { return m_baseItr.operator->(); }
+
+private:
+
+    TUnorderedMapConstItr(const BaseItr& baseItr) : m_baseItr(baseItr) { }
+
+    BaseItr m_baseItr;
+};
+
+template <typename K, typename V, typename H, typename E>
+class TUnorderedMap : private THashTable<TUnorderedMapPair<K, V>, H, E>
+{
+    typedef TUnorderedMapPair<K, V> Pair;
+    typedef THashTable<Pair, H, E> Table;
+
+public:
+
+    typedef TUnorderedMapItr<K, V> iterator;
+    typedef TUnorderedMapConstItr<K, V> const_iterator;
+
+    // Insert the pair, or overwrite the value if key is present. Returns
+    // where the pair is and whether key was new.
+    //
+    std::pair<iterator, bool> insert(const K& key, const V& value) { return insert_or_assign(key, value); }
+    std::pair<iterator, bool> insert(K&& key, V&& value) { return insert_or_assign(std::move(key), std::move(value)); }
+    template <typename M> std::pair<iterator, bool> insert_or_assign(const K& key, M&& value);
+    template <typename M> std::pair<iterator, bool> insert_or_assign(K&& key, M&& value);
+
+    // Build the value from args in the new pair if key is absent; if it is
+    // present nothing is constructed and args are left untouched.
+    //
+    template <typename... Args> std::pair<iterator, bool> try_emplace(const K& key, Args&&... args);
+    template <typename... Args> std::pair<iterator, bool> try_emplace(K&& key, Args&&... args);
+
+    // The value for key, default-constructed in place if key is absent.
+    //
+    V& operator[](const K& key) { return *try_emplace(key).first; }
+    V& operator[](K&& key) { return *try_emplace(std::move(key)).first; }
+
+    void erase(const K& key) { Table::erase(key); }
+    void erase(iterator itr) { Table::erase(itr.m_baseItr); }
+    void erase(const_iterator itr) { Table::erase(itr.m_baseItr); }
+    void clear(void) { Table::clear(); }
+
+    // Copies rebuild the table in O(n); moves and swap are O(1).
+    //
+    void swap(TUnorderedMap& other) { Table::swap(static_cast<Table&>(other)); }
+
+    // Make room for count pairs, so that inserting up to count moves no pair.
+    //
+    void reserve(size_t count) { Table::reserve(count); }
+
+    iterator find(const K& key) { return iterator(Table::find(key)); }
+    iterator begin(void) { return iterator(Table::begin()); }
+    iterator end(void) { return iterator(Table::end()); }
+
+    const_iterator find(const K& key) const { return const_iterator(Table::find(key)); }
+    const_iterator begin(void) const { return const_iterator(Table::begin()); }
+    const_iterator end(void) const { return const_iterator(Table::end()); }
+
+    // Heterogeneous lookups, available when H and E are transparent.
+    //
+    template <typename Q> iterator find(const Q& key, typename THashTableTransparent<H, E, Q>::Type* = NULL) { return iterator(Table::find(key)); }
+    template <typename Q> const_iterator find(const Q& key, typename THashTableTransparent<H, E, Q>::Type* = NULL) const { return const_iterator(Table::find(key)); }
+    template <typename Q> void erase(const Q& key, typename THashTableTransparent<H, E, Q>::Type* = NULL) { Table::erase(key); }
+
+    size_t size(void) const { return Table::size(); }
+};
+
+// TUnorderedMap
+//
+template <typename K, typename V, typename H, typename E>
+template <typename M>
+std::pair<typename TUnorderedMap<K, V, H, E>::iterator, bool>
+TUnorderedMap<K, V, H, E>::insert_or_assign(const K& key, M&& value)
+{
+    std::pair<typename Table::iterator, bool> result = Table::try_emplace(key, TUnorderedMapEmplace(), key, std::forward<M>(value));
+
+    if (!result.second)
+        result.first->second = std::forward<M>(value);
+
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename H, typename E>
+template <typename M>
+std::pair<typename TUnorderedMap<K, V, H, E>::iterator, bool>
+TUnorderedMap<K, V, H, E>::insert_or_assign(K&& key, M&& value)
+{
+    std::pair<typename Table::iterator, bool> result = Table::try_emplace(key, TUnorderedMapEmplace(), std::move(key), std::forward<M>(value));
+
+    if (!result.second)
+        result.first->second = std::forward<M>(value);
+
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename H, typename E>
+template <typename... Args>
+std::pair<typename TUnorderedMap<K, V, H, E>::iterator, bool>
+TUnorderedMap<K, V, H, E>::try_emplace(const K& key, Args&&... args)
+{
+    std::pair<typename Table::iterator, bool> result = Table::try_emplace(key, TUnorderedMapEmplace(), key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+template <typename K, typename V, typename H, typename E>
+template <typename... Args>
+std::pair<typename TUnorderedMap<K, V, H, E>::iterator, bool>
+TUnorderedMap<K, V, H, E>::try_emplace(K&& key, Args&&... args)
+{
+    std::pair<typename Table::iterator, bool> result = Table::try_emplace(key, TUnorderedMapEmplace(), std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
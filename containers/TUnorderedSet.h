@@ -0,0 +1,52 @@
+/*
+Copyright 2016 Tom Kim
+Implementation of an unordered set container backed by a THashTable, with the
+interface of TSet minus the ordered operations.
+
+Lookups, inserts and erases take O(1) expected time. Iteration visits the keys
+in slot order, and an insert that grows the table invalidates all iterators;
+see THashTable. Keys are hashed with H and compared with E; when both are
+transparent, as THashTableHash and THashTableEqual are for std::string, the
+lookups also accept other key types, e.g. a TUnorderedSet<std::string> can be
+searched by const char* without building a string.
+*/
+#pragma once
+
+#include "THashTable.h"
+
+template <typename K, typename H = THashTableHash<K>, typename E = THashTableEqual<K> >
+class TUnorderedSet : private THashTable<K, H, E>
+{
+    typedef THashTable<K, H, E> Table;
+
+public:
+
+    // keys cannot be changed in place, so both iterators are const
+    typedef typename Table::const_iterator iterator;
+    typedef typename Table::const_iterator const_iterator;
+
+    std::pair<iterator, bool> insert(const K& key) { return Table::insert(key); }
+    std::pair<iterator, bool> insert(K&& key) { return Table::insert(std::move(key)); }
+    void erase(const K& key) { Table::erase(key); }
+    void erase(const_iterator itr) { Table::erase(itr); }
+    void clear(void) { Table::clear(); }
+
+    // Copies rebuild the table in O(n); moves and swap are O(1).
+    //
+    void swap(TUnorderedSet& other) { Table::swap(static_cast<Table&>(other)); }
+
+    // Make room for count keys, so that inserting up to count moves no key.
+    //
+    void reserve(size_t count) { Table::reserve(count); }
+
+    const_iterator find(const K& key) const { return Table::find(key); }
+    const_iterator begin(void) const { return Table::begin(); }
+    const_iterator end(void) const { return Table::end(); }
+
+    // Heterogeneous lookups, available when H and E are transparent.
+    //
+    template <typename Q> const_iterator find(const Q& key, typename THashTableTransparent<H, E, Q>::Type* = NULL) const { return Table::find(key); }
+    template <typename Q> void erase(const Q& key, typename THashTableTransparent<H, E, Q>::Type* = NULL) { Table::erase(key); }
+
+    size_t size(void) const { return Table::size(); }
+};